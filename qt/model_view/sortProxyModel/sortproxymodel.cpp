@@ -8,388 +8,2926 @@
 */
 
 #include "sortproxymodel.h"
+#include <QDateTime>
 #include <QDebug>
+#include <QMutex>
+#include <QSemaphore>
+#include <QThreadPool>
 #include <QVariant>
+#include <functional>
 #include <iterator>
+#include <limits>
+#include <optional>
 
 #include <private/qabstractitemmodel_p.h>
 
 namespace
 {
-void buildReverseMap(const std::vector<int> &aToB, std::vector<int> &bToA)
+// longestIncreasingSubsequence and runConcurrently are kept identical to the copies in UpdateableModel.h
+/**
+ * @brief Finds a longest strictly increasing subsequence in @p values
+ * @returns for every entry in @p values whether it is part of the subsequence
+ *
+ * Runs in O(n log n). If there are several subsequences of maximum length, the one that picks
+ * the earliest possible entries is returned.
+ */
+std::vector<bool> longestIncreasingSubsequence(const std::vector<int> &values)
+{
+    const int size = static_cast<int>(values.size());
+
+    // lengthFrom[i] is the length of the longest increasing subsequence starting at i. It is
+    // computed from the back, so heads[len - 1] holds the largest value any increasing
+    // subsequence of length len found so far starts with. heads is decreasing.
+    std::vector<int> lengthFrom(values.size());
+    std::vector<int> heads;
+    for (int i = size - 1; i >= 0; --i)
+    {
+        const auto it = std::lower_bound(heads.begin(), heads.end(), values[i], std::greater<int>());
+        lengthFrom[i] = static_cast<int>(it - heads.begin()) + 1;
+        if (it == heads.end())
+            heads.push_back(values[i]);
+        else
+            *it = values[i];
+    }
+
+    std::vector<bool> inSubsequence(values.size(), false);
+    int remaining = static_cast<int>(heads.size());
+    int previous = std::numeric_limits<int>::min();
+    for (int i = 0; i < size && remaining > 0; ++i)
+    {
+        if (lengthFrom[i] == remaining && values[i] > previous)
+        {
+            inSubsequence[i] = true;
+            previous = values[i];
+            --remaining;
+        }
+    }
+    return inSubsequence;
+}
+
+/**
+ * Runs task(0) ... task(count - 1), using idle threads of the global thread pool where available
+ * and the calling thread otherwise. Returns once all tasks have finished.
+ */
+void runConcurrently(int count, const std::function<void(int)> &task)
+{
+    QSemaphore finished;
+    for (int i = 1; i < count; ++i)
+    {
+        const bool started = QThreadPool::globalInstance()->tryStart([&task, &finished, i]() {
+            task(i);
+            finished.release();
+        });
+        if (!started)
+        {
+            task(i);
+            finished.release();
+        }
+    }
+    task(0);
+    finished.release();
+    finished.acquire(count);
+}
+
+/**
+ * Compares two values the way QSortFilterProxyModel does. Strings are compared using @p collator if
+ * one is given, which then determines the case sensitivity as well.
+ */
+bool variantLessThan(const QVariant &lhs, const QVariant &rhs, Qt::CaseSensitivity caseSensitivity,
+                     const QCollator *collator = nullptr)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    if (lhs.typeId() == QMetaType::QString && rhs.typeId() == QMetaType::QString)
+#else
+    if (lhs.type() == QVariant::String && rhs.type() == QVariant::String)
+#endif
+    {
+        if (collator)
+            return collator->compare(lhs.toString(), rhs.toString()) < 0;
+        return QString::compare(lhs.toString(), rhs.toString(), caseSensitivity) < 0;
+    }
+    else
+    {
+        return QAbstractItemModelPrivate::isVariantLessThan(lhs, rhs, caseSensitivity, false);
+    }
+}
+
+bool hasSameCollation(const QCollator &lhs, const QCollator &rhs)
+{
+    return lhs.locale() == rhs.locale() && lhs.numericMode() == rhs.numericMode()
+        && lhs.ignorePunctuation() == rhs.ignorePunctuation();
+}
+
+/**
+ * @returns a collator with the same settings as @p collator that does not share its data. Copies of a
+ * QCollator share their data, and must not be used on different threads at the same time.
+ */
+QCollator detachedCollator(const QCollator &collator)
+{
+    QCollator copy(collator.locale());
+    copy.setCaseSensitivity(collator.caseSensitivity());
+    copy.setNumericMode(collator.numericMode());
+    copy.setIgnorePunctuation(collator.ignorePunctuation());
+    return copy;
+}
+
+/**
+ * Sorts [begin, end) by sorting one chunk per pool thread concurrently, and then merging
+ * neighbouring chunks pairwise until a single sorted range remains. Each merge level runs
+ * concurrently as well.
+ */
+template<typename Compare>
+void parallelSort(std::vector<int>::iterator begin, std::vector<int>::iterator end, const Compare &compare)
+{
+    constexpr std::ptrdiff_t minimumChunkSize = 4096;
+    const std::ptrdiff_t size = std::distance(begin, end);
+    const int chunkCount = int(std::max<std::ptrdiff_t>(
+        1, std::min<std::ptrdiff_t>(QThreadPool::globalInstance()->maxThreadCount(), size / minimumChunkSize)));
+    if (chunkCount == 1)
+    {
+        std::sort(begin, end, compare);
+        return;
+    }
+
+    std::vector<std::vector<int>::iterator> bounds;
+    bounds.reserve(chunkCount + 1);
+    for (int i = 0; i <= chunkCount; ++i)
+        bounds.push_back(begin + size * i / chunkCount);
+
+    runConcurrently(chunkCount, [&bounds, &compare](int chunk) {
+        std::sort(bounds[chunk], bounds[chunk + 1], compare);
+    });
+
+    for (int width = 1; width < chunkCount; width *= 2)
+    {
+        const int mergeCount = (chunkCount + 2 * width - 1) / (2 * width);
+        runConcurrently(mergeCount, [&bounds, &compare, width, chunkCount](int merge) {
+            const int first = merge * 2 * width;
+            const int middle = std::min(first + width, chunkCount);
+            const int last = std::min(first + 2 * width, chunkCount);
+            if (middle < last)
+                std::inplace_merge(bounds[first], bounds[middle], bounds[last], compare);
+        });
+    }
+}
+}
+
+/**
+ * @brief The SortProxyModel::RowSequence class holds the handles of rows in a given order, such as the
+ * order of the source model or that of the proxy
+ *
+ * The sequence is an implicit treap: a binary tree in sequence order, kept balanced by giving every
+ * node a pseudo random priority that is never lower than those of its children, where every node
+ * knows the size of its subtree. Finding the handle at a position or the position of a handle, and
+ * inserting, removing or moving a range of k rows take O(log n) steps plus O(k) for the rows
+ * themselves. The nodes are stored by handle, which makes the node of a handle a plain lookup.
+ */
+class SortProxyModel::RowSequence
+{
+public:
+    int size() const { return sizeOf(m_root); }
+    quint64 generation() const { return m_generation; }
+    int capacity() const { return static_cast<int>(m_nodes.size()); }
+    bool contains(int handle) const { return handle >= 0 && handle < capacity() && m_nodes[handle].size > 0; }
+    int at(int position) const;
+    int positionOf(int handle) const;
+    int next(int handle) const;
+    std::vector<int> handles(int first, int last) const;
+    std::vector<int> toVector() const { return handles(0, size() - 1); }
+    std::vector<int> positions() const;
+    template<class Less>
+    int lowerBound(int handle, const Less &less) const;
+
+    void insert(int position, int handle);
+    void insert(int position, std::vector<int>::const_iterator begin, std::vector<int>::const_iterator end);
+    void remove(int first, int last);
+    void move(int first, int last, int destination);
+    void assign(std::vector<int>::const_iterator begin, std::vector<int>::const_iterator end);
+    void clear();
+
+private:
+    struct Node
+    {
+        int left = -1;
+        int right = -1;
+        int parent = -1;
+        int size = 0; // 0 if the handle is not part of the sequence
+    };
+
+    static quint32 priority(int handle);
+    int sizeOf(int node) const { return node < 0 ? 0 : m_nodes[node].size; }
+    void update(int node);
+    void setRoot(int node);
+    std::pair<int, int> split(int node, int count);
+    int merge(int lhs, int rhs);
+    int build(std::vector<int>::const_iterator begin, std::vector<int>::const_iterator end);
+    void release(int node);
+
+    std::vector<Node> m_nodes; // by handle
+    int m_root = -1;
+    quint64 m_generation = 1; // changes whenever the sequence does
+};
+
+/**
+ * @returns the handle at @p position, which must be within the sequence
+ */
+int SortProxyModel::RowSequence::at(int position) const
+{
+    int node = m_root;
+    for (;;)
+    {
+        const Node &current = m_nodes[node];
+        const int leftSize = sizeOf(current.left);
+        if (position == leftSize)
+            return node;
+        if (position < leftSize)
+        {
+            node = current.left;
+        }
+        else
+        {
+            position -= leftSize + 1;
+            node = current.right;
+        }
+    }
+}
+
+/**
+ * @returns the position of @p handle, which must be part of the sequence
+ */
+int SortProxyModel::RowSequence::positionOf(int handle) const
+{
+    int position = sizeOf(m_nodes[handle].left);
+    for (int node = handle; m_nodes[node].parent >= 0; node = m_nodes[node].parent)
+    {
+        const Node &parent = m_nodes[m_nodes[node].parent];
+        if (parent.right == node)
+            position += sizeOf(parent.left) + 1;
+    }
+    return position;
+}
+
+/**
+ * @returns the handle after @p handle, or -1 if @p handle is the last one. Walking through n rows
+ * this way takes O(n) steps in total.
+ */
+int SortProxyModel::RowSequence::next(int handle) const
+{
+    int node = m_nodes[handle].right;
+    if (node >= 0)
+    {
+        while (m_nodes[node].left >= 0)
+            node = m_nodes[node].left;
+        return node;
+    }
+    node = handle;
+    while (m_nodes[node].parent >= 0 && m_nodes[m_nodes[node].parent].right == node)
+        node = m_nodes[node].parent;
+    return m_nodes[node].parent;
+}
+
+/**
+ * @returns the handles at the positions @p first to @p last
+ */
+std::vector<int> SortProxyModel::RowSequence::handles(int first, int last) const
+{
+    std::vector<int> result;
+    if (first > last)
+        return result;
+
+    result.reserve(static_cast<std::size_t>(last - first + 1));
+    result.push_back(at(first));
+    for (int position = first; position < last; ++position)
+        result.push_back(next(result.back()));
+    return result;
+}
+
+/**
+ * @returns the position of every handle, indexed by handle, with -1 for the handles that are not part
+ * of the sequence. Takes O(n) steps, so it pays off when looking up a large part of the rows.
+ */
+std::vector<int> SortProxyModel::RowSequence::positions() const
+{
+    std::vector<int> result(m_nodes.size(), -1);
+    if (m_root < 0)
+        return result;
+
+    int handle = m_root;
+    while (m_nodes[handle].left >= 0)
+        handle = m_nodes[handle].left;
+    for (int position = 0; handle >= 0; ++position, handle = next(handle))
+        result[handle] = position;
+    return result;
+}
+
+/**
+ * @returns the number of handles in front of the first one that does not sort before @p handle, in a
+ * sequence that is sorted according to @p less. Takes O(log n) comparisons.
+ */
+template<class Less>
+int SortProxyModel::RowSequence::lowerBound(int handle, const Less &less) const
+{
+    int position = 0;
+    int node = m_root;
+    while (node >= 0)
+    {
+        if (less(node, handle))
+        {
+            position += sizeOf(m_nodes[node].left) + 1;
+            node = m_nodes[node].right;
+        }
+        else
+        {
+            node = m_nodes[node].left;
+        }
+    }
+    return position;
+}
+
+/**
+ * Inserts @p handle, which must not be part of the sequence yet, at @p position.
+ */
+void SortProxyModel::RowSequence::insert(int position, int handle)
+{
+    if (handle >= capacity())
+        m_nodes.resize(static_cast<std::size_t>(handle) + 1);
+    m_nodes[handle] = Node();
+    m_nodes[handle].size = 1;
+    const auto parts = split(m_root, position);
+    setRoot(merge(merge(parts.first, handle), parts.second));
+}
+
+/**
+ * Inserts the handles in [begin, end), none of which may be part of the sequence yet, at @p position.
+ */
+void SortProxyModel::RowSequence::insert(int position, std::vector<int>::const_iterator begin,
+                                         std::vector<int>::const_iterator end)
+{
+    if (begin == end)
+        return;
+
+    const int inserted = build(begin, end);
+    const auto parts = split(m_root, position);
+    setRoot(merge(merge(parts.first, inserted), parts.second));
+}
+
+/**
+ * Removes the handles at the positions @p first to @p last.
+ */
+void SortProxyModel::RowSequence::remove(int first, int last)
+{
+    const auto front = split(m_root, first);
+    const auto removed = split(front.second, last - first + 1);
+    release(removed.first);
+    setRoot(merge(front.first, removed.second));
+}
+
+/**
+ * Moves the handles at the positions @p first to @p last to just before @p destination, which is a
+ * position before the move, like for QAbstractItemModel::beginMoveRows().
+ */
+void SortProxyModel::RowSequence::move(int first, int last, int destination)
+{
+    const int count = last - first + 1;
+    const auto front = split(m_root, first);
+    const auto moved = split(front.second, count);
+    const int rest = merge(front.first, moved.second);
+    const auto parts = split(rest, destination > last ? destination - count : destination);
+    setRoot(merge(merge(parts.first, moved.first), parts.second));
+}
+
+/**
+ * Replaces the sequence with the handles in [begin, end). Takes O(n) steps.
+ */
+void SortProxyModel::RowSequence::assign(std::vector<int>::const_iterator begin, std::vector<int>::const_iterator end)
+{
+    release(m_root);
+    setRoot(build(begin, end));
+}
+
+/**
+ * Empties the sequence, and forgets about all handles.
+ */
+void SortProxyModel::RowSequence::clear()
+{
+    m_nodes.clear();
+    m_root = -1;
+    ++m_generation;
+}
+
+quint32 SortProxyModel::RowSequence::priority(int handle)
+{
+    // the finalizer of MurmurHash3, which maps distinct handles to distinct, well mixed priorities
+    auto hash = static_cast<quint32>(handle);
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+void SortProxyModel::RowSequence::update(int node)
+{
+    Node &current = m_nodes[node];
+    current.size = 1 + sizeOf(current.left) + sizeOf(current.right);
+    if (current.left >= 0)
+        m_nodes[current.left].parent = node;
+    if (current.right >= 0)
+        m_nodes[current.right].parent = node;
+}
+
+void SortProxyModel::RowSequence::setRoot(int node)
+{
+    ++m_generation;
+    m_root = node;
+    if (node >= 0)
+        m_nodes[node].parent = -1;
+}
+
+/**
+ * Splits the subtree of @p node into one with its first @p count handles, and one with the others.
+ * @returns the roots of both, which are -1 if empty
+ */
+std::pair<int, int> SortProxyModel::RowSequence::split(int node, int count)
+{
+    if (node < 0)
+        return {-1, -1};
+
+    const int leftSize = sizeOf(m_nodes[node].left);
+    if (count <= leftSize)
+    {
+        const auto parts = split(m_nodes[node].left, count);
+        m_nodes[node].left = parts.second;
+        update(node);
+        return {parts.first, node};
+    }
+    const auto parts = split(m_nodes[node].right, count - leftSize - 1);
+    m_nodes[node].right = parts.first;
+    update(node);
+    return {node, parts.second};
+}
+
+/**
+ * Joins the subtrees of @p lhs and @p rhs, with all handles of @p lhs in front. @returns the root
+ */
+int SortProxyModel::RowSequence::merge(int lhs, int rhs)
+{
+    if (lhs < 0)
+        return rhs;
+    if (rhs < 0)
+        return lhs;
+
+    if (priority(lhs) > priority(rhs))
+    {
+        const int right = merge(m_nodes[lhs].right, rhs);
+        m_nodes[lhs].right = right;
+        update(lhs);
+        return lhs;
+    }
+    const int left = merge(lhs, m_nodes[rhs].left);
+    m_nodes[rhs].left = left;
+    update(rhs);
+    return rhs;
+}
+
+/**
+ * Builds a subtree of the handles in [begin, end) in O(n) steps, by keeping the path from the root to
+ * the last handle added on a stack. @returns the root
+ */
+int SortProxyModel::RowSequence::build(std::vector<int>::const_iterator begin, std::vector<int>::const_iterator end)
+{
+    if (begin == end)
+        return -1;
+
+    const int maximumHandle = *std::max_element(begin, end);
+    if (maximumHandle >= capacity())
+        m_nodes.resize(static_cast<std::size_t>(maximumHandle) + 1);
+
+    std::vector<int> path;
+    for (auto it = begin; it != end; ++it)
+    {
+        const int handle = *it;
+        m_nodes[handle] = Node();
+        int lastPopped = -1;
+        while (!path.empty() && priority(path.back()) < priority(handle))
+        {
+            lastPopped = path.back();
+            path.pop_back();
+        }
+        m_nodes[handle].left = lastPopped;
+        if (!path.empty())
+            m_nodes[path.back()].right = handle;
+        path.push_back(handle);
+    }
+
+    // the size of a subtree is only known once those of both children are, so visit them first
+    std::vector<std::pair<int, bool>> stack{{path.front(), false}};
+    while (!stack.empty())
+    {
+        const auto entry = stack.back();
+        stack.pop_back();
+        if (entry.second)
+        {
+            update(entry.first);
+            continue;
+        }
+        stack.emplace_back(entry.first, true);
+        const Node &node = m_nodes[entry.first];
+        if (node.left >= 0)
+            stack.emplace_back(node.left, false);
+        if (node.right >= 0)
+            stack.emplace_back(node.right, false);
+    }
+    m_nodes[path.front()].parent = -1;
+    return path.front();
+}
+
+/**
+ * Resets the nodes of the subtree of @p node, taking its handles out of the sequence.
+ */
+void SortProxyModel::RowSequence::release(int node)
+{
+    if (node < 0)
+        return;
+
+    std::vector<int> stack{node};
+    while (!stack.empty())
+    {
+        const int handle = stack.back();
+        stack.pop_back();
+        if (m_nodes[handle].left >= 0)
+            stack.push_back(m_nodes[handle].left);
+        if (m_nodes[handle].right >= 0)
+            stack.push_back(m_nodes[handle].right);
+        m_nodes[handle] = Node();
+    }
+}
+
+/**
+ * @brief The SortProxyModel::SortKeyCache class holds the sort keys of every source row
+ *
+ * Fetching the sort role through QAbstractItemModel::data() and comparing the resulting
+ * QVariants on every comparison made during a sort is expensive. Instead, the sort keys of
+ * each source row are extracted once and kept here, indexed by the handle of the row. There is
+ * one key per sort criterion, and rows are compared lexicographically on them.
+ *
+ * Rows with equal keys are ordered by their source row, which makes the sort order a strict
+ * total order. That keeps the proxy stable and allows the change handlers to locate rows
+ * using the keys alone.
+ *
+ * Each cache holds the rows below a single source parent.
+ */
+class SortProxyModel::SortKeyCache
+{
+public:
+    explicit SortKeyCache(const RowSequence &sourceOrder)
+        : m_sourceOrder(&sourceOrder)
+    {
+    }
+
+    void rebuild(const QAbstractItemModel *model, const QModelIndex &parent, const QVector<SortCriterion> &criteria,
+                 const QCollator &collator);
+    void setCriteria(const QVector<SortCriterion> &criteria, const QCollator &collator);
+    void detachCollators();
+    void freezeSourceOrder();
+
+    void insertRows(int firstRow, const std::vector<int> &handles);
+    void removeRows(const std::vector<int> &handles);
+    bool updateRows(int firstRow, const std::vector<int> &handles, int firstColumn, int lastColumn,
+                    const QVector<int> &roles, std::vector<int> &changedHandles);
+
+    bool lessThan(int lhs, int rhs) const;
+    bool primaryValueLessThan(const QVariant &lhs, const QVariant &rhs, Qt::CaseSensitivity caseSensitivity) const;
+    void sort(std::vector<int>::iterator begin, std::vector<int>::iterator end, int parallelSortThreshold = 0) const;
+    void partialSort(std::vector<int>::iterator begin, std::vector<int>::iterator middle,
+                     std::vector<int>::iterator end) const;
+
+private:
+    class Key;
+
+    /**
+     * Orders rows with equal keys by their source row, either looked up in the source order one at a
+     * time, or in a table of the source rows of all rows, indexed by handle.
+     */
+    struct SourceRowLess
+    {
+        const RowSequence *sourceOrder = nullptr;
+        const std::vector<int> *sourceRows = nullptr;
+
+        bool operator()(int lhs, int rhs) const
+        {
+            if (sourceRows)
+                return (*sourceRows)[lhs] < (*sourceRows)[rhs];
+            return sourceOrder->positionOf(lhs) < sourceOrder->positionOf(rhs);
+        }
+    };
+
+    SourceRowLess sourceRowLess() const;
+    SourceRowLess sourceRowLess(std::ptrdiff_t rowCount, std::vector<int> &sourceRows) const;
+    bool lessThan(int lhs, int rhs, const SourceRowLess &sourceRowLess) const;
+
+    template<class Compare>
+    static void sortRange(std::vector<int>::iterator begin, std::vector<int>::iterator end, const Compare &compare,
+                          int parallelSortThreshold)
+    {
+        if (parallelSortThreshold > 0 && std::distance(begin, end) >= parallelSortThreshold)
+            parallelSort(begin, end, compare);
+        else
+            std::sort(begin, end, compare);
+    }
+
+    const QAbstractItemModel *m_model = nullptr;
+    QPersistentModelIndex m_parent;
+    const RowSequence *m_sourceOrder; // null once the source rows are frozen
+    std::vector<int> m_sourceRows; // the source row of every handle, once frozen
+    std::vector<Key> m_keys;
+};
+
+/**
+ * @brief The SortProxyModel::SortKeyCache::Key class holds the key of a single sort criterion
+ *
+ * If all keys share the same integer, floating point, string or date/time type, they are
+ * stored as plain values of that type, so comparisons do not involve QVariant at all. Mixed
+ * or other types are stored as QVariant and compared the way QSortFilterProxyModel does.
+ *
+ * For locale aware criteria, strings are stored as their QCollatorSortKey. Computing those is
+ * expensive, but happens only once per row, and comparing them is about as cheap as comparing
+ * bytes.
+ *
+ * The keys are indexed by handle. Slots of removed rows are kept until their handle is reused.
+ */
+class SortProxyModel::SortKeyCache::Key
+{
+public:
+    Key(const QAbstractItemModel *model, const QPersistentModelIndex &parent, const RowSequence *sourceOrder,
+        const SortCriterion &criterion, const QCollator &collator);
+
+    bool hasSameSource(const SortCriterion &criterion, const QCollator &collator) const;
+    void setSortOrder(Qt::SortOrder order) { m_descending = (order == Qt::DescendingOrder); }
+    bool isAffectedBy(int firstColumn, int lastColumn, const QVector<int> &roles) const;
+    void detachCollator()
+    {
+        if (m_collator)
+            m_collator = detachedCollator(*m_collator);
+    }
+
+    void reload();
+    void insertRows(int firstRow, const std::vector<int> &handles);
+    void removeRows(const std::vector<int> &handles);
+    bool updateRows(int firstRow, const std::vector<int> &handles, std::vector<bool> &changed);
+
+    int compare(int lhs, int rhs) const;
+    bool valueLessThan(const QVariant &lhs, const QVariant &rhs) const
+    {
+        return variantLessThan(lhs, rhs, m_caseSensitivity, m_collator ? &*m_collator : nullptr);
+    }
+    template<class Visitor>
+    auto visitOrdered(const Visitor &visitor, const SourceRowLess &sourceRowLess) const;
+
+private:
+    enum class KeyType
+    {
+        None,
+        Integer,
+        Double,
+        String,
+        CollatedString,
+        DateTime,
+        Variant
+    };
+
+    KeyType keyTypeFor(int userType) const;
+    QVariant fetch(int row) const;
+    bool storeKey(int handle, const QVariant &value);
+    void resize(int size);
+
+    template<class Less>
+    bool orderedLessThan(const Less &less, int lhs, int rhs, const SourceRowLess &sourceRowLess) const
+    {
+        if (less(lhs, rhs))
+            return !m_descending;
+        if (less(rhs, lhs))
+            return m_descending;
+        return sourceRowLess(lhs, rhs);
+    }
+
+    template<class Function>
+    void forActiveKeys(const Function &function)
+    {
+        switch (m_keyType)
+        {
+        case KeyType::Integer:
+        case KeyType::DateTime:
+            return function(m_integerKeys);
+        case KeyType::Double:
+            return function(m_doubleKeys);
+        case KeyType::String:
+            return function(m_stringKeys);
+        case KeyType::Variant:
+            return function(m_variantKeys);
+        case KeyType::CollatedString: // handled separately, as QCollatorSortKey is not default constructible
+        case KeyType::None:
+            break;
+        }
+    }
+
+    template<class Visitor>
+    auto visit(const Visitor &visitor) const
+    {
+        switch (m_keyType)
+        {
+        case KeyType::Integer:
+        case KeyType::DateTime:
+            return visitor([this](int lhs, int rhs) { return m_integerKeys[lhs] < m_integerKeys[rhs]; });
+        case KeyType::Double:
+            return visitor([this](int lhs, int rhs) { return m_doubleKeys[lhs] < m_doubleKeys[rhs]; });
+        case KeyType::String:
+            return visitor([this](int lhs, int rhs) { return m_stringKeys[lhs] < m_stringKeys[rhs]; });
+        case KeyType::CollatedString:
+            return visitor([this](int lhs, int rhs) { return m_collatedKeys[lhs] < m_collatedKeys[rhs]; });
+        case KeyType::Variant:
+        {
+            const QCollator *collator = m_collator ? &*m_collator : nullptr;
+            return visitor([this, collator](int lhs, int rhs) {
+                return variantLessThan(m_variantKeys[lhs], m_variantKeys[rhs], m_caseSensitivity, collator);
+            });
+        }
+        case KeyType::None:
+            break;
+        }
+        return visitor([](int, int) { return false; });
+    }
+
+    const QAbstractItemModel *m_model = nullptr;
+    QPersistentModelIndex m_parent;
+    const RowSequence *m_sourceOrder = nullptr;
+    int m_column = 0;
+    int m_role = Qt::DisplayRole;
+    Qt::CaseSensitivity m_caseSensitivity = Qt::CaseSensitive;
+    bool m_descending = false;
+    std::optional<QCollator> m_collator; // only set for locale aware criteria
+
+    KeyType m_keyType = KeyType::None;
+    int m_userType = 0;
+    std::vector<qint64> m_integerKeys; // also used for date/time values, as msecs since epoch
+    std::vector<double> m_doubleKeys;
+    std::vector<QString> m_stringKeys; // case folded if sorting case insensitive
+    std::vector<QCollatorSortKey> m_collatedKeys;
+    std::vector<QVariant> m_variantKeys;
+};
+
+/**
+ * @returns a negative value if the row with handle @p lhs sorts before that with handle @p rhs, a
+ * positive value if it sorts after, and 0 if their keys are equal. Takes the sort order into account.
+ */
+inline int SortProxyModel::SortKeyCache::Key::compare(int lhs, int rhs) const
+{
+    return visit([this, lhs, rhs](const auto &less) {
+        if (less(lhs, rhs))
+            return m_descending ? 1 : -1;
+        if (less(rhs, lhs))
+            return m_descending ? -1 : 1;
+        return 0;
+    });
+}
+
+/**
+ * Calls @p visitor with a strict less-than comparator on handles that takes the sort order and
+ * @p sourceRowLess for equal keys into account, specialized for the storage type.
+ */
+template<class Visitor>
+auto SortProxyModel::SortKeyCache::Key::visitOrdered(const Visitor &visitor, const SourceRowLess &sourceRowLess) const
+{
+    return visit([this, &visitor, &sourceRowLess](const auto &less) {
+        return visitor([this, &less, &sourceRowLess](int lhs, int rhs) {
+            return orderedLessThan(less, lhs, rhs, sourceRowLess);
+        });
+    });
+}
+
+/**
+ * Rebuilds the key cache for all rows below @p parent in @p model. Without @p criteria, the model
+ * is not sorted, in which case no keys are kept and rows are ordered by their source row.
+ */
+void SortProxyModel::SortKeyCache::rebuild(const QAbstractItemModel *model, const QModelIndex &parent,
+                                           const QVector<SortCriterion> &criteria, const QCollator &collator)
+{
+    m_model = model;
+    m_parent = parent;
+    m_keys.clear();
+    setCriteria(criteria, collator);
+}
+
+/**
+ * Changes the sort criteria, with @p collator used for the locale aware ones. Keys of criteria that
+ * only changed their sort order are kept, all others are reloaded from the model.
+ */
+void SortProxyModel::SortKeyCache::setCriteria(const QVector<SortCriterion> &criteria, const QCollator &collator)
+{
+    const int count = m_model ? int(criteria.size()) : 0;
+    if (int(m_keys.size()) > count)
+        m_keys.erase(m_keys.begin() + count, m_keys.end());
+
+    for (int i = 0; i < count; ++i)
+    {
+        const SortCriterion &criterion = criteria.at(i);
+        if (i == int(m_keys.size()))
+            m_keys.emplace_back(m_model, m_parent, m_sourceOrder, criterion, collator);
+        else if (!m_keys[i].hasSameSource(criterion, collator))
+            m_keys[i] = Key(m_model, m_parent, m_sourceOrder, criterion, collator);
+        else
+            m_keys[i].setSortOrder(criterion.order);
+    }
+}
+
+/**
+ * Gives every key its own collator, so a copy of the cache can be used on another thread while the
+ * original is still in use.
+ */
+void SortProxyModel::SortKeyCache::detachCollators()
+{
+    for (Key &key : m_keys)
+        key.detachCollator();
+}
+
+/**
+ * Takes a table of the source rows of all rows, so a copy of the cache can order rows with equal keys
+ * on another thread while the source order changes. The keys cannot be reloaded afterwards.
+ */
+void SortProxyModel::SortKeyCache::freezeSourceOrder()
+{
+    m_sourceRows = m_sourceOrder->positions();
+    m_sourceOrder = nullptr;
+}
+
+/**
+ * Loads the keys of the source rows from @p firstRow on, which have just been inserted into the source
+ * model and the source order with @p handles.
+ */
+void SortProxyModel::SortKeyCache::insertRows(int firstRow, const std::vector<int> &handles)
+{
+    for (Key &key : m_keys)
+        key.insertRows(firstRow, handles);
+}
+
+/**
+ * Releases the keys of the rows with @p handles, which have been removed from the source model.
+ */
+void SortProxyModel::SortKeyCache::removeRows(const std::vector<int> &handles)
+{
+    for (Key &key : m_keys)
+        key.removeRows(handles);
+}
+
+/**
+ * Refreshes the keys of the source rows from @p firstRow on, with @p handles, after the data in
+ * columns @p firstColumn to @p lastColumn changed for @p roles. The handles of the rows of which any
+ * key changed are added to @p changedHandles.
+ * @returns false if the keys had to be reloaded because of a type change, in which case the order
+ * of all rows may have changed.
+ */
+bool SortProxyModel::SortKeyCache::updateRows(int firstRow, const std::vector<int> &handles, int firstColumn,
+                                              int lastColumn, const QVector<int> &roles,
+                                              std::vector<int> &changedHandles)
+{
+    std::vector<bool> changed;
+    bool reloaded = false;
+    for (Key &key : m_keys)
+    {
+        if (key.isAffectedBy(firstColumn, lastColumn, roles) && !key.updateRows(firstRow, handles, changed))
+            reloaded = true;
+    }
+    if (reloaded)
+        return false;
+
+    for (std::size_t i = 0; i < changed.size(); ++i)
+    {
+        if (changed[i])
+            changedHandles.push_back(handles[i]);
+    }
+    return true;
+}
+
+/**
+ * @returns the order of rows with equal keys for comparing single rows.
+ */
+SortProxyModel::SortKeyCache::SourceRowLess SortProxyModel::SortKeyCache::sourceRowLess() const
+{
+    if (!m_sourceOrder)
+        return {nullptr, &m_sourceRows};
+    return {m_sourceOrder, nullptr};
+}
+
+/**
+ * @returns the order of rows with equal keys for sorting @p rowCount rows. Looking up the source rows
+ * of all rows in advance into @p sourceRows takes linear time, which pays off when sorting a good part
+ * of them; otherwise the source rows are looked up on every tie.
+ */
+SortProxyModel::SortKeyCache::SourceRowLess SortProxyModel::SortKeyCache::sourceRowLess(
+    std::ptrdiff_t rowCount, std::vector<int> &sourceRows) const
+{
+    if (m_sourceOrder && rowCount * 16 >= m_sourceOrder->size())
+    {
+        sourceRows = m_sourceOrder->positions();
+        return {nullptr, &sourceRows};
+    }
+    return sourceRowLess();
+}
+
+bool SortProxyModel::SortKeyCache::lessThan(int lhs, int rhs) const
+{
+    return lessThan(lhs, rhs, sourceRowLess());
+}
+
+bool SortProxyModel::SortKeyCache::lessThan(int lhs, int rhs, const SourceRowLess &sourceRowLess) const
+{
+    for (const Key &key : m_keys)
+    {
+        if (const int result = key.compare(lhs, rhs))
+            return result < 0;
+    }
+    return sourceRowLess(lhs, rhs);
+}
+
+/**
+ * Compares @p lhs and @p rhs the way the values of the first sort criterion are compared, in ascending
+ * order, using the collator of that criterion if it is locale aware. Without sort criteria, the values
+ * are compared using @p caseSensitivity.
+ */
+bool SortProxyModel::SortKeyCache::primaryValueLessThan(const QVariant &lhs, const QVariant &rhs,
+                                                        Qt::CaseSensitivity caseSensitivity) const
+{
+    if (m_keys.empty())
+        return variantLessThan(lhs, rhs, caseSensitivity);
+    return m_keys.front().valueLessThan(lhs, rhs);
+}
+
+/**
+ * Sorts the handles in [begin, end). Ranges of at least @p parallelSortThreshold rows are sorted
+ * using multiple threads; a threshold of 0 always sorts on the calling thread. Without keys, this
+ * puts the rows in source order.
+ */
+void SortProxyModel::SortKeyCache::sort(std::vector<int>::iterator begin, std::vector<int>::iterator end,
+                                        int parallelSortThreshold) const
+{
+    std::vector<int> sourceRows;
+    const SourceRowLess tiebreak = sourceRowLess(std::distance(begin, end), sourceRows);
+    if (m_keys.size() == 1)
+    {
+        // the common case, which can use a comparator specialized for the storage type
+        m_keys.front().visitOrdered(
+            [begin, end, parallelSortThreshold](const auto &compare) {
+                sortRange(begin, end, compare, parallelSortThreshold);
+            },
+            tiebreak);
+        return;
+    }
+
+    sortRange(
+        begin, end, [this, &tiebreak](int lhs, int rhs) { return lessThan(lhs, rhs, tiebreak); },
+        parallelSortThreshold);
+}
+
+/**
+ * Puts the handles in [begin, end) that sort first into [begin, middle), in sorted order. The order of
+ * the remaining handles is unspecified.
+ */
+void SortProxyModel::SortKeyCache::partialSort(std::vector<int>::iterator begin, std::vector<int>::iterator middle,
+                                               std::vector<int>::iterator end) const
+{
+    std::vector<int> sourceRows;
+    const SourceRowLess tiebreak = sourceRowLess(std::distance(begin, end), sourceRows);
+    if (m_keys.size() == 1)
+    {
+        m_keys.front().visitOrdered(
+            [begin, middle, end](const auto &compare) { std::partial_sort(begin, middle, end, compare); }, tiebreak);
+        return;
+    }
+
+    std::partial_sort(begin, middle, end, [this, &tiebreak](int lhs, int rhs) { return lessThan(lhs, rhs, tiebreak); });
+}
+
+SortProxyModel::SortKeyCache::Key::Key(const QAbstractItemModel *model, const QPersistentModelIndex &parent,
+                                       const RowSequence *sourceOrder, const SortCriterion &criterion,
+                                       const QCollator &collator)
+    : m_model(model)
+    , m_parent(parent)
+    , m_sourceOrder(sourceOrder)
+    , m_column(criterion.column)
+    , m_role(criterion.role)
+    , m_caseSensitivity(criterion.caseSensitivity)
+    , m_descending(criterion.order == Qt::DescendingOrder)
+{
+    if (criterion.localeAware)
+    {
+        m_collator = collator;
+        m_collator->setCaseSensitivity(criterion.caseSensitivity);
+    }
+    reload();
+}
+
+bool SortProxyModel::SortKeyCache::Key::hasSameSource(const SortCriterion &criterion, const QCollator &collator) const
+{
+    return m_column == criterion.column && m_role == criterion.role && m_caseSensitivity == criterion.caseSensitivity
+        && m_collator.has_value() == criterion.localeAware && (!m_collator || hasSameCollation(*m_collator, collator));
+}
+
+bool SortProxyModel::SortKeyCache::Key::isAffectedBy(int firstColumn, int lastColumn, const QVector<int> &roles) const
+{
+    return m_column >= firstColumn && m_column <= lastColumn && (roles.isEmpty() || roles.contains(m_role));
+}
+
+void SortProxyModel::SortKeyCache::Key::reload()
+{
+    m_keyType = KeyType::None;
+    m_userType = 0;
+    resize(0);
+
+    const std::vector<int> handles = m_sourceOrder->toVector();
+    if (handles.empty())
+        return;
+
+    // guess the storage type from the first row. storeKey() falls back to QVariant storage if
+    // a row does not match that guess.
+    const QVariant first = fetch(0);
+    const KeyType keyType = keyTypeFor(first.userType());
+    m_userType = first.userType();
+    m_keyType = keyType;
+    resize(m_sourceOrder->capacity());
+    for (int row = 0; row < int(handles.size()); ++row)
+    {
+        storeKey(handles[row], row == 0 ? first : fetch(row));
+        if (m_keyType != keyType)
+            return; // all keys were reloaded as QVariant
+    }
+}
+
+SortProxyModel::SortKeyCache::Key::KeyType SortProxyModel::SortKeyCache::Key::keyTypeFor(int userType) const
+{
+    switch (userType)
+    {
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::LongLong:
+        return KeyType::Integer;
+    case QMetaType::Double:
+        return KeyType::Double;
+    case QMetaType::QString:
+        return m_collator ? KeyType::CollatedString : KeyType::String;
+    case QMetaType::QDateTime:
+        return KeyType::DateTime;
+    default:
+        return KeyType::Variant;
+    }
+}
+
+QVariant SortProxyModel::SortKeyCache::Key::fetch(int row) const
+{
+    return m_model->index(row, m_column, m_parent).data(m_role);
+}
+
+/**
+ * Stores @p value as the key for the row with @p handle.
+ * @returns true if the key was different from the previously stored key. Returns false if the
+ * key did not match the storage type, in which case all keys have been reloaded as QVariant.
+ */
+bool SortProxyModel::SortKeyCache::Key::storeKey(int handle, const QVariant &value)
+{
+    if (m_keyType != KeyType::Variant && value.userType() != m_userType)
+    {
+        resize(0);
+        m_keyType = KeyType::Variant;
+        resize(m_sourceOrder->capacity());
+        const std::vector<int> handles = m_sourceOrder->toVector();
+        for (int row = 0; row < int(handles.size()); ++row)
+            m_variantKeys[handles[row]] = fetch(row);
+        return false;
+    }
+
+    const auto assign = [](auto &key, const auto &newKey) {
+        if (key == newKey)
+            return false;
+        key = newKey;
+        return true;
+    };
+
+    switch (m_keyType)
+    {
+    case KeyType::Integer:
+        return assign(m_integerKeys[handle], value.toLongLong());
+    case KeyType::DateTime:
+    {
+        const QDateTime dateTime = value.toDateTime();
+        // invalid date/times sort before all valid ones
+        return assign(m_integerKeys[handle], dateTime.isValid() ? dateTime.toMSecsSinceEpoch()
+                                                                 : std::numeric_limits<qint64>::min());
+    }
+    case KeyType::Double:
+        return assign(m_doubleKeys[handle], value.toDouble());
+    case KeyType::String:
+        return assign(m_stringKeys[handle],
+                      m_caseSensitivity == Qt::CaseSensitive ? value.toString() : value.toString().toCaseFolded());
+    case KeyType::CollatedString:
+    {
+        QCollatorSortKey key = m_collator->sortKey(value.toString());
+        if (key.compare(m_collatedKeys[handle]) == 0)
+            return false;
+        m_collatedKeys[handle] = std::move(key);
+        return true;
+    }
+    case KeyType::Variant:
+        return assign(m_variantKeys[handle], value);
+    case KeyType::None:
+        break;
+    }
+    return false;
+}
+
+/**
+ * Resizes the storage of the active key type to @p size handles, keeping the stored keys.
+ */
+void SortProxyModel::SortKeyCache::Key::resize(int size)
+{
+    const auto newSize = static_cast<std::size_t>(size);
+    m_integerKeys.resize(m_keyType == KeyType::Integer || m_keyType == KeyType::DateTime ? newSize : 0);
+    m_doubleKeys.resize(m_keyType == KeyType::Double ? newSize : 0);
+    m_stringKeys.resize(m_keyType == KeyType::String ? newSize : 0);
+    if (m_keyType == KeyType::CollatedString)
+        m_collatedKeys.resize(newSize, m_collator->sortKey(QString()));
+    else
+        m_collatedKeys.clear();
+    m_variantKeys.resize(m_keyType == KeyType::Variant ? newSize : 0);
+}
+
+/**
+ * Makes room for and loads the keys of the source rows from @p firstRow on, which have just been
+ * inserted into the source model with @p handles.
+ */
+void SortProxyModel::SortKeyCache::Key::insertRows(int firstRow, const std::vector<int> &handles)
+{
+    if (m_keyType == KeyType::None)
+    {
+        // the model was empty so far, so we had no storage type yet
+        reload();
+        return;
+    }
+
+    resize(m_sourceOrder->capacity());
+    for (std::size_t i = 0; i < handles.size(); ++i)
+    {
+        const KeyType oldType = m_keyType;
+        storeKey(handles[i], fetch(firstRow + static_cast<int>(i)));
+        if (m_keyType != oldType)
+            return; // all keys were reloaded
+    }
+}
+
+/**
+ * Releases the keys of the removed rows with @p handles. Their slots stay, and are overwritten once
+ * the handles are reused.
+ */
+void SortProxyModel::SortKeyCache::Key::removeRows(const std::vector<int> &handles)
+{
+    // collated keys are not default constructible, and are simply overwritten later
+    forActiveKeys([&handles](auto &keys) {
+        for (int handle : handles)
+            keys[handle] = {};
+    });
+}
+
+/**
+ * Refreshes the keys of the source rows from @p firstRow on, with @p handles, and marks the rows
+ * whose key changed in @p changed, indexed like @p handles.
+ * @returns false if the keys did not match the storage type, and all keys were reloaded.
+ */
+bool SortProxyModel::SortKeyCache::Key::updateRows(int firstRow, const std::vector<int> &handles,
+                                                   std::vector<bool> &changed)
+{
+    changed.resize(handles.size(), false);
+    for (std::size_t i = 0; i < handles.size(); ++i)
+    {
+        const KeyType oldType = m_keyType;
+        if (storeKey(handles[i], fetch(firstRow + static_cast<int>(i))))
+            changed[i] = true;
+        if (m_keyType != oldType)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief The SortProxyModel::RowHeap class holds the source rows beyond the row limit
+ *
+ * The rows are kept in a binary heap of handles, with the row that sorts first in front. The heap
+ * position of every handle is tracked, so any row can be taken out or repositioned in O(log n) when
+ * it is removed or its key changes. The rows are never fully sorted. As handles stay the same when
+ * other rows are inserted or removed, the heap does not change then.
+ */
+class SortProxyModel::RowHeap
+{
+public:
+    explicit RowHeap(const SortKeyCache &keys)
+        : m_keys(keys)
+    {
+    }
+
+    bool isEmpty() const { return m_heap.empty(); }
+    int size() const { return static_cast<int>(m_heap.size()); }
+    int top() const { return m_heap.front(); }
+    bool contains(int handle) const
+    {
+        return handle < static_cast<int>(m_positions.size()) && m_positions[handle] != -1;
+    }
+
+    void assign(std::vector<int>::const_iterator begin, std::vector<int>::const_iterator end);
+    std::vector<int> takeRows();
+    void push(int handle);
+    int pop();
+    void remove(int handle);
+    void update(std::vector<int> changedHandles);
+
+private:
+    bool before(int lhs, int rhs) const;
+    void place(int position, int handle);
+    void siftUp(int position);
+    void siftDown(int position);
+
+    const SortKeyCache &m_keys;
+    std::vector<int> m_heap;
+    std::vector<int> m_positions; // the heap position of every handle, or -1
+    std::vector<int> m_lifted; // rows that sort before all others while update() runs, sorted
+};
+
+/**
+ * Replaces the contents of the heap with the handles in [begin, end). Runs in linear time.
+ */
+void SortProxyModel::RowHeap::assign(std::vector<int>::const_iterator begin, std::vector<int>::const_iterator end)
+{
+    for (int handle : m_heap)
+        m_positions[handle] = -1;
+    m_heap.assign(begin, end);
+    std::make_heap(m_heap.begin(), m_heap.end(), [this](int lhs, int rhs) { return before(rhs, lhs); });
+    for (int position = 0; position < size(); ++position)
+    {
+        const int handle = m_heap[position];
+        if (handle >= static_cast<int>(m_positions.size()))
+            m_positions.resize(static_cast<std::size_t>(handle) + 1, -1);
+        m_positions[handle] = position;
+    }
+}
+
+/**
+ * Empties the heap. @returns the handles it contained, in no particular order.
+ */
+std::vector<int> SortProxyModel::RowHeap::takeRows()
+{
+    std::vector<int> handles;
+    handles.swap(m_heap);
+    for (int handle : handles)
+        m_positions[handle] = -1;
+    return handles;
+}
+
+void SortProxyModel::RowHeap::push(int handle)
+{
+    if (handle >= static_cast<int>(m_positions.size()))
+        m_positions.resize(static_cast<std::size_t>(handle) + 1, -1);
+    m_heap.push_back(handle);
+    m_positions[handle] = size() - 1;
+    siftUp(size() - 1);
+}
+
+/**
+ * Takes the row that sorts first out of the heap. @returns its handle.
+ */
+int SortProxyModel::RowHeap::pop()
+{
+    const int handle = m_heap.front();
+    remove(handle);
+    return handle;
+}
+
+void SortProxyModel::RowHeap::remove(int handle)
+{
+    const int position = m_positions[handle];
+    m_positions[handle] = -1;
+    const int last = m_heap.back();
+    m_heap.pop_back();
+    if (position == size())
+        return;
+
+    place(position, last);
+    siftUp(position);
+    siftDown(m_positions[last]);
+}
+
+/**
+ * Repositions @p changedHandles, all of which are in the heap, after their keys changed.
+ *
+ * With more than one changed row, the heap property may be broken in several places at once, so
+ * the changed rows cannot simply be sifted one by one. Instead, they are lifted to the front of the
+ * heap by treating them as sorting before all other rows, taken out, and pushed back in with their
+ * new keys.
+ */
+void SortProxyModel::RowHeap::update(std::vector<int> changedHandles)
+{
+    std::sort(changedHandles.begin(), changedHandles.end());
+    m_lifted = changedHandles;
+    // in increasing handle order, lifted rows still further down only ever compare as sorting after
+    // the row being sifted up, just like their unknown old keys would
+    for (int handle : changedHandles)
+        siftUp(m_positions[handle]);
+    for (std::size_t i = 0; i < changedHandles.size(); ++i)
+        pop();
+    m_lifted.clear();
+
+    for (int handle : changedHandles)
+        push(handle);
+}
+
+bool SortProxyModel::RowHeap::before(int lhs, int rhs) const
+{
+    if (!m_lifted.empty())
+    {
+        const bool lhsLifted = std::binary_search(m_lifted.cbegin(), m_lifted.cend(), lhs);
+        const bool rhsLifted = std::binary_search(m_lifted.cbegin(), m_lifted.cend(), rhs);
+        if (lhsLifted || rhsLifted)
+            return lhsLifted && rhsLifted ? lhs < rhs : lhsLifted;
+    }
+    return m_keys.lessThan(lhs, rhs);
+}
+
+void SortProxyModel::RowHeap::place(int position, int handle)
+{
+    m_heap[position] = handle;
+    m_positions[handle] = position;
+}
+
+void SortProxyModel::RowHeap::siftUp(int position)
+{
+    const int handle = m_heap[position];
+    while (position > 0)
+    {
+        const int parent = (position - 1) / 2;
+        if (!before(handle, m_heap[parent]))
+            break;
+        place(position, m_heap[parent]);
+        position = parent;
+    }
+    place(position, handle);
+}
+
+void SortProxyModel::RowHeap::siftDown(int position)
+{
+    const int handle = m_heap[position];
+    const int count = size();
+    for (;;)
+    {
+        int child = 2 * position + 1;
+        if (child >= count)
+            break;
+        if (child + 1 < count && before(m_heap[child + 1], m_heap[child]))
+            ++child;
+        if (!before(m_heap[child], handle))
+            break;
+        place(position, m_heap[child]);
+        position = child;
+    }
+    place(position, handle);
+}
+
+/**
+ * State shared between the proxy and sorts running in the thread pool. The proxy detaches itself
+ * on destruction, so a sort finishing after that does not try to deliver its result.
+ */
+struct SortProxyModel::AsynchronousSortState
+{
+    QMutex mutex;
+    SortProxyModel *model = nullptr;
+};
+
+SortProxyModel::Mapping::Mapping()
+    : sourceOrder(std::make_unique<RowSequence>())
+    , proxyOrder(std::make_unique<RowSequence>())
+    , sortKeys(std::make_unique<SortKeyCache>(*sourceOrder))
+{
+}
+
+SortProxyModel::Mapping::~Mapping() = default;
+
+/**
+ * Replaces the rows with @p rowCount new source rows, none of which is shown yet.
+ */
+void SortProxyModel::Mapping::resetRows(int rowCount)
+{
+    proxyOrder->clear();
+    sourceOrder->clear();
+    freeHandles.clear();
+    handleCount = 0;
+    const std::vector<int> handles = allocateHandles(rowCount);
+    sourceOrder->insert(0, handles.cbegin(), handles.cend());
+}
+
+/**
+ * @returns @p count handles for new source rows, reusing those of removed rows first.
+ */
+std::vector<int> SortProxyModel::Mapping::allocateHandles(int count)
+{
+    std::vector<int> handles;
+    handles.reserve(static_cast<std::size_t>(count));
+    while (static_cast<int>(handles.size()) < count)
+    {
+        if (freeHandles.empty())
+        {
+            handles.push_back(handleCount++);
+        }
+        else
+        {
+            handles.push_back(freeHandles.back());
+            freeHandles.pop_back();
+        }
+    }
+    return handles;
+}
+
+/**
+ * Makes the @p handles of removed rows available for new rows. They must no longer be part of the
+ * source or proxy order.
+ */
+void SortProxyModel::Mapping::releaseHandles(const std::vector<int> &handles)
+{
+    freeHandles.insert(freeHandles.end(), handles.cbegin(), handles.cend());
+}
+
+/**
+ * @returns whether proxyToSourceRows and sourceToProxyRows match the current orders, rebuilding them if
+ * that pays off.
+ *
+ * Rebuilding takes O(n) steps, while looking a row up in the orders takes O(log n). The tables are
+ * therefore only rebuilt once the lookups since they went stale have cost about as much as rebuilding
+ * them, so views reading rows between every single change do not rebuild them over and over again,
+ * while views reading many rows after a change get O(1) lookups again soon.
+ */
+bool SortProxyModel::Mapping::hasRowTable() const
+{
+    if (rowTableSourceGeneration == sourceOrder->generation() && rowTableProxyGeneration == proxyOrder->generation())
+        return true;
+
+    const int size = sourceOrder->size();
+    int depth = 1;
+    while (depth < 31 && (1 << depth) < size)
+        ++depth;
+    if (++lookupsWithoutRowTable * depth < size)
+        return false;
+
+    const std::vector<int> sourceRows = sourceOrder->positions();
+    proxyToSourceRows = proxyOrder->toVector();
+    sourceToProxyRows.assign(static_cast<std::size_t>(size), -1);
+    for (int proxyRow = 0; proxyRow < static_cast<int>(proxyToSourceRows.size()); ++proxyRow)
+    {
+        const int handle = proxyToSourceRows[proxyRow];
+        // rows whose removal is being signalled are no longer part of the source order
+        const int sourceRow = handle < static_cast<int>(sourceRows.size()) ? sourceRows[handle] : -1;
+        proxyToSourceRows[proxyRow] = sourceRow;
+        if (sourceRow >= 0)
+            sourceToProxyRows[sourceRow] = proxyRow;
+    }
+    rowTableSourceGeneration = sourceOrder->generation();
+    rowTableProxyGeneration = proxyOrder->generation();
+    lookupsWithoutRowTable = 0;
+    return true;
+}
+
+SortProxyModel::SortProxyModel(QObject *parent)
+    : QAbstractProxyModel(parent)
+    , m_rowsBeyondLimit(std::make_unique<RowHeap>(*m_rootMapping.sortKeys))
+    , m_asynchronousSortState(std::make_shared<AsynchronousSortState>())
+{
+    m_asynchronousSortState->model = this;
+}
+
+SortProxyModel::~SortProxyModel()
+{
+    QMutexLocker locker(&m_asynchronousSortState->mutex);
+    m_asynchronousSortState->model = nullptr;
+}
+
+QModelIndex SortProxyModel::index(int row, int column, const QModelIndex &parent) const
+{
+    if (!sourceModel())
+        return {};
+    Mapping *mapping = mappingFor(parent);
+    if (!mapping || row < 0 || row >= mapping->proxyOrder->size())
+        return {};
+    if (column < 0 || column >= sourceModel()->columnCount(mapping->sourceParent))
+        return {};
+
+    return createIndex(row, column, mapping);
+}
+
+QModelIndex SortProxyModel::parent(const QModelIndex &child) const
+{
+    if (!child.isValid())
+        return {};
+
+    return proxyParentOf(*mappingOf(child));
+}
+
+int SortProxyModel::rowCount(const QModelIndex &parent) const
+{
+    if (!sourceModel())
+        return 0;
+
+    const Mapping *mapping = mappingFor(parent);
+    return mapping ? mapping->proxyOrder->size() : 0;
+}
+
+int SortProxyModel::columnCount(const QModelIndex &parent) const
+{
+    const auto source = sourceModel();
+    if (source)
+    {
+        return source->columnCount(mapToSource(parent));
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+/**
+ * @brief SortProxyModel::sort sorts the model
+ * @param column The column to sort on.
+ * @param order The order to use when sorting.
+ *
+ * The default @arg order is Qt::Ascending order. As per convention, if you
+ * pass -1 for @arg column the sorting is disabled. The valid range for
+ * @arg column is therefore -1 to columnCount() - 1.
+ *
+ * Sorting on a single column replaces any criteria set using setSortCriteria().
+ */
+void SortProxyModel::sort(int column, Qt::SortOrder order)
+{
+    Q_ASSERT(column >= -1 && column < columnCount());
+
+    if (m_sortColumn != column || m_order != order || !m_additionalSortCriteria.isEmpty())
+    {
+        int oldColumn = m_sortColumn;
+        int oldOrder = m_order;
+
+        m_sortColumn = column;
+        m_order = order;
+        m_additionalSortCriteria.clear();
+
+        updateSortCriteria(m_rootMapping, sortCriteria());
+
+        if (oldOrder != m_order)
+            Q_EMIT sortOrderChanged();
+        if (oldColumn != m_sortColumn)
+            Q_EMIT sortColumnChanged();
+    }
+}
+
+QVariant SortProxyModel::data(const QModelIndex &proxyIndex, int role) const
+{
+    if (proxyIndex.isValid() && !isInvalidedRow(*mappingOf(proxyIndex), proxyIndex.row()))
+    {
+        return QAbstractProxyModel::data(proxyIndex, role);
+    }
+    return {};
+}
+
+void SortProxyModel::setSourceModel(QAbstractItemModel *model)
+{
+    if (model != sourceModel())
+    {
+        beginResetModel();
+        if (sourceModel())
+            sourceModel()->disconnect(this);
+        QAbstractProxyModel::setSourceModel(model);
+        if (model)
+        {
+            connect(model, &QAbstractItemModel::dataChanged, this, &SortProxyModel::handleDataChanged);
+            connect(model, &QAbstractItemModel::rowsInserted, this, &SortProxyModel::handleRowsInserted);
+            connect(model, &QAbstractItemModel::rowsRemoved, this, &SortProxyModel::handleRowsRemoved);
+        }
+        endResetModel();
+    }
+}
+
+QModelIndex SortProxyModel::mapToSource(const QModelIndex &proxyIndex) const
+{
+    if (!proxyIndex.isValid())
+        return {};
+
+    Q_ASSERT(proxyIndex.model() == this);
+
+    const Mapping *mapping = mappingOf(proxyIndex);
+    if (isInvalidedRow(*mapping, proxyIndex.row()))
+        return {}; // the row or its parent has been removed from the source model
+
+    // no further bounds checking, out of bounds indices are a breach of contract
+    if (mapping->hasRowTable())
+        return sourceModel()->index(mapping->proxyToSourceRows[proxyIndex.row()], proxyIndex.column(),
+                                    mapping->sourceParent);
+    const int handle = mapping->proxyOrder->at(proxyIndex.row());
+    return sourceModel()->index(mapping->sourceOrder->positionOf(handle), proxyIndex.column(), mapping->sourceParent);
+}
+
+QModelIndex SortProxyModel::mapFromSource(const QModelIndex &sourceIndex) const
+{
+    if (!sourceIndex.isValid())
+        return {};
+
+    Q_ASSERT(sourceIndex.model() == sourceModel());
+
+    Mapping *mapping = mappingForSource(sourceIndex.parent(), true);
+    if (!mapping)
+        return {};
+
+    const auto proxyRow = mapToProxyRow(*mapping, sourceIndex.row());
+    if (proxyRow < 0)
+        return {};
+    return createIndex(proxyRow, sourceIndex.column(), mapping);
+}
+
+void SortProxyModel::setSortRole(int role)
+{
+    if (m_sortRole != role)
+    {
+        m_sortRole = role;
+        Q_EMIT sortRoleChanged();
+        updateSortCriteria(m_rootMapping, sortCriteria());
+    }
+}
+
+int SortProxyModel::sortRole() const
+{
+    return m_sortRole;
+}
+
+void SortProxyModel::setSortCaseSensitivity(Qt::CaseSensitivity sensitivity)
+{
+    if (m_caseSensitivity != sensitivity)
+    {
+        m_caseSensitivity = sensitivity;
+        Q_EMIT sortCaseSensitivityChanged();
+        updateSortCriteria(m_rootMapping, sortCriteria());
+    }
+}
+
+Qt::CaseSensitivity SortProxyModel::sortCaseSensitivity() const
+{
+    return m_caseSensitivity;
+}
+
+/**
+ * @brief SortProxyModel::setSortLocaleAware compares strings using locale aware collation
+ *
+ * By default, strings are compared by their code points, which for instance sorts "Zebra" before
+ * "apple". With @p on, strings are compared using sortCollator() instead. The collation key of each
+ * row is computed once and cached, so comparing rows stays cheap. Like setSortCaseSensitivity(),
+ * this only changes the primary sort criterion.
+ */
+void SortProxyModel::setSortLocaleAware(bool on)
+{
+    if (m_sortLocaleAware != on)
+    {
+        m_sortLocaleAware = on;
+        Q_EMIT sortLocaleAwareChanged();
+        updateSortCriteria(m_rootMapping, sortCriteria());
+    }
+}
+
+bool SortProxyModel::isSortLocaleAware() const
+{
+    return m_sortLocaleAware;
+}
+
+int SortProxyModel::sortColumn() const
+{
+    return m_sortColumn;
+}
+
+Qt::SortOrder SortProxyModel::sortOrder() const
+{
+    return m_order;
+}
+
+/**
+ * @brief SortProxyModel::setSortCriteria sorts on multiple keys
+ *
+ * Rows are compared on the first criterion; rows that compare equal on it are compared on the
+ * second one, and so on. Rows that are equal on all criteria keep their source order. Each
+ * criterion has its own column, role, order and case sensitivity.
+ *
+ * The first criterion is the primary one, as reported by sortColumn(), sortOrder(), sortRole()
+ * and sortCaseSensitivity(); setSortRole() and setSortCaseSensitivity() only change the primary
+ * criterion. An empty list of criteria disables sorting, just like sort(-1).
+ */
+void SortProxyModel::setSortCriteria(const QVector<SortCriterion> &criteria)
+{
+    if (criteria == sortCriteria())
+        return;
+
+    const SortCriterion primary = criteria.isEmpty()
+        ? SortCriterion{-1, m_sortRole, m_order, m_caseSensitivity, m_sortLocaleAware}
+        : criteria.constFirst();
+    Q_ASSERT(primary.column >= -1 && primary.column < columnCount());
+
+    const int oldColumn = m_sortColumn;
+    const Qt::SortOrder oldOrder = m_order;
+    const int oldRole = m_sortRole;
+    const Qt::CaseSensitivity oldCaseSensitivity = m_caseSensitivity;
+    const bool oldLocaleAware = m_sortLocaleAware;
+
+    m_sortColumn = primary.column;
+    m_order = primary.order;
+    m_sortRole = primary.role;
+    m_caseSensitivity = primary.caseSensitivity;
+    m_sortLocaleAware = primary.localeAware;
+    m_additionalSortCriteria = criteria.mid(1);
+
+    updateSortCriteria(m_rootMapping, sortCriteria());
+
+    if (oldRole != m_sortRole)
+        Q_EMIT sortRoleChanged();
+    if (oldCaseSensitivity != m_caseSensitivity)
+        Q_EMIT sortCaseSensitivityChanged();
+    if (oldLocaleAware != m_sortLocaleAware)
+        Q_EMIT sortLocaleAwareChanged();
+    if (oldOrder != m_order)
+        Q_EMIT sortOrderChanged();
+    if (oldColumn != m_sortColumn)
+        Q_EMIT sortColumnChanged();
+}
+
+/**
+ * @returns the criteria the model is sorted on, starting with the primary one. The list is
+ * empty if the model is not sorted.
+ */
+QVector<SortProxyModel::SortCriterion> SortProxyModel::sortCriteria() const
+{
+    if (m_sortColumn == -1)
+        return {};
+
+    QVector<SortCriterion> criteria{
+        SortCriterion{m_sortColumn, m_sortRole, m_order, m_caseSensitivity, m_sortLocaleAware}};
+    criteria += m_additionalSortCriteria;
+    return criteria;
+}
+
+/**
+ * @brief SortProxyModel::setSortCollator sets the collator used for locale aware sort criteria
+ *
+ * The collator determines the locale and options such as the numeric mode, in which "file2" sorts
+ * before "file10". The case sensitivity is taken from each sort criterion instead. By default, a
+ * collator for the default locale is used.
+ */
+void SortProxyModel::setSortCollator(const QCollator &collator)
+{
+    m_sortCollator = collator;
+    updateSortCriteria(m_rootMapping, sortCriteria());
+}
+
+QCollator SortProxyModel::sortCollator() const
+{
+    return m_sortCollator;
+}
+
+/**
+ * @brief SortProxyModel::setReorderSignalPolicy sets which signals are emitted when rows change order
+ *
+ * With EmitLayoutChangeAboveThreshold, a layout change is emitted instead of row moves when the
+ * number of rows that need to move exceeds layoutChangeMoveThreshold(), or exceeds the fraction
+ * layoutChangeRowFraction() of the row count. The default policy is AlwaysEmitRowMoves.
+ */
+void SortProxyModel::setReorderSignalPolicy(ReorderSignalPolicy policy)
+{
+    m_reorderSignalPolicy = policy;
+}
+
+SortProxyModel::ReorderSignalPolicy SortProxyModel::reorderSignalPolicy() const
+{
+    return m_reorderSignalPolicy;
+}
+
+/**
+ * Sets the number of rows that may move in a single reorder before a layout change is emitted
+ * instead, if the reorder signal policy is EmitLayoutChangeAboveThreshold. The default is 1000.
+ */
+void SortProxyModel::setLayoutChangeMoveThreshold(int movedRows)
+{
+    m_layoutChangeMoveThreshold = movedRows;
+}
+
+int SortProxyModel::layoutChangeMoveThreshold() const
+{
+    return m_layoutChangeMoveThreshold;
+}
+
+/**
+ * Sets the fraction of the row count that may move in a single reorder before a layout change is
+ * emitted instead, if the reorder signal policy is EmitLayoutChangeAboveThreshold. The default is
+ * 1.0, which means only the layoutChangeMoveThreshold() applies.
+ */
+void SortProxyModel::setLayoutChangeRowFraction(qreal movedRowFraction)
+{
+    m_layoutChangeRowFraction = movedRowFraction;
+}
+
+qreal SortProxyModel::layoutChangeRowFraction() const
+{
+    return m_layoutChangeRowFraction;
+}
+
+/**
+ * @brief SortProxyModel::setAsynchronousSorting enables sorting in a background thread
+ *
+ * If enabled, a full sort, such as after changing the sort column or resetting the source
+ * model, takes a snapshot of the sort keys and sorts it in the global QThreadPool. Until the
+ * result is applied, the proxy keeps its previous order (or the order of the source model
+ * after a reset) and isSortPending() returns true. The result is applied using the same row
+ * move or layout change signals as a synchronous sort. Source model changes arriving in the
+ * meantime are handled as usual, and restart the pending sort from a fresh snapshot.
+ *
+ * Only the top level rows are sorted asynchronously. The rows below a parent in a tree model
+ * are always sorted synchronously, as they are sorted when they are first queried.
+ *
+ * Disabled by default.
+ */
+void SortProxyModel::setAsynchronousSorting(bool enabled)
 {
-    const int size = int(aToB.size());
-    bToA.resize(size);
-    for (int i = 0; i < size; ++i)
+    if (m_asynchronousSorting == enabled)
+        return;
+
+    m_asynchronousSorting = enabled;
+    if (!enabled && m_sortPending)
     {
-        bToA[aToB[i]] = i;
+        // sort synchronously instead
+        ++m_sortGeneration;
+        setSortPending(false);
+        reorder(m_rootMapping);
     }
 }
+
+bool SortProxyModel::asynchronousSorting() const
+{
+    return m_asynchronousSorting;
 }
 
-SortProxyModel::SortProxyModel(QObject *parent)
-    : QAbstractProxyModel(parent)
-    , m_invalidatedRows(make_pair(m_proxyToSourceMap.end(), m_proxyToSourceMap.end()))
+/**
+ * @returns true while an asynchronous sort has been requested, but its result has not been
+ * applied yet.
+ */
+bool SortProxyModel::isSortPending() const
 {
+    return m_sortPending;
 }
 
-QModelIndex SortProxyModel::index(int row, int column, const QModelIndex &parent) const
+/**
+ * @brief SortProxyModel::setParallelSorting enables sorting large models using multiple threads
+ *
+ * If enabled, full sorts of at least parallelSortThreshold() rows are split into chunks that are
+ * sorted and merged concurrently, using idle threads of the global QThreadPool. Smaller sorts,
+ * and the incremental updates after changes in the source model, are not affected.
+ *
+ * Disabled by default.
+ */
+void SortProxyModel::setParallelSorting(bool enabled)
 {
-    Q_ASSERT(!parent.isValid()); // we do not support tree models
-    Q_UNUSED(parent)
+    m_parallelSorting = enabled;
+}
 
-    if (!sourceModel())
-        return {};
-    if (row >= static_cast<int>(m_proxyToSourceMap.size()))
-        return {};
-    if (column < 0 || column >= sourceModel()->columnCount())
-        return {};
+bool SortProxyModel::parallelSorting() const
+{
+    return m_parallelSorting;
+}
 
-    return createIndex(row, column, static_cast<quintptr>(m_proxyToSourceMap[static_cast<ulong>(row)]));
+/**
+ * Sets the minimum number of rows for which a sort runs in parallel, if parallelSorting() is
+ * enabled. Below this, the cost of distributing the work outweighs the gain. The default is
+ * 50000 rows.
+ */
+void SortProxyModel::setParallelSortThreshold(int rowCount)
+{
+    m_parallelSortThreshold = std::max(1, rowCount);
 }
 
-QModelIndex SortProxyModel::parent(const QModelIndex &child) const
+int SortProxyModel::parallelSortThreshold() const
 {
-    Q_UNUSED(child)
-    return {};
+    return m_parallelSortThreshold;
 }
 
-int SortProxyModel::rowCount(const QModelIndex &parent) const
+/**
+ * @brief SortProxyModel::setRowLimit only shows the first @p limit rows of the sorted order
+ *
+ * Meant for views that only show the top of a large model, such as the top 50 by volume. The rows
+ * beyond the limit are never sorted: the rows within the limit are selected with a partial sort, and
+ * the others are kept in a heap. Inserting, removing or changing a row then takes O(log n)
+ * comparisons. Rows entering or leaving the top are signalled as inserted or removed rows.
+ *
+ * The limit applies to the top level rows only. While it is set, sorting does not happen
+ * asynchronously. A negative limit, the default, shows all rows.
+ */
+void SortProxyModel::setRowLimit(int limit)
+{
+    limit = std::max(-1, limit);
+    if (m_rowLimit == limit)
+        return;
+
+    const bool wasLimited = m_rowLimit >= 0;
+    m_rowLimit = limit;
+    if (wasLimited && limit >= 0)
+        applyRowLimit(); // only the rows at the boundary change
+    else
+        reorderWithRowLimit();
+}
+
+int SortProxyModel::rowLimit() const
+{
+    return m_rowLimit;
+}
+
+/**
+ * @brief SortProxyModel::setFilterAcceptsRowFunction only shows the source rows accepted by @p function
+ *
+ * The function gets the same arguments as the one of KDFunctionalSortFilterProxyModel. Filtering
+ * here instead of in a proxy model below this one keeps a single mapping between the source rows
+ * and the sorted ones, so data() and mapToSource() take a single step.
+ *
+ * The filter is evaluated again for rows whose data changed. Rows that stop matching are removed,
+ * and rows that start matching are inserted at their sorted position. Call invalidateFilter() if the
+ * outcome of the function changes for other reasons. The children of rows that are filtered out
+ * are not shown either.
+ */
+void SortProxyModel::setFilterAcceptsRowFunction(AcceptsFunction function)
+{
+    m_filterAcceptsRowFunction = std::move(function);
+    invalidateFilter();
+}
+
+void SortProxyModel::clearFilterAcceptsRowFunction()
+{
+    setFilterAcceptsRowFunction({});
+}
+
+/**
+ * @brief SortProxyModel::invalidateFilter evaluates the filter again for all rows
+ *
+ * Only the rows below parents that have been queried so far are evaluated; the others are
+ * filtered once they are first queried.
+ */
+void SortProxyModel::invalidateFilter()
 {
-    Q_UNUSED(parent)
     if (sourceModel())
+        refilter(m_rootMapping);
+}
+
+bool SortProxyModel::lessThan(const QModelIndex &source_left, const QModelIndex &source_right) const
+{
+    return m_rootMapping.sortKeys->primaryValueLessThan(source_left.data(m_sortRole), source_right.data(m_sortRole),
+                                                        m_caseSensitivity);
+}
+
+void SortProxyModel::resetInternalData()
+{
+    rebuildRowMap();
+}
+
+void SortProxyModel::rebuildRowMap()
+{
+    // simple initial sort. No emitting of row moves
+    m_rootMapping.children.clear();
+    const int rowCount = sourceModel() ? sourceModel()->rowCount() : 0;
+    m_rootMapping.resetRows(rowCount);
+    rebuildSortKeys();
+    const bool sortLater = m_asynchronousSorting && m_sortColumn != -1 && m_rowLimit < 0;
+    std::vector<int> rows = acceptedRows(m_rootMapping, 0, m_rootMapping.sourceOrder->toVector());
+    if (m_rowLimit >= 0)
+    {
+        // only select the rows within the limit, the others are not sorted at all
+        const auto middle = rows.begin() + std::min(m_rowLimit, static_cast<int>(rows.size()));
+        m_rootMapping.sortKeys->partialSort(rows.begin(), middle, rows.end());
+        m_rowsBeyondLimit->assign(middle, rows.cend());
+        rows.erase(middle, rows.end());
+    }
+    else if (!sortLater)
+    {
+        sortMappingContainer(m_rootMapping, rows);
+    }
+    m_rootMapping.proxyOrder->assign(rows.cbegin(), rows.cend());
+
+    if (sortLater && !rows.empty())
+    {
+        // start with the order of the source model
+        scheduleSort();
+    }
+    else if (m_sortPending)
+    {
+        ++m_sortGeneration;
+        setSortPending(false);
+    }
+}
+
+void SortProxyModel::rebuildSortKeys()
+{
+    m_rootMapping.sortKeys->rebuild(sourceModel(), QModelIndex(), sortCriteria(), m_sortCollator);
+}
+
+/**
+ * Applies changed sort @p criteria to @p mapping and all mappings below it, reordering their rows.
+ */
+void SortProxyModel::updateSortCriteria(Mapping &mapping, const QVector<SortCriterion> &criteria)
+{
+    mapping.sortKeys->setCriteria(criteria, m_sortCollator);
+    reorder(mapping);
+    for (auto &child : mapping.children)
+        updateSortCriteria(*child.second, criteria);
+}
+
+template<class Iterator>
+inline Iterator predecessor(Iterator it)
+{
+    --it;
+    return it;
+}
+
+template<class Iterator>
+inline Iterator successor(Iterator it)
+{
+    ++it;
+    return it;
+}
+
+void SortProxyModel::reorder(Mapping &mapping)
+{
+    if (isRowLimited(mapping))
+    {
+        reorderWithRowLimit();
+        return;
+    }
+
+    // update the sort order. Emits row moves
+    if (mapping.proxyOrder->size() == 0)
+        return;
+
+    if (&mapping == &m_rootMapping)
+    {
+        if (m_asynchronousSorting && m_sortColumn != -1)
+        {
+            scheduleSort();
+            return;
+        }
+        if (m_sortPending)
+        {
+            // a synchronous reorder supersedes the pending one
+            ++m_sortGeneration;
+            setSortPending(false);
+        }
+    }
+
+    std::vector<int> newOrder = mapping.proxyOrder->toVector();
+
+    if (m_sortColumn == -1)
     {
-        return static_cast<int>(m_proxyToSourceMap.size());
+        mapping.sortKeys->sort(newOrder.begin(), newOrder.end()); // without keys, the order of the source model
     }
     else
     {
-        return 0;
+        sortMappingContainer(mapping, newOrder);
     }
+
+    moveRowsToOrder(mapping, newOrder);
 }
 
-int SortProxyModel::columnCount(const QModelIndex &parent) const
+/**
+ * @brief SortProxyModel::reorderWithRowLimit selects and sorts the top level rows within the row limit
+ *
+ * All top level rows are partially sorted, so that only the rows within the limit end up sorted. The
+ * others are put in the heap. Without a row limit, which also applies when the limit was just lifted,
+ * all rows are sorted and shown.
+ */
+void SortProxyModel::reorderWithRowLimit()
 {
-    Q_UNUSED(parent)
-    const auto source = sourceModel();
-    if (source)
+    if (!sourceModel())
+        return;
+    if (m_sortPending)
+    {
+        // a synchronous reorder supersedes the pending one
+        ++m_sortGeneration;
+        setSortPending(false);
+    }
+
+    std::vector<int> newOrder = m_rootMapping.proxyOrder->toVector();
+    const std::vector<int> rowsBeyondLimit = m_rowsBeyondLimit->takeRows();
+    newOrder.insert(newOrder.end(), rowsBeyondLimit.cbegin(), rowsBeyondLimit.cend());
+    if (m_rowLimit >= 0)
+    {
+        const auto middle = newOrder.begin() + std::min(m_rowLimit, static_cast<int>(newOrder.size()));
+        m_rootMapping.sortKeys->partialSort(newOrder.begin(), middle, newOrder.end());
+        m_rowsBeyondLimit->assign(middle, newOrder.cend());
+        newOrder.erase(middle, newOrder.end());
+    }
+    else if (m_sortColumn == -1)
     {
-        return source->columnCount();
+        m_rootMapping.sortKeys->sort(newOrder.begin(), newOrder.end());
     }
     else
     {
-        return 0;
+        sortMappingContainer(m_rootMapping, newOrder);
     }
+
+    setRowsToOrder(m_rootMapping, newOrder);
 }
 
 /**
- * @brief SortProxyModel::sort sorts the model
- * @param column The column to sort on.
- * @param order The order to use when sorting.
+ * @brief SortProxyModel::setRowsToOrder puts the rows of @p mapping in the order given by @p newOrder,
+ * which may contain other rows than the proxy does
  *
- * The default @arg order is Qt::Ascending order. As per convention, if you
- * pass -1 for @arg column the sorting is disabled. The valid range for
- * @arg column is therefore -1 to columnCount() - 1.
+ * Rows that are not part of @p newOrder are removed and missing rows are appended, before all rows
+ * are moved into place.
  */
-void SortProxyModel::sort(int column, Qt::SortOrder order)
+void SortProxyModel::setRowsToOrder(Mapping &mapping, const std::vector<int> &newOrder)
 {
-    Q_ASSERT(column >= -1 && column < columnCount());
+    RowSequence &proxyOrder = *mapping.proxyOrder;
+    const QModelIndex parent = proxyParentOf(mapping);
+
+    // with a row limit, both orders hold at most that many rows, so look the rows up in a sorted copy
+    //   rather than in a table covering all source rows
+    std::vector<int> included = newOrder;
+    std::sort(included.begin(), included.end());
 
-    if (m_sortColumn != column || m_order != order)
+    std::vector<int> excludedRows;
+    const std::vector<int> shownRows = proxyOrder.toVector();
+    for (int row = 0; row < static_cast<int>(shownRows.size()); ++row)
     {
-        int oldColumn = m_sortColumn;
-        int oldOrder = m_order;
+        if (!std::binary_search(included.cbegin(), included.cend(), shownRows[row]))
+            excludedRows.push_back(row);
+    }
+    removeProxyRows(mapping, excludedRows);
 
-        m_sortColumn = column;
-        m_order = order;
+    std::vector<int> addedRows;
+    for (int handle : newOrder)
+    {
+        if (!proxyOrder.contains(handle))
+            addedRows.push_back(handle);
+    }
+    if (!addedRows.empty())
+    {
+        const int rowCount = proxyOrder.size();
+        beginInsertRows(parent, rowCount, rowCount + static_cast<int>(addedRows.size()) - 1);
+        proxyOrder.insert(rowCount, addedRows.cbegin(), addedRows.cend());
+        endInsertRows();
+    }
 
-        reorder();
+    moveRowsToOrder(mapping, newOrder);
+}
 
-        if (oldOrder != m_order)
-            Q_EMIT sortOrderChanged();
-        if (oldColumn != m_sortColumn)
-            Q_EMIT sortColumnChanged();
+/**
+ * @brief SortProxyModel::applyRowLimit restores the row limit after top level rows were inserted,
+ * removed or changed
+ *
+ * Rows beyond the limit are moved to the heap. Then, as long as there is room for more rows, or the
+ * first row in the heap sorts before the last row shown, that row takes the place of the last row.
+ */
+void SortProxyModel::applyRowLimit()
+{
+    Mapping &mapping = m_rootMapping;
+    RowSequence &proxyOrder = *mapping.proxyOrder;
+    RowHeap &rowsBeyondLimit = *m_rowsBeyondLimit;
+    const SortKeyCache &sortKeys = *mapping.sortKeys;
+    const auto less = [&sortKeys](int lhs, int rhs) { return sortKeys.lessThan(lhs, rhs); };
+
+    const auto removeRowsFrom = [&](int firstRow) {
+        const int lastRow = proxyOrder.size() - 1;
+        beginRemoveRows({}, firstRow, lastRow);
+        const std::vector<int> removedRows = proxyOrder.handles(firstRow, lastRow);
+        proxyOrder.remove(firstRow, lastRow);
+        for (int handle : removedRows)
+            rowsBeyondLimit.push(handle);
+        endRemoveRows();
+        for (int handle : removedRows)
+            mapping.children.erase(handle);
+    };
+
+    if (proxyOrder.size() > m_rowLimit)
+        removeRowsFrom(m_rowLimit);
+
+    while (!rowsBeyondLimit.isEmpty()
+           && (proxyOrder.size() < m_rowLimit
+               || (proxyOrder.size() > 0 && less(rowsBeyondLimit.top(), proxyOrder.at(proxyOrder.size() - 1)))))
+    {
+        if (proxyOrder.size() == m_rowLimit)
+            removeRowsFrom(m_rowLimit - 1);
+
+        const int handle = rowsBeyondLimit.pop();
+        const int row = proxyOrder.lowerBound(handle, less);
+        beginInsertRows({}, row, row);
+        proxyOrder.insert(row, handle);
+        endInsertRows();
+    }
+}
+
+bool SortProxyModel::isRowLimited(const Mapping &mapping) const
+{
+    return m_rowLimit >= 0 && &mapping == &m_rootMapping;
+}
+
+/**
+ * Evaluates the filter again for all source rows of @p mapping and the mappings below it, hiding
+ * the rows that no longer pass it and showing the ones that do now.
+ */
+void SortProxyModel::refilter(Mapping &mapping)
+{
+    std::vector<int> rowsToShow;
+    std::vector<int> rowsToHide;
+    const std::vector<int> handles = mapping.sourceOrder->toVector();
+    for (int sourceRow = 0; sourceRow < static_cast<int>(handles.size()); ++sourceRow)
+    {
+        const int handle = handles[sourceRow];
+        const bool accepted = filterAcceptsRow(mapping, sourceRow);
+        if (accepted != isAcceptedRow(mapping, handle))
+            (accepted ? rowsToShow : rowsToHide).push_back(handle);
+    }
+    hideSourceRows(mapping, rowsToHide);
+    showSourceRows(mapping, std::move(rowsToShow));
+    if (isRowLimited(mapping))
+        applyRowLimit();
+
+    for (auto &child : mapping.children)
+        refilter(*child.second);
+}
+
+/**
+ * @brief SortProxyModel::showSourceRows adds the rows with @p handles, which passed the filter but are
+ * not part of @p mapping yet, at their sorted position
+ *
+ * The new rows are sorted among themselves first, and then merged into the proxy. The insert
+ * position of each run of new rows is found with a binary search, so the existing rows are only
+ * compared O(log n) times per run, and adjacent new rows are inserted in one go. With a row limit,
+ * only the new rows that make it into the limit are sorted and merged; the others go straight into
+ * the heap.
+ */
+void SortProxyModel::showSourceRows(Mapping &mapping, std::vector<int> handles)
+{
+    if (handles.empty())
+        return;
+    if (m_sortPending && &mapping == &m_rootMapping)
+        scheduleSort(); // the pending result does not cover the new rows
+
+    RowSequence &proxyOrder = *mapping.proxyOrder;
+    const SortKeyCache &sortKeys = *mapping.sortKeys;
+    const auto less = [&sortKeys](int lhs, int rhs) { return sortKeys.lessThan(lhs, rhs); };
+    const bool rowLimited = isRowLimited(mapping);
+    if (rowLimited)
+    {
+        const int count = static_cast<int>(handles.size());
+        int kept = std::min(m_rowLimit, count);
+        sortKeys.partialSort(handles.begin(), handles.begin() + kept, handles.end());
+        const int rowCount = proxyOrder.size();
+        if (rowCount > 0)
+        {
+            const int room = std::max(0, m_rowLimit - rowCount);
+            const int last = proxyOrder.at(rowCount - 1);
+            const int sortBeforeLast = static_cast<int>(
+                std::lower_bound(handles.cbegin(), handles.cbegin() + kept, last, less) - handles.cbegin());
+            kept = std::min(kept, std::max(room, sortBeforeLast));
+        }
+        for (auto it = handles.cbegin() + kept; it != handles.cend(); ++it)
+            m_rowsBeyondLimit->push(*it);
+        handles.resize(static_cast<std::size_t>(kept));
+    }
+    else
+    {
+        sortMappingContainer(mapping, handles);
+    }
+
+    const QModelIndex proxyParent = proxyParentOf(mapping);
+    auto newIt = handles.cbegin();
+    while (newIt != handles.cend())
+    {
+        const int insertStartPos = proxyOrder.lowerBound(*newIt, less);
+
+        // see how many more items we can insert in one go
+        auto lastInsert = newIt;
+        if (insertStartPos < proxyOrder.size())
+        {
+            const int nextHandle = proxyOrder.at(insertStartPos);
+            while (successor(lastInsert) != handles.cend() && less(*successor(lastInsert), nextHandle))
+                ++lastInsert;
+        }
+        else
+        {
+            lastInsert = predecessor(handles.cend());
+        }
+
+        const auto insertLength = static_cast<int>(lastInsert - newIt) + 1;
+        beginInsertRows(proxyParent, insertStartPos, insertStartPos + insertLength - 1);
+        proxyOrder.insert(insertStartPos, newIt, successor(lastInsert));
+        endInsertRows();
+
+        newIt = successor(lastInsert);
     }
+
+    if (rowLimited)
+        applyRowLimit();
 }
 
-QVariant SortProxyModel::data(const QModelIndex &proxyIndex, int role) const
+/**
+ * @brief SortProxyModel::hideSourceRows takes the rows with @p handles, which no longer pass the
+ * filter, out of @p mapping
+ *
+ * The source model still has the rows. Rows beyond the row limit are only taken out of the heap.
+ */
+void SortProxyModel::hideSourceRows(Mapping &mapping, const std::vector<int> &handles)
 {
-    if (proxyIndex.isValid() && !isInvalidedRow(proxyIndex.row()))
+    if (handles.empty())
+        return;
+    if (m_sortPending && &mapping == &m_rootMapping)
+        scheduleSort(); // the pending result still contains the hidden rows
+
+    const bool rowLimited = isRowLimited(mapping);
+    std::vector<int> proxyRows;
+    for (int handle : handles)
     {
-        return QAbstractProxyModel::data(proxyIndex, role);
+        if (rowLimited && m_rowsBeyondLimit->contains(handle))
+            m_rowsBeyondLimit->remove(handle);
+        else
+            proxyRows.push_back(mapping.proxyOrder->positionOf(handle));
     }
-    return {};
+    std::sort(proxyRows.begin(), proxyRows.end());
+    removeProxyRows(mapping, proxyRows);
 }
 
-void SortProxyModel::setSourceModel(QAbstractItemModel *model)
+/**
+ * Removes the sorted @p proxyRows from @p mapping, using one removal per range of adjacent rows.
+ * The rows are only taken out of the proxy; the source model still has them.
+ */
+void SortProxyModel::removeProxyRows(Mapping &mapping, const std::vector<int> &proxyRows)
 {
-    if (model != sourceModel())
+    RowSequence &proxyOrder = *mapping.proxyOrder;
+    const QModelIndex parent = proxyParentOf(mapping);
+    auto it = proxyRows.cend();
+    while (it != proxyRows.cbegin())
     {
-        beginResetModel();
-        if (sourceModel())
-            sourceModel()->disconnect(this);
-        QAbstractProxyModel::setSourceModel(model);
-        if (model)
-        {
-            connect(model, &QAbstractItemModel::dataChanged, this, &SortProxyModel::handleDataChanged);
-            connect(model, &QAbstractItemModel::rowsInserted, this, &SortProxyModel::handleRowsInserted);
-            connect(model, &QAbstractItemModel::rowsRemoved, this, &SortProxyModel::handleRowsRemoved);
-        }
-        endResetModel();
+        --it;
+        const int lastRow = *it;
+        while (it != proxyRows.cbegin() && *predecessor(it) == *it - 1)
+            --it;
+        const int firstRow = *it;
+
+        beginRemoveRows(parent, firstRow, lastRow);
+        const std::vector<int> removedRows = proxyOrder.handles(firstRow, lastRow);
+        proxyOrder.remove(firstRow, lastRow);
+        endRemoveRows();
+        for (int handle : removedRows)
+            mapping.children.erase(handle);
     }
 }
 
-QModelIndex SortProxyModel::mapToSource(const QModelIndex &proxyIndex) const
+bool SortProxyModel::filterAcceptsRow(const Mapping &mapping, int sourceRow) const
 {
-    if (!proxyIndex.isValid())
-        return {};
-
-    Q_ASSERT(proxyIndex.model() == this);
-
-    // no further bounds checking, out of bounds indices are a breach of contract
-    return sourceModel()->index(static_cast<int>(proxyIndex.internalId()), proxyIndex.column());
+    return !m_filterAcceptsRowFunction || m_filterAcceptsRowFunction(sourceModel(), sourceRow, mapping.sourceParent);
 }
 
-QModelIndex SortProxyModel::mapFromSource(const QModelIndex &sourceIndex) const
+/**
+ * @returns whether the row with @p handle in @p mapping passed the filter when it was last evaluated.
+ * Such a row is either shown, or beyond the row limit.
+ */
+bool SortProxyModel::isAcceptedRow(const Mapping &mapping, int handle) const
 {
-    if (!sourceIndex.isValid())
-        return {};
-
-    Q_ASSERT(sourceIndex.model() == sourceModel());
-
-    if (sourceIndex.parent().isValid())
-        return {};
-
-    // no further bounds checking, out of bounds indices are a breach of contract
-    const auto proxyRow = mapToProxyRow(sourceIndex.row());
-    return index(proxyRow, sourceIndex.column());
+    return mapping.proxyOrder->contains(handle) || (isRowLimited(mapping) && m_rowsBeyondLimit->contains(handle));
 }
 
-void SortProxyModel::setSortRole(int role)
+/**
+ * @returns the handles of the rows that pass the filter, out of @p handles, the handles of the source
+ * rows of @p mapping from @p firstRow on
+ */
+std::vector<int> SortProxyModel::acceptedRows(const Mapping &mapping, int firstRow,
+                                              const std::vector<int> &handles) const
 {
-    if (m_sortRole != role)
+    std::vector<int> rows;
+    rows.reserve(handles.size());
+    for (std::size_t i = 0; i < handles.size(); ++i)
     {
-        m_sortRole = role;
-        Q_EMIT sortRoleChanged();
-        reorder();
+        if (filterAcceptsRow(mapping, firstRow + static_cast<int>(i)))
+            rows.push_back(handles[i]);
     }
+    return rows;
 }
 
-int SortProxyModel::sortRole() const
+/**
+ * @brief SortProxyModel::scheduleSort requests an asynchronous sort of the top level rows
+ *
+ * Invalidates any sort already running. The sort itself is started from the event loop, so a
+ * burst of changes results in a single new sort.
+ */
+void SortProxyModel::scheduleSort()
 {
-    return m_sortRole;
-}
+    ++m_sortGeneration;
+    setSortPending(true);
+    if (m_sortStartQueued)
+        return;
 
-void SortProxyModel::setSortCaseSensitivity(Qt::CaseSensitivity sensitivity)
-{
-    if (m_caseSensitivity != sensitivity)
-    {
-        m_caseSensitivity = sensitivity;
-        Q_EMIT sortCaseSensitivityChanged();
-        reorder();
-    }
+    m_sortStartQueued = true;
+    QMetaObject::invokeMethod(this, &SortProxyModel::startAsynchronousSort, Qt::QueuedConnection);
 }
 
-Qt::CaseSensitivity SortProxyModel::sortCaseSensitivity() const
+void SortProxyModel::startAsynchronousSort()
 {
-    return m_caseSensitivity;
+    m_sortStartQueued = false;
+    if (!m_sortPending)
+        return;
+
+    // the snapshot of the keys is shared with the worker thread. Rows are only compared by their
+    // keys, so the worker never touches the source model. The keys are those of the top level, so
+    // the snapshot does not hold any persistent indexes of the source model either. The collation
+    // keys were computed on this thread already, but QVariant keys are compared with a collator,
+    // which must not share its data with the one used here. Rows with equal keys are ordered by a
+    // copy of their source rows, as the source order changes on this thread.
+    const auto snapshot = std::make_shared<SortKeyCache>(*m_rootMapping.sortKeys);
+    snapshot->detachCollators();
+    snapshot->freezeSourceOrder();
+    std::shared_ptr<const SortKeyCache> keys = snapshot;
+    const std::vector<int> rows = m_rootMapping.proxyOrder->toVector(); // the rows that pass the filter
+    const int generation = m_sortGeneration;
+    const std::shared_ptr<AsynchronousSortState> state = m_asynchronousSortState;
+    const int parallelSortThreshold = m_parallelSorting ? m_parallelSortThreshold : 0;
+
+    QThreadPool::globalInstance()->start([keys, rows, generation, state, parallelSortThreshold]() {
+        std::vector<int> newOrder = rows;
+        keys->sort(newOrder.begin(), newOrder.end(), parallelSortThreshold);
+
+        QMutexLocker locker(&state->mutex);
+        if (!state->model)
+            return;
+        SortProxyModel *model = state->model;
+        QMetaObject::invokeMethod(
+            model, [model, generation, newOrder]() { model->applyAsynchronousSort(generation, newOrder); },
+            Qt::QueuedConnection);
+    });
 }
 
-int SortProxyModel::sortColumn() const
+void SortProxyModel::applyAsynchronousSort(int generation, const std::vector<int> &newOrder)
 {
-    return m_sortColumn;
+    if (generation != m_sortGeneration)
+        return; // outdated, a newer sort has been scheduled since
+
+    Q_ASSERT(static_cast<int>(newOrder.size()) == m_rootMapping.proxyOrder->size());
+    setSortPending(false);
+    moveRowsToOrder(m_rootMapping, newOrder);
 }
 
-Qt::SortOrder SortProxyModel::sortOrder() const
+void SortProxyModel::setSortPending(bool pending)
 {
-    return m_order;
+    if (m_sortPending != pending)
+    {
+        m_sortPending = pending;
+        Q_EMIT sortPendingChanged();
+    }
 }
 
-bool SortProxyModel::lessThan(const QModelIndex &source_left, const QModelIndex &source_right) const
+/**
+ * @brief SortProxyModel::moveRowsToOrder moves the rows of @p mapping into the order given by @p newOrder
+ * @param newOrder a permutation of the handles of the proxy rows of @p mapping in the desired order
+ *
+ * Rows that are on the longest increasing subsequence of their current proxy rows (in the new order)
+ * are already in the right order relative to each other, and stay where they are. Only the other rows
+ * are moved, each to just before the row that follows it in the new order. Rows that are to be moved
+ * to the same place and that are already adjacent are moved together in a single move.
+ */
+void SortProxyModel::moveRowsToOrder(Mapping &mapping, const std::vector<int> &newOrder)
 {
-    const QVariant lhs = source_left.data(m_sortRole);
-    const QVariant rhs = source_right.data(m_sortRole);
+    const std::vector<int> currentOrder = mapping.proxyOrder->toVector();
+    if (newOrder == currentOrder)
+        return;
 
-#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-    if (lhs.typeId() == QMetaType::QString && rhs.typeId() == QMetaType::QString)
-#else
-    if (lhs.type() == QVariant::String && rhs.type() == QVariant::String)
-#endif
+    const int rowCount = static_cast<int>(newOrder.size());
+    if (m_reorderSignalPolicy == AlwaysEmitLayoutChange)
+    {
+        changeLayoutToOrder(mapping, newOrder);
+        return;
+    }
+
+    // a table of the current rows by handle covers all source rows, which only pays off if most of
+    //   them are shown; below the row limit, the rows are looked up one by one
+    std::vector<int> currentRows(newOrder.size());
+    if (static_cast<qint64>(rowCount) * 16 >= mapping.handleCount)
     {
-        return QString::compare(lhs.toString(), rhs.toString(), m_caseSensitivity) < 0;
+        std::vector<int> currentRowOf(static_cast<std::size_t>(mapping.handleCount));
+        for (int row = 0; row < rowCount; ++row)
+            currentRowOf[currentOrder[row]] = row;
+        for (int newRow = 0; newRow < rowCount; ++newRow)
+            currentRows[newRow] = currentRowOf[newOrder[newRow]];
     }
     else
     {
-        return QAbstractItemModelPrivate::isVariantLessThan(lhs, rhs, m_caseSensitivity, false);
+        for (int newRow = 0; newRow < rowCount; ++newRow)
+            currentRows[newRow] = mapping.proxyOrder->positionOf(newOrder[newRow]);
     }
+    const std::vector<bool> staysInPlace = longestIncreasingSubsequence(currentRows);
+    const int movedRows = static_cast<int>(std::count(staysInPlace.begin(), staysInPlace.end(), false));
+    moveRowsToOrder(mapping, newOrder, staysInPlace, movedRows);
 }
 
-void SortProxyModel::resetInternalData()
+/**
+ * @brief SortProxyModel::moveRowsToOrder moves the rows that do not stay in place
+ * @param newOrder a permutation of the handles of the proxy rows of @p mapping in the desired order
+ * @param staysInPlace for every row in @p newOrder, whether it keeps its current proxy row. The rows
+ * that stay must be in increasing order of their current proxy rows.
+ * @param movedRows the number of rows that do not stay in place
+ *
+ * Emits a layout change instead if the reorder signal policy asks for it.
+ */
+void SortProxyModel::moveRowsToOrder(Mapping &mapping, const std::vector<int> &newOrder,
+                                     const std::vector<bool> &staysInPlace, int movedRows)
 {
-    rebuildRowMap();
-}
+    const int rowCount = static_cast<int>(newOrder.size());
+    if (useLayoutChange(movedRows, rowCount))
+    {
+        changeLayoutToOrder(mapping, newOrder);
+        return;
+    }
 
-void SortProxyModel::rebuildRowMap()
-{
-    // simple initial sort. No emitting of row moves
-    m_proxyToSourceMap.clear();
-    if (sourceModel())
+    const RowSequence &proxyOrder = *mapping.proxyOrder;
+    for (int newRow = rowCount - 1; newRow >= 0; --newRow)
     {
-        m_proxyToSourceMap.resize(static_cast<ulong>(sourceModel()->rowCount()));
-        std::iota(m_proxyToSourceMap.begin(), m_proxyToSourceMap.end(), 0);
-        sortMappingContainer(m_proxyToSourceMap);
+        if (staysInPlace[newRow])
+            continue;
+
+        const int lastNewRow = newRow;
+        const int lastRow = proxyOrder.positionOf(newOrder[newRow]);
+        int firstRow = lastRow;
+        // see how many rows in front of this one can go along in the same move
+        while (newRow > 0 && !staysInPlace[newRow - 1] && proxyOrder.positionOf(newOrder[newRow - 1]) == firstRow - 1)
+        {
+            --newRow;
+            --firstRow;
+        }
+
+        const int destinationRow =
+            lastNewRow + 1 < rowCount ? proxyOrder.positionOf(newOrder[lastNewRow + 1]) : rowCount;
+        if (destinationRow != lastRow + 1)
+            moveProxyRows(mapping, firstRow, lastRow, destinationRow);
     }
-    buildReverseMap(m_proxyToSourceMap, m_sourceToProxyMap);
 }
 
-template<class Iterator>
-inline Iterator predecessor(Iterator it)
+/**
+ * @brief SortProxyModel::reorderChangedRows puts rows whose sort keys changed in their new place
+ * @param changedHandles the handles of the rows with changed keys
+ *
+ * The rows whose keys did not change are still sorted relative to each other, so the new position
+ * of every changed row can be found with a binary search among them, once the changed rows are taken
+ * out of the proxy order for a moment. Only changed rows that end up in a different place are moved;
+ * the unchanged rows are not compared or moved at all. With k changed rows, this takes O(k log n).
+ */
+void SortProxyModel::reorderChangedRows(Mapping &mapping, const std::vector<int> &changedHandles)
 {
-    --it;
-    return it;
-}
+    if ((m_sortPending && &mapping == &m_rootMapping) || m_sortColumn == -1)
+    {
+        // the proxy is not sorted at the moment, so there is nothing to search in
+        reorder(mapping);
+        return;
+    }
 
-template<class Iterator>
-inline Iterator successor(Iterator it)
-{
-    ++it;
-    return it;
-}
+    RowSequence &proxyOrder = *mapping.proxyOrder;
+    const SortKeyCache &sortKeys = *mapping.sortKeys;
+    const auto less = [&sortKeys](int lhs, int rhs) { return sortKeys.lessThan(lhs, rhs); };
+    const int rowCount = proxyOrder.size();
+    const int changedCount = static_cast<int>(changedHandles.size());
+
+    // the current proxy rows of the changed rows, in increasing order, with their handles
+    std::vector<std::pair<int, int>> changedProxyRows;
+    changedProxyRows.reserve(changedHandles.size());
+    for (int handle : changedHandles)
+        changedProxyRows.emplace_back(proxyOrder.positionOf(handle), handle);
+    std::sort(changedProxyRows.begin(), changedProxyRows.end());
+
+    // the changed rows in their new order
+    std::vector<int> changed = changedHandles;
+    sortKeys.sort(changed.begin(), changed.end());
+
+    // take the changed rows out, so only the unchanged rows are left, still in sorted order. Then find
+    //   the number of unchanged rows in front of each changed row, and the row that follows it in the
+    //   new order, or -1 at the end. Finally put the changed rows back where they were.
+    for (auto it = changedProxyRows.crbegin(); it != changedProxyRows.crend(); ++it)
+        proxyOrder.remove(it->first, it->first);
+    std::vector<int> unchangedBefore(changed.size());
+    for (int i = 0; i < changedCount; ++i)
+        unchangedBefore[i] = proxyOrder.lowerBound(changed[i], less);
+    std::vector<int> followingRows(changed.size());
+    for (int i = 0; i < changedCount; ++i)
+    {
+        if (i + 1 < changedCount && unchangedBefore[i + 1] == unchangedBefore[i])
+            followingRows[i] = changed[i + 1];
+        else
+            followingRows[i] = unchangedBefore[i] < proxyOrder.size() ? proxyOrder.at(unchangedBefore[i]) : -1;
+    }
+    for (const auto &changedProxyRow : changedProxyRows)
+        proxyOrder.insert(changedProxyRow.first, changedProxyRow.second);
+
+    // A changed row can stay where it is if it already has the same unchanged rows in front of it.
+    // Of those candidates, keep the largest set that is in the right order relative to each other.
+    std::vector<int> candidates;
+    std::vector<int> candidateRows;
+    for (int i = 0; i < changedCount; ++i)
+    {
+        const int currentRow = proxyOrder.positionOf(changed[i]);
+        const auto changedBefore = static_cast<int>(std::distance(
+            changedProxyRows.cbegin(),
+            std::lower_bound(changedProxyRows.cbegin(), changedProxyRows.cend(), currentRow,
+                             [](const std::pair<int, int> &entry, int row) { return entry.first < row; })));
+        if (currentRow - changedBefore == unchangedBefore[i])
+        {
+            candidates.push_back(i);
+            candidateRows.push_back(currentRow);
+        }
+    }
+    std::vector<bool> changedStaysInPlace(changed.size(), false);
+    const std::vector<bool> candidateStays = longestIncreasingSubsequence(candidateRows);
+    for (std::size_t c = 0; c < candidates.size(); ++c)
+        changedStaysInPlace[candidates[c]] = candidateStays[c];
+
+    const int movedRows =
+        static_cast<int>(std::count(changedStaysInPlace.cbegin(), changedStaysInPlace.cend(), false));
+    if (movedRows == 0)
+        return;
 
-template<class Iterator, class Predicate>
-inline Iterator find_if_from_back(const Iterator &begin, const Iterator &end, Predicate predicate)
-{
-    auto it = end;
-    do
+    if (useLayoutChange(movedRows, rowCount))
+    {
+        // splice the changed rows into the unchanged ones
+        const std::vector<int> currentOrder = proxyOrder.toVector();
+        std::vector<int> newOrder;
+        newOrder.reserve(currentOrder.size());
+        auto nextChanged = changedProxyRows.cbegin();
+        int unchangedCount = 0;
+        int i = 0;
+        for (int row = 0; row < rowCount; ++row)
+        {
+            if (nextChanged != changedProxyRows.cend() && nextChanged->first == row)
+            {
+                ++nextChanged;
+                continue;
+            }
+            while (i < changedCount && unchangedBefore[i] == unchangedCount)
+                newOrder.push_back(changed[i++]);
+            newOrder.push_back(currentOrder[row]);
+            ++unchangedCount;
+        }
+        newOrder.insert(newOrder.end(), changed.cbegin() + i, changed.cend());
+        changeLayoutToOrder(mapping, newOrder);
+        return;
+    }
+
+    // move the changed rows from the back, each to just before the row that follows it in the new order
+    for (int i = changedCount - 1; i >= 0; --i)
     {
-        auto pred = predecessor(it);
-        if (predicate(*pred))
+        if (changedStaysInPlace[i])
+            continue;
+
+        const int lastIndex = i;
+        const int lastRow = proxyOrder.positionOf(changed[i]);
+        int firstRow = lastRow;
+        // see how many rows in front of this one can go along in the same move
+        while (i > 0 && unchangedBefore[i - 1] == unchangedBefore[i] && !changedStaysInPlace[i - 1]
+               && proxyOrder.positionOf(changed[i - 1]) == firstRow - 1)
         {
-            return pred;
+            --i;
+            --firstRow;
         }
-        it = pred;
-    } while (it != begin);
 
-    return end;
+        const int followingRow = followingRows[lastIndex];
+        const int destinationRow = followingRow < 0 ? rowCount : proxyOrder.positionOf(followingRow);
+        if (destinationRow != lastRow + 1)
+            moveProxyRows(mapping, firstRow, lastRow, destinationRow);
+    }
 }
 
-template<class Iterator>
-inline Iterator find_from_back(const Iterator &begin, const Iterator &end, const typename Iterator::value_type &value)
+bool SortProxyModel::useLayoutChange(int movedRows, int rowCount) const
 {
-    const auto predicate = [value](const typename Iterator::value_type &itemValue) { return itemValue == value; };
-
-    return find_if_from_back(begin, end, predicate);
+    switch (m_reorderSignalPolicy)
+    {
+    case AlwaysEmitRowMoves:
+        return false;
+    case EmitLayoutChangeAboveThreshold:
+        return movedRows > m_layoutChangeMoveThreshold || movedRows > m_layoutChangeRowFraction * rowCount;
+    case AlwaysEmitLayoutChange:
+        return true;
+    }
+    return false;
 }
 
-void SortProxyModel::reorder()
+/**
+ * @brief SortProxyModel::changeLayoutToOrder puts the rows of @p mapping in the order given by @p newOrder
+ * in one go
+ *
+ * Emits a single layoutAboutToBeChanged/layoutChanged pair, and updates the persistent indexes of the
+ * rows in @p mapping in bulk. For rows below a parent, the parent is passed along with the signals.
+ */
+void SortProxyModel::changeLayoutToOrder(Mapping &mapping, const std::vector<int> &newOrder)
 {
-    // update the sort order. Emits row moves
-    if (m_proxyToSourceMap.empty()) // checks emptiness, doesn't empty by itself
-        return;
-
-    auto newOrder = m_proxyToSourceMap; // deep copy
-
-    if (m_sortColumn == -1)
+    QList<QPersistentModelIndex> parents;
+    if (mapping.parent)
+        parents.append(proxyParentOf(mapping));
+    Q_EMIT layoutAboutToBeChanged(parents, QAbstractItemModel::VerticalSortHint);
+
+    QModelIndexList oldIndexes;
+    std::vector<int> handles;
+    const QModelIndexList persistentIndexes = persistentIndexList();
+    for (const QModelIndex &persistentIndex : persistentIndexes)
     {
-        std::iota(newOrder.begin(), newOrder.end(), 0);
+        if (mappingOf(persistentIndex) != &mapping)
+            continue;
+        oldIndexes.append(persistentIndex);
+        handles.push_back(mapping.proxyOrder->at(persistentIndex.row()));
     }
-    else
+
+    mapping.proxyOrder->assign(newOrder.cbegin(), newOrder.cend());
+
+    QModelIndexList newIndexes;
+    newIndexes.reserve(oldIndexes.size());
+    for (int i = 0; i < oldIndexes.size(); ++i)
     {
-        sortMappingContainer(newOrder);
+        newIndexes.append(createIndex(mapping.proxyOrder->positionOf(handles[i]), oldIndexes.at(i).column(), &mapping));
     }
-    // during a reorder, we don't try to keep the reverse map in order. We clear and rebuild later.
-    m_sourceToProxyMap.clear();
+    changePersistentIndexList(oldIndexes, newIndexes);
 
-    auto orderedIt = predecessor(newOrder.end());
-    auto unorderedIt = predecessor(m_proxyToSourceMap.end());
+    Q_EMIT layoutChanged(parents, QAbstractItemModel::VerticalSortHint);
+}
 
-    while (orderedIt != newOrder.begin())
+/**
+ * Moves the proxy rows @p firstRow to @p lastRow of @p mapping to just before @p destinationRow,
+ * emitting the row move signals.
+ */
+void SortProxyModel::moveProxyRows(Mapping &mapping, int firstRow, int lastRow, int destinationRow)
+{
+    const QModelIndex parent = proxyParentOf(mapping);
+    const bool ok = beginMoveRows(parent, firstRow, lastRow, parent, destinationRow);
+    if (!ok)
     {
-        if (*orderedIt == *unorderedIt)
-        {
-            --orderedIt;
-            --unorderedIt;
-        }
-        else
-        {
-            auto it = find_from_back(m_proxyToSourceMap.begin(), unorderedIt, *orderedIt);
-            // we know it is valid, as newOrder is just a permutation of m_rowMap
-            int movedRow = static_cast<int>(it - m_proxyToSourceMap.begin());
-            int destinationRow = static_cast<int>(unorderedIt - m_proxyToSourceMap.begin()) + 1;
-            int moveCount = 1;
-
-            while (it != m_proxyToSourceMap.begin() && orderedIt != newOrder.begin() &&
-                   *predecessor(it) == *predecessor(orderedIt))
-            {
-                ++moveCount;
-                --movedRow;
-                --it;
-                --orderedIt;
-            }
-            bool ok = beginMoveRows(QModelIndex(), movedRow, movedRow + moveCount - 1, QModelIndex(), destinationRow);
-            if (!ok)
-            {
-                qWarning() << "moveRows from" << movedRow << "up to" << movedRow + moveCount - 1 << "to"
-                           << destinationRow;
-                QStringList contents;
-                contents.reserve(rowCount());
-                for (int row = 0; row < rowCount(); ++row)
-                {
-                    contents << index(row).data(m_sortRole).toString();
-                }
-                qWarning() << "moving failed. Current contents:" << contents.join(QLatin1String(", "));
-            }
-            auto rotateEnd = successor(unorderedIt);
-            std::rotate(it, it + moveCount, rotateEnd);
-            endMoveRows();
-            --orderedIt;
-            unorderedIt = rotateEnd - (moveCount + 1);
-        }
+        qWarning() << "moving rows" << firstRow << "up to" << lastRow << "to" << destinationRow << "failed";
+        return;
     }
 
-    buildReverseMap(m_proxyToSourceMap, m_sourceToProxyMap);
+    mapping.proxyOrder->move(firstRow, lastRow, destinationRow);
+    endMoveRows();
 }
 
-void SortProxyModel::sortMappingContainer(std::vector<int> &container)
+void SortProxyModel::sortMappingContainer(const Mapping &mapping, std::vector<int> &container) const
 {
     if (m_sortColumn == -1)
         return;
 
-    std::sort(container.begin(), container.end(),
-              [this](int lhs, int rhs) { return lessThan(lhs, rhs) != (m_order == Qt::DescendingOrder); });
+    mapping.sortKeys->sort(container.begin(), container.end(), m_parallelSorting ? m_parallelSortThreshold : 0);
+}
+
+/**
+ * @returns the proxy row of @p sourceRow in @p mapping, or -1 if the row is not shown
+ */
+int SortProxyModel::mapToProxyRow(const Mapping &mapping, int sourceRow) const
+{
+    if (sourceRow < 0 || sourceRow >= mapping.sourceOrder->size())
+        return -1;
+
+    if (mapping.hasRowTable())
+        return mapping.sourceToProxyRows[sourceRow];
+    const int handle = mapping.sourceOrder->at(sourceRow);
+    return mapping.proxyOrder->contains(handle) ? mapping.proxyOrder->positionOf(handle) : -1;
 }
 
-bool SortProxyModel::lessThan(int source_left_row, int source_right_row) const
+/**
+ * @returns the mapping that contains the row of @p proxyIndex
+ */
+SortProxyModel::Mapping *SortProxyModel::mappingOf(const QModelIndex &proxyIndex) const
 {
-    if (m_sortColumn == -1)
-        return false;
+    return static_cast<Mapping *>(proxyIndex.internalPointer());
+}
 
-    return lessThan(sourceModel()->index(source_left_row, m_sortColumn),
-                    sourceModel()->index(source_right_row, m_sortColumn));
+/**
+ * @returns the mapping of the rows below @p proxyParent, creating it if it does not exist yet. Returns
+ * nullptr if the parent cannot have rows.
+ */
+SortProxyModel::Mapping *SortProxyModel::mappingFor(const QModelIndex &proxyParent) const
+{
+    if (!proxyParent.isValid())
+        return const_cast<Mapping *>(&m_rootMapping);
+
+    // only the first column has children, like in QTreeView
+    Mapping *parentMapping = mappingOf(proxyParent);
+    const int row = proxyParent.row();
+    if (proxyParent.column() != 0 || isInvalidedRow(*parentMapping, row))
+        return nullptr;
+
+    const int handle = parentMapping->proxyOrder->at(row);
+    const auto it = parentMapping->children.find(handle);
+    if (it != parentMapping->children.end())
+        return it->second.get();
+    return createChildMapping(*parentMapping, handle);
 }
 
-int SortProxyModel::mapToProxyRow(int sourceRow) const
+/**
+ * @returns the mapping of the rows below @p sourceParent. If it does not exist yet, it is created if
+ * @p create is true, and nullptr is returned otherwise. Also returns nullptr if the parent is not part
+ * of the proxy.
+ */
+SortProxyModel::Mapping *SortProxyModel::mappingForSource(const QModelIndex &sourceParent, bool create) const
 {
-    if (!m_sourceToProxyMap.empty())
-    {
-        // we have an up-to-date reverse mapping, so use that
-        return m_sourceToProxyMap[sourceRow];
-    }
+    if (!sourceParent.isValid())
+        return const_cast<Mapping *>(&m_rootMapping);
+    if (sourceParent.column() != 0)
+        return nullptr;
+
+    Mapping *parentMapping = mappingForSource(sourceParent.parent(), create);
+    if (!parentMapping)
+        return nullptr;
+
+    const int sourceRow = sourceParent.row();
+    if (sourceRow >= parentMapping->sourceOrder->size())
+        return nullptr;
+    const int handle = parentMapping->sourceOrder->at(sourceRow);
+    const auto it = parentMapping->children.find(handle);
+    if (it != parentMapping->children.end())
+        return it->second.get();
+    if (!create || !parentMapping->proxyOrder->contains(handle))
+        return nullptr;
+    return createChildMapping(*parentMapping, handle);
+}
+
+/**
+ * @brief SortProxyModel::createChildMapping sets up the mapping of the rows below a parent
+ * @param parent the mapping that contains the parent
+ * @param handle the handle of the parent
+ *
+ * The rows are sorted right away. No signals are emitted: the rows were there all along, they have
+ * just not been looked at so far.
+ */
+SortProxyModel::Mapping *SortProxyModel::createChildMapping(Mapping &parent, int handle) const
+{
+    auto mapping = std::make_unique<Mapping>();
+    mapping->parent = &parent;
+    mapping->handle = handle;
+    mapping->sourceParent = sourceModel()->index(parent.sourceOrder->positionOf(handle), 0, parent.sourceParent);
+    mapping->resetRows(sourceModel()->rowCount(mapping->sourceParent));
+    mapping->sortKeys->rebuild(sourceModel(), mapping->sourceParent, sortCriteria(), m_sortCollator);
+    std::vector<int> rows = acceptedRows(*mapping, 0, mapping->sourceOrder->toVector());
+    sortMappingContainer(*mapping, rows);
+    mapping->proxyOrder->assign(rows.cbegin(), rows.cend());
+
+    Mapping *result = mapping.get();
+    parent.children.emplace(handle, std::move(mapping));
+    return result;
+}
+
+/**
+ * @returns the proxy index of the parent of the rows in @p mapping
+ */
+QModelIndex SortProxyModel::proxyParentOf(const Mapping &mapping) const
+{
+    if (!mapping.parent)
+        return {};
 
-    // reverse mapping is not up to date, use slower linear search instead
-    auto it = std::find(m_proxyToSourceMap.cbegin(), m_proxyToSourceMap.cend(), sourceRow);
-    return static_cast<int>(it - m_proxyToSourceMap.cbegin());
+    // a parent that has been removed from the source may still be waiting to be removed from the proxy
+    const RowSequence &parentRows = *mapping.parent->proxyOrder;
+    if (!parentRows.contains(mapping.handle))
+        return {};
+    return createIndex(parentRows.positionOf(mapping.handle), 0, mapping.parent);
 }
 
 void SortProxyModel::handleDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight,
                                        const QVector<int> &roles)
 {
-    // Map the row-range
+    // nothing to do if the rows have not been queried yet
+    Mapping *mapping = mappingForSource(topLeft.parent(), false);
+    if (!mapping)
+        return;
+
     const int firstSrcRow = topLeft.row();
-    const std::vector<int>::size_type rowCnt = bottomRight.row() - firstSrcRow + 1;
-    std::vector<int> rows(rowCnt);
-    for (int r = 0; r < (int)rowCnt; ++r)
+    const std::vector<int> handles = mapping->sourceOrder->handles(firstSrcRow, bottomRight.row());
+
+    // rows that stop passing the filter are hidden right away, while the keys still match the order
+    //   of the proxy. Rows that start passing it are shown once the other rows are in order again.
+    std::vector<int> rowsToShow;
+    if (m_filterAcceptsRowFunction)
     {
-        rows[r] = mapToProxyRow(r + firstSrcRow);
+        std::vector<int> rowsToHide;
+        for (std::size_t i = 0; i < handles.size(); ++i)
+        {
+            const bool accepted = filterAcceptsRow(*mapping, firstSrcRow + static_cast<int>(i));
+            if (accepted != isAcceptedRow(*mapping, handles[i]))
+                (accepted ? rowsToShow : rowsToHide).push_back(handles[i]);
+        }
+        hideSourceRows(*mapping, rowsToHide);
+    }
+
+    // Map the row-range, skipping rows that are not shown
+    std::vector<int> rows;
+    rows.reserve(handles.size());
+    for (int handle : handles)
+    {
+        if (mapping->proxyOrder->contains(handle))
+            rows.push_back(mapping->proxyOrder->positionOf(handle));
     }
     std::sort(rows.begin(), rows.end());
 
@@ -418,157 +2956,152 @@ void SortProxyModel::handleDataChanged(const QModelIndex &topLeft, const QModelI
     // re-emit the dataChanged signals
     for (const auto &range : ranges)
     {
-        QModelIndex pTopLeft = index(range.from, topLeft.column());
-        QModelIndex pBottomRight = index(range.to, bottomRight.column());
+        QModelIndex pTopLeft = createIndex(range.from, topLeft.column(), mapping);
+        QModelIndex pBottomRight = createIndex(range.to, bottomRight.column(), mapping);
         Q_EMIT dataChanged(pTopLeft, pBottomRight, roles);
     }
 
     // re-order if needed
-    if (roles.isEmpty() || roles.contains(m_sortRole))
+    std::vector<int> changedRows;
+    if (!mapping->sortKeys->updateRows(firstSrcRow, handles, topLeft.column(), bottomRight.column(), roles,
+                                       changedRows))
+    {
+        reorder(*mapping); // all keys were reloaded
+        changedRows.clear();
+    }
+    changedRows.erase(std::remove_if(changedRows.begin(), changedRows.end(),
+                                     [this, mapping](int handle) { return !isAcceptedRow(*mapping, handle); }),
+                      changedRows.end());
+
+    if (isRowLimited(*mapping))
     {
-        reorder();
+        const auto isShown = [this](int handle) { return !m_rowsBeyondLimit->contains(handle); };
+        const auto rowsBeyondLimit = std::stable_partition(changedRows.begin(), changedRows.end(), isShown);
+        if (rowsBeyondLimit != changedRows.end())
+            m_rowsBeyondLimit->update(std::vector<int>(rowsBeyondLimit, changedRows.end()));
+        changedRows.erase(rowsBeyondLimit, changedRows.end());
+        if (!changedRows.empty())
+            reorderChangedRows(*mapping, changedRows);
+        applyRowLimit();
     }
+    else if (!changedRows.empty())
+    {
+        reorderChangedRows(*mapping, changedRows);
+    }
+    showSourceRows(*mapping, std::move(rowsToShow));
 }
 
 void SortProxyModel::handleRowsInserted(const QModelIndex &parent, int firstNewRow, int lastNewRow)
 {
-    if (parent.isValid())
+    // nothing to do if the rows below the parent have not been queried yet. If they were queried
+    //   since the insert, they already include the new rows.
+    Mapping *mapping = mappingForSource(parent, false);
+    const int count = lastNewRow - firstNewRow + 1;
+    if (!mapping || mapping->sourceOrder->size() + count != sourceModel()->rowCount(parent))
         return;
 
-    // reverse mapping is now invalid
-    m_sourceToProxyMap.clear();
-
-    // create a mapping for the new rows
-    std::vector<int> newRowsMap;
-    newRowsMap.resize(static_cast<ulong>(lastNewRow - firstNewRow + 1));
-    std::iota(newRowsMap.begin(), newRowsMap.end(), firstNewRow);
-    sortMappingContainer(newRowsMap);
-
-    // update the row indices in the mapping pointing to rows that shifted backwards
-    const int shift = lastNewRow - firstNewRow + 1;
-    for (auto &oldPos : m_proxyToSourceMap)
-    {
-        if (oldPos >= firstNewRow)
-        {
-            oldPos += shift;
-        }
-    }
-
-    // assure we have enough space for the new items (and avoid reallocations that can break iterators)
-    m_proxyToSourceMap.reserve(m_proxyToSourceMap.size() + newRowsMap.size());
-
-    // now merge the new rows into the mapping we already have
-    auto newIt = newRowsMap.begin();
-    auto curIt = m_proxyToSourceMap.begin();
-
-    while (curIt != m_proxyToSourceMap.end() && newIt != newRowsMap.end())
-    {
-        if (lessThan(*newIt, *curIt))
-        {
-            auto firstInsert = newIt;
-            // see how many more items we can insert in one go
-            while (successor(newIt) != newRowsMap.end() && !lessThan(*curIt, *successor(newIt)))
-            {
-                ++newIt;
-            }
-            const auto insertStartPos = static_cast<int>(curIt - m_proxyToSourceMap.begin());
-            const auto insertLength = static_cast<int>(newIt - firstInsert) + 1;
-            beginInsertRows({}, insertStartPos, insertStartPos + insertLength - 1);
-            curIt = m_proxyToSourceMap.insert(curIt, firstInsert, successor(newIt));
-            ++curIt;
-            endInsertRows();
-            ++newIt;
-        }
-        else
-        {
-            ++curIt;
-        }
-    }
-    // handle case of insert at the end of the container: insert the remaining items in newRowsMap
-    if (curIt == m_proxyToSourceMap.end() && newIt != newRowsMap.end())
-    {
-        const auto insertStartPos = static_cast<int>(curIt - m_proxyToSourceMap.begin());
-        const auto insertLength = static_cast<int>(newRowsMap.end() - newIt);
-        beginInsertRows({}, insertStartPos, insertStartPos + insertLength - 1);
-        m_proxyToSourceMap.insert(m_proxyToSourceMap.end(), newIt, newRowsMap.end());
-        endInsertRows();
-    }
+    // the new rows get handles of their own, so the rows behind them keep theirs, and neither the
+    //   proxy order nor the keys, the heap or the child mappings of the other rows change
+    const std::vector<int> handles = mapping->allocateHandles(count);
+    mapping->sourceOrder->insert(firstNewRow, handles.cbegin(), handles.cend());
+    mapping->sortKeys->insertRows(firstNewRow, handles);
 
-    buildReverseMap(m_proxyToSourceMap, m_sourceToProxyMap);
+    // now merge the new rows that pass the filter into the mapping we already have
+    showSourceRows(*mapping, acceptedRows(*mapping, firstNewRow, handles));
 }
 
 void SortProxyModel::handleRowsRemoved(const QModelIndex &parent, int firstRemovedRow, int lastRemovedRow)
 {
-    if (parent.isValid())
+    // nothing to do if the rows below the parent have not been queried yet. If they were queried
+    //   since the removal, the removed rows are already gone.
+    Mapping *mapping = mappingForSource(parent, false);
+    const int count = lastRemovedRow - firstRemovedRow + 1;
+    if (!mapping || mapping->sourceOrder->size() - count != sourceModel()->rowCount(parent))
         return;
+    RowSequence &proxyOrder = *mapping->proxyOrder;
 
-    // reverse mapping is now invalid
-    m_sourceToProxyMap.clear();
-
-    // update the row indices in the mapping pointing to rows that shifted forwards and build
-    //   up list of rows to remove
-    const int shift = lastRemovedRow - firstRemovedRow + 1;
+    // build up list of rows to remove
+    const std::vector<int> handles = mapping->sourceOrder->handles(firstRemovedRow, lastRemovedRow);
     std::vector<int> removedRows;
-    removedRows.reserve(static_cast<ulong>(shift));
-    int row = 0;
-    for (auto &oldPos : m_proxyToSourceMap)
+    for (int handle : handles)
     {
-        if (oldPos > lastRemovedRow)
-        {
-            oldPos -= shift;
-        }
-        else if (oldPos >= firstRemovedRow)
+        // rows that are filtered out are not part of the proxy
+        if (proxyOrder.contains(handle))
+            removedRows.push_back(proxyOrder.positionOf(handle));
+    }
+    std::sort(removedRows.begin(), removedRows.end());
+
+    const bool rowLimited = isRowLimited(*mapping);
+    if (rowLimited)
+    {
+        // rows beyond the row limit are only taken out of the heap
+        for (int handle : handles)
         {
-            removedRows.push_back(row);
+            if (m_rowsBeyondLimit->contains(handle))
+                m_rowsBeyondLimit->remove(handle);
         }
-        ++row;
     }
 
-    std::sort(removedRows.begin(), removedRows.end());
+    mapping->sourceOrder->remove(firstRemovedRow, lastRemovedRow);
+    mapping->sortKeys->removeRows(handles);
+    if (m_sortPending && mapping == &m_rootMapping)
+        scheduleSort(); // the pending result still contains the removed rows
 
-    m_invalidatedRows = make_pair(removedRows.begin(), removedRows.end());
+    // the child mappings of removed rows are kept until their parents are gone from the proxy as well
+    std::vector<std::unique_ptr<Mapping>> removedChildren;
+    for (int handle : handles)
+    {
+        const auto child = mapping->children.find(handle);
+        if (child == mapping->children.end())
+            continue;
+        removedChildren.push_back(std::move(child->second));
+        mapping->children.erase(child);
+    }
 
     // iterates backwards through the list of rows to remove so the indices in removedRows stay
-    //   correct during the iteration
-    auto it = predecessor(removedRows.end());
-    for (;;)
+    //   correct during the iteration. Until their step, the removed rows are still shown, but are no
+    //   longer part of the source order.
+    mapping->rowsPendingRemoval = static_cast<int>(removedRows.size());
+    const QModelIndex proxyParent = proxyParentOf(*mapping);
+    auto it = removedRows.end();
+    while (it != removedRows.begin())
     {
+        --it;
         auto lastRowToRemove = *it;
         // see if we have consecutive rows we can remove in one go
         while (it != removedRows.begin() && *predecessor(it) == *it - 1)
             --it;
         auto firstRowToRemove = *it;
-        beginRemoveRows({}, firstRowToRemove, lastRowToRemove);
-        m_proxyToSourceMap.erase(m_proxyToSourceMap.begin() + firstRowToRemove,
-                                 m_proxyToSourceMap.begin() + lastRowToRemove + 1);
-        m_invalidatedRows.second = it;
+        beginRemoveRows(proxyParent, firstRowToRemove, lastRowToRemove);
+        proxyOrder.remove(firstRowToRemove, lastRowToRemove);
+        mapping->rowsPendingRemoval -= lastRowToRemove - firstRowToRemove + 1;
         endRemoveRows();
-
-        if (it == removedRows.begin())
-            break;
-        --it;
     }
 
-    m_invalidatedRows = make_pair(m_proxyToSourceMap.end(), m_proxyToSourceMap.end());
-
-    buildReverseMap(m_proxyToSourceMap, m_sourceToProxyMap);
+    // the handles can be reused once the rows are gone from the proxy as well
+    mapping->releaseHandles(handles);
+    if (rowLimited)
+        applyRowLimit();
 }
 
 /**
  * @brief SortProxyModel::isInvalidedRow
  * @param row
- * @returns true if the indicated row has already been removed from the source model
+ * @returns true if the indicated row of @p mapping has already been removed from the source model
  *
  * During a remove operation, we cannot always send a single rowsRemoved signal. That means
  * we will be signalling to the outside world during while the source model has already
  * removed some rows that we still have in the model. However, we cannot access these rows
  * any more, as the indexes either point to rows outside the range of the model or point to
  * rows that have shifted into the position that the row was in.) If such a row is accessed
- * via the proxy, we will return an invalid QVariant.
+ * via the proxy, we will return an invalid QVariant. The same holds for all rows below a
+ * parent that has been removed.
  */
-bool SortProxyModel::isInvalidedRow(const int row) const
+bool SortProxyModel::isInvalidedRow(const Mapping &mapping, const int row) const
 {
-    // m_invalidatedRows only contains a valid range during a remove operation that involves multiple rows
-    return std::any_of(m_invalidatedRows.first, m_invalidatedRows.second,
-                       [row](int invalidated) { return invalidated == row; });
+    if (mapping.parent && !mapping.sourceParent.isValid())
+        return true;
+
+    // only while a remove operation is signalled, the proxy has rows that are gone from the source order
+    return mapping.rowsPendingRemoval > 0 && !mapping.sourceOrder->contains(mapping.proxyOrder->at(row));
 }
@@ -11,6 +11,11 @@
 #define SORTPROXYMODEL_H
 
 #include <QAbstractProxyModel>
+#include <QCollator>
+
+#include <functional>
+#include <map>
+#include <memory>
 
 class SortProxyModelTest;
 
@@ -19,9 +24,9 @@ class SortProxyModelTest;
  *
  * The default QSortFilterProxyModel does not properly emit detailed signals
  * for what happens during sorting, making it hard to visually show this and
- * to keep selections stable. This proxy model provides sorting for list or
- * table type models that does provide move signals to signal what happens
- * during a sort.
+ * to keep selections stable. This proxy model provides sorting for list,
+ * table and tree type models that does provide move signals to signal what
+ * happens during a sort.
  *
  * The API is similar to that of QSortFilterProxyModel for the sorting parts
  * of the API, so if you used QSortFilterProxyModel only for sorting it
@@ -33,7 +38,50 @@ class SortProxyModel : public QAbstractProxyModel
     Q_PROPERTY(int sortRole READ sortRole WRITE setSortRole NOTIFY sortRoleChanged)
 
 public:
+    /**
+     * Determines which signals are emitted when the sort order of existing rows changes.
+     *
+     * Row move signals allow views to animate the reordering, but every view and every
+     * persistent index pays a price per move. For large reorders, a single layout change is
+     * much cheaper.
+     */
+    enum ReorderSignalPolicy
+    {
+        AlwaysEmitRowMoves, ///< always emit row move signals (default)
+        EmitLayoutChangeAboveThreshold, ///< emit a layout change if too many rows need to move
+        AlwaysEmitLayoutChange ///< always emit a layout change
+    };
+    Q_ENUM(ReorderSignalPolicy)
+
+    /**
+     * A single sort key: rows are compared on the data of @a role in @a column, in @a order.
+     * String data is compared using @a caseSensitivity, and using the sort collator if
+     * @a localeAware is set.
+     */
+    struct SortCriterion
+    {
+        int column = 0;
+        int role = Qt::DisplayRole;
+        Qt::SortOrder order = Qt::AscendingOrder;
+        Qt::CaseSensitivity caseSensitivity = Qt::CaseSensitive;
+        bool localeAware = false;
+
+        friend bool operator==(const SortCriterion &lhs, const SortCriterion &rhs)
+        {
+            return lhs.column == rhs.column && lhs.role == rhs.role && lhs.order == rhs.order
+                && lhs.caseSensitivity == rhs.caseSensitivity && lhs.localeAware == rhs.localeAware;
+        }
+        friend bool operator!=(const SortCriterion &lhs, const SortCriterion &rhs) { return !(lhs == rhs); }
+    };
+
+    /**
+     * Decides whether the source row with the given row and parent is shown. Same signature as
+     * KDFunctionalSortFilterProxyModel::AcceptsFunction.
+     */
+    using AcceptsFunction = std::function<bool(const QAbstractItemModel *, int, const QModelIndex &)>;
+
     explicit SortProxyModel(QObject *parent = nullptr);
+    ~SortProxyModel() override;
 
     // QAbstractItemModel interface
 public:
@@ -56,44 +104,173 @@ public:
     int sortRole() const;
     void setSortCaseSensitivity(Qt::CaseSensitivity sensitivity);
     Qt::CaseSensitivity sortCaseSensitivity() const;
+    void setSortLocaleAware(bool on);
+    bool isSortLocaleAware() const;
     int sortColumn() const;
     Qt::SortOrder sortOrder() const;
 
+    void setSortCriteria(const QVector<SortCriterion> &criteria);
+    QVector<SortCriterion> sortCriteria() const;
+    void setSortCollator(const QCollator &collator);
+    QCollator sortCollator() const;
+
+    void setReorderSignalPolicy(ReorderSignalPolicy policy);
+    ReorderSignalPolicy reorderSignalPolicy() const;
+    void setLayoutChangeMoveThreshold(int movedRows);
+    int layoutChangeMoveThreshold() const;
+    void setLayoutChangeRowFraction(qreal movedRowFraction);
+    qreal layoutChangeRowFraction() const;
+
+    void setAsynchronousSorting(bool enabled);
+    bool asynchronousSorting() const;
+    bool isSortPending() const;
+
+    void setParallelSorting(bool enabled);
+    bool parallelSorting() const;
+    void setParallelSortThreshold(int rowCount);
+    int parallelSortThreshold() const;
+
+    void setRowLimit(int limit);
+    int rowLimit() const;
+
+    void setFilterAcceptsRowFunction(AcceptsFunction function);
+    void clearFilterAcceptsRowFunction();
+
+public Q_SLOTS:
+    void invalidateFilter();
+
 Q_SIGNALS:
     void sortRoleChanged();
     void sortCaseSensitivityChanged();
+    void sortLocaleAwareChanged();
     void sortColumnChanged();
     void sortOrderChanged();
+    void sortPendingChanged();
 
 protected:
+    /**
+     * @deprecated Sorting compares the cached sort keys of the rows, and does not call this function.
+     * Defining lessThan() in a subclass therefore does not change the sort order. Use
+     * setSortCriteria() and setSortCollator() to customize the order instead.
+     *
+     * @returns whether the sort role data of @p source_left is less than that of @p source_right,
+     * compared like the primary sort criterion does, in ascending order.
+     */
+    QT_DEPRECATED_X("lessThan() is not used for sorting, use setSortCriteria() instead")
     bool lessThan(const QModelIndex &source_left, const QModelIndex &source_right) const;
 
 protected Q_SLOTS:
     void resetInternalData();
 
 private:
+    class RowSequence;
+    class SortKeyCache;
+    class RowHeap;
+    struct AsynchronousSortState;
+
+    /**
+     * The mapping of the rows below a single parent, sorted on their own. Only the mapping of the
+     * top level rows exists up front; those of child rows are created when they are first queried.
+     *
+     * Every source row has a handle, which stays the same while other rows are inserted, removed or
+     * moved. The sort keys, the heap of rows beyond the row limit and the child mappings refer to rows
+     * by their handle, so nothing needs to be renumbered when rows shift.
+     */
+    struct Mapping
+    {
+        Mapping();
+        ~Mapping();
+
+        void resetRows(int rowCount);
+        std::vector<int> allocateHandles(int count);
+        void releaseHandles(const std::vector<int> &handles);
+        bool hasRowTable() const;
+
+        Mapping *parent = nullptr;
+        int handle = -1; // the handle of the parent in the parent mapping
+        int rowsPendingRemoval = 0; // proxy rows whose source rows are gone, while a removal is signalled
+        QPersistentModelIndex sourceParent;
+        std::unique_ptr<RowSequence> sourceOrder; // the handles of all source rows, in source order
+        std::unique_ptr<RowSequence> proxyOrder; // the handles of the rows shown, in proxy order
+        std::vector<int> freeHandles;
+        int handleCount = 0;
+        std::unique_ptr<SortKeyCache> sortKeys;
+        std::map<int, std::unique_ptr<Mapping>> children; // by handle of the parent
+
+        // flat copies of the orders, so mapToSource(), data() and mapFromSource() look rows up in O(1)
+        // steps. They are rebuilt lazily after the orders changed, see hasRowTable()
+        mutable std::vector<int> proxyToSourceRows;
+        mutable std::vector<int> sourceToProxyRows; // -1 for rows that are not shown
+        mutable quint64 rowTableSourceGeneration = 0;
+        mutable quint64 rowTableProxyGeneration = 0;
+        mutable qint64 lookupsWithoutRowTable = 0;
+    };
+
     void rebuildRowMap();
-    void reorder();
-    void sortMappingContainer(std::vector<int> &container);
-    bool lessThan(int source_left_row, int source_right_row) const;
-    int mapToProxyRow(int sourceRow) const;
+    void rebuildSortKeys();
+    void updateSortCriteria(Mapping &mapping, const QVector<SortCriterion> &criteria);
+    void reorder(Mapping &mapping);
+    void reorderWithRowLimit();
+    void setRowsToOrder(Mapping &mapping, const std::vector<int> &newOrder);
+    void applyRowLimit();
+    bool isRowLimited(const Mapping &mapping) const;
+    void refilter(Mapping &mapping);
+    void showSourceRows(Mapping &mapping, std::vector<int> handles);
+    void hideSourceRows(Mapping &mapping, const std::vector<int> &handles);
+    void removeProxyRows(Mapping &mapping, const std::vector<int> &proxyRows);
+    bool filterAcceptsRow(const Mapping &mapping, int sourceRow) const;
+    bool isAcceptedRow(const Mapping &mapping, int handle) const;
+    std::vector<int> acceptedRows(const Mapping &mapping, int firstRow, const std::vector<int> &handles) const;
+    void moveRowsToOrder(Mapping &mapping, const std::vector<int> &newOrder);
+    void moveRowsToOrder(Mapping &mapping, const std::vector<int> &newOrder, const std::vector<bool> &staysInPlace,
+                         int movedRows);
+    void reorderChangedRows(Mapping &mapping, const std::vector<int> &changedHandles);
+    void moveProxyRows(Mapping &mapping, int firstRow, int lastRow, int destinationRow);
+    bool useLayoutChange(int movedRows, int rowCount) const;
+    void changeLayoutToOrder(Mapping &mapping, const std::vector<int> &newOrder);
+    void scheduleSort();
+    void startAsynchronousSort();
+    void applyAsynchronousSort(int generation, const std::vector<int> &newOrder);
+    void setSortPending(bool pending);
+    void sortMappingContainer(const Mapping &mapping, std::vector<int> &container) const;
+    int mapToProxyRow(const Mapping &mapping, int sourceRow) const;
+
+    Mapping *mappingOf(const QModelIndex &proxyIndex) const;
+    Mapping *mappingFor(const QModelIndex &proxyParent) const;
+    Mapping *mappingForSource(const QModelIndex &sourceParent, bool create) const;
+    Mapping *createChildMapping(Mapping &parent, int handle) const;
+    QModelIndex proxyParentOf(const Mapping &mapping) const;
 
     // source model change handlers
     void handleDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QVector<int> &roles);
     void handleRowsInserted(const QModelIndex &parent, int firstNewRow, int lastNewRow);
     void handleRowsRemoved(const QModelIndex &parent, int firstRemovedRow, int lastRemovedRow);
 
-    bool isInvalidedRow(const int row) const;
+    bool isInvalidedRow(const Mapping &mapping, const int row) const;
 
 private:
     int m_sortColumn = -1;
     Qt::SortOrder m_order = Qt::AscendingOrder;
     int m_sortRole = Qt::DisplayRole;
     Qt::CaseSensitivity m_caseSensitivity = Qt::CaseSensitive;
+    bool m_sortLocaleAware = false;
+    QCollator m_sortCollator;
+    QVector<SortCriterion> m_additionalSortCriteria; // criteria after the primary one above
+    ReorderSignalPolicy m_reorderSignalPolicy = AlwaysEmitRowMoves;
+    int m_layoutChangeMoveThreshold = 1000;
+    qreal m_layoutChangeRowFraction = 1.0;
+    bool m_asynchronousSorting = false;
+    bool m_sortPending = false;
+    bool m_sortStartQueued = false;
+    int m_sortGeneration = 0;
+    bool m_parallelSorting = false;
+    int m_parallelSortThreshold = 50000;
+    int m_rowLimit = -1;
+    AcceptsFunction m_filterAcceptsRowFunction;
 
-    std::vector<int> m_proxyToSourceMap;
-    std::vector<int> m_sourceToProxyMap;
-    std::pair<std::vector<int>::iterator, std::vector<int>::iterator> m_invalidatedRows;
+    Mapping m_rootMapping;
+    std::unique_ptr<RowHeap> m_rowsBeyondLimit; // the top level rows that are not shown because of the row limit
+    std::shared_ptr<AsynchronousSortState> m_asynchronousSortState;
 
     friend class SortProxyModelTest;
 };
@@ -0,0 +1,403 @@
+/*
+  This file is part of KDToolBox.
+
+  SPDX-FileCopyrightText: 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+
+  SPDX-License-Identifier: MIT
+*/
+
+#include "../sortproxymodel.h"
+#include "vectormodel.h"
+#include <QCoreApplication>
+#include <QScopeGuard>
+#include <QTest>
+#include <QThread>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <random>
+
+/**
+ * VectorModel with a second column, so the benchmarks can change the sort column. The value in
+ * the second column is derived from the one in the first, in an unrelated order.
+ */
+class TwoColumnVectorModel : public VectorModel<int>
+{
+public:
+    using VectorModel<int>::VectorModel;
+
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override { return parent.isValid() ? 0 : 2; }
+
+    QVariant data(const QModelIndex &index, int role) const override
+    {
+        if (index.column() == 1 && role == Qt::DisplayRole)
+            return static_cast<int>(contents[index.row()] * 7919LL % 1000003);
+
+        return VectorModel<int>::data(index, role);
+    }
+};
+
+/**
+ * Counts the signals emitted by a proxy, so the benchmarks can report them next to the wall time.
+ * A change that makes the proxy emit more signals is as much of a regression as a slower one,
+ * as every attached view and persistent index has to process each of them.
+ */
+class SignalCounter : public QObject
+{
+public:
+    explicit SignalCounter(QAbstractItemModel *model)
+    {
+        connect(model, &QAbstractItemModel::modelReset, this, [this]() { ++resets; });
+        connect(model, &QAbstractItemModel::layoutChanged, this, [this]() { ++layoutChanges; });
+        connect(model, &QAbstractItemModel::rowsMoved, this, [this]() { ++moves; });
+        connect(model, &QAbstractItemModel::rowsInserted, this, [this]() { ++inserts; });
+        connect(model, &QAbstractItemModel::rowsRemoved, this, [this]() { ++removals; });
+        connect(model, &QAbstractItemModel::dataChanged, this, [this]() { ++dataChanges; });
+    }
+
+    void report(int operations) const
+    {
+        const double count = std::max(operations, 1);
+        qInfo("%s: per operation %.1f resets, %.1f layout changes, %.1f row moves, %.1f inserts, %.1f removals, "
+              "%.1f data changes",
+              QTest::currentDataTag(), resets / count, layoutChanges / count, moves / count, inserts / count,
+              removals / count, dataChanges / count);
+    }
+
+    int resets = 0;
+    int layoutChanges = 0;
+    int moves = 0;
+    int inserts = 0;
+    int removals = 0;
+    int dataChanges = 0;
+};
+
+class SortProxyModelBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    using QObject::QObject;
+
+private Q_SLOTS:
+    void initialSort_data();
+    void initialSort();
+    void resortOnColumnChange_data();
+    void resortOnColumnChange();
+    void bulkInsertAndRemove_data();
+    void bulkInsertAndRemove();
+    void singleRowChange_data();
+    void singleRowChange();
+    void mapFromSourceUnderChurn_data();
+    void mapFromSourceUnderChurn();
+    void readRows_data();
+    void readRows();
+    void parallelSort_data();
+    void parallelSort();
+    void removeScatteredRows_data();
+    void removeScatteredRows();
+};
+
+static void addRowCounts(std::initializer_list<int> rowCounts = {10000, 100000, 1000000})
+{
+    QTest::addColumn<int>("rowCount");
+
+    for (int rowCount : rowCounts)
+        QTest::addRow("%d rows", rowCount) << rowCount;
+}
+
+static std::vector<int> randomValues(int count, int maximum, unsigned seed = 42)
+{
+    std::mt19937 generator(seed);
+    std::uniform_int_distribution<int> distribution(0, maximum);
+    std::vector<int> values(static_cast<std::size_t>(count));
+    for (auto &value : values)
+        value = distribution(generator);
+    return values;
+}
+
+/**
+ * Sorts @p sourceModel through @p sorted. Reorders that move more rows than the threshold are
+ * signalled as a single layout change, as moving nearly every row one by one would be quadratic.
+ */
+static void sortOnFirstColumn(SortProxyModel &sorted, QAbstractItemModel &sourceModel)
+{
+    sorted.setReorderSignalPolicy(SortProxyModel::EmitLayoutChangeAboveThreshold);
+    sorted.setSourceModel(&sourceModel);
+    sorted.sort(0);
+}
+
+void SortProxyModelBenchmark::initialSort_data()
+{
+    addRowCounts();
+}
+
+void SortProxyModelBenchmark::initialSort()
+{
+    QFETCH(int, rowCount);
+
+    VectorModel<int> sourceModel(randomValues(rowCount, rowCount / 4));
+    SortProxyModel sorted;
+    sortOnFirstColumn(sorted, sourceModel);
+    SignalCounter counter(&sorted);
+    int operations = 0;
+    QBENCHMARK
+    {
+        sorted.setSourceModel(nullptr);
+        sorted.setSourceModel(&sourceModel);
+        ++operations;
+    }
+    counter.report(operations);
+
+    // the initial sort is part of the reset
+    QCOMPARE(counter.resets, 2 * operations);
+    QCOMPARE(counter.moves, 0);
+    QCOMPARE(counter.layoutChanges, 0);
+}
+
+void SortProxyModelBenchmark::resortOnColumnChange_data()
+{
+    addRowCounts();
+}
+
+void SortProxyModelBenchmark::resortOnColumnChange()
+{
+    QFETCH(int, rowCount);
+
+    TwoColumnVectorModel sourceModel(randomValues(rowCount, rowCount / 4));
+    SortProxyModel sorted;
+    sortOnFirstColumn(sorted, sourceModel);
+    SignalCounter counter(&sorted);
+    int column = 0;
+    int operations = 0;
+    QBENCHMARK
+    {
+        column = 1 - column;
+        sorted.sort(column);
+        ++operations;
+    }
+    counter.report(operations);
+
+    QCOMPARE(counter.layoutChanges, operations);
+    QCOMPARE(counter.moves, 0);
+}
+
+void SortProxyModelBenchmark::bulkInsertAndRemove_data()
+{
+    addRowCounts();
+}
+
+void SortProxyModelBenchmark::bulkInsertAndRemove()
+{
+    QFETCH(int, rowCount);
+
+    // a block of new rows in the middle of the source, scattered all over the proxy
+    constexpr int blockSize = 1000;
+    const int firstRow = rowCount / 2;
+    const std::vector<int> block = randomValues(blockSize, rowCount / 4, 7);
+
+    VectorModel<int> sourceModel(randomValues(rowCount, rowCount / 4));
+    SortProxyModel sorted;
+    sortOnFirstColumn(sorted, sourceModel);
+    SignalCounter counter(&sorted);
+    int operations = 0;
+    QBENCHMARK
+    {
+        sourceModel.insert(firstRow, block);
+        sourceModel.removeRows(firstRow, blockSize);
+        ++operations;
+    }
+    counter.report(operations);
+
+    QCOMPARE(sorted.rowCount(), rowCount);
+    QVERIFY(counter.inserts <= blockSize * operations);
+    QVERIFY(counter.removals <= blockSize * operations);
+    QCOMPARE(counter.moves, 0);
+}
+
+void SortProxyModelBenchmark::singleRowChange_data()
+{
+    addRowCounts();
+}
+
+void SortProxyModelBenchmark::singleRowChange()
+{
+    QFETCH(int, rowCount);
+
+    VectorModel<int> sourceModel(randomValues(rowCount, rowCount / 4));
+    SortProxyModel sorted;
+    sortOnFirstColumn(sorted, sourceModel);
+    std::mt19937 generator(7);
+    std::uniform_int_distribution<int> rowDistribution(0, rowCount - 1);
+    std::uniform_int_distribution<int> valueDistribution(0, rowCount / 4);
+    SignalCounter counter(&sorted);
+    int operations = 0;
+    QBENCHMARK
+    {
+        sourceModel.setValue(rowDistribution(generator), valueDistribution(generator));
+        ++operations;
+    }
+    counter.report(operations);
+
+    // at most a single move and the change itself
+    QVERIFY(counter.moves <= operations);
+    QVERIFY(counter.dataChanges <= operations);
+    QCOMPARE(counter.layoutChanges, 0);
+}
+
+void SortProxyModelBenchmark::mapFromSourceUnderChurn_data()
+{
+    addRowCounts();
+}
+
+void SortProxyModelBenchmark::mapFromSourceUnderChurn()
+{
+    QFETCH(int, rowCount);
+
+    VectorModel<int> sourceModel(randomValues(rowCount, rowCount / 4));
+    SortProxyModel sorted;
+    sortOnFirstColumn(sorted, sourceModel);
+    std::mt19937 generator(7);
+    std::uniform_int_distribution<int> rowDistribution(0, rowCount - 1);
+    std::uniform_int_distribution<int> valueDistribution(0, rowCount / 4);
+    SignalCounter counter(&sorted);
+    int operations = 0;
+    qint64 proxyRowTotal = 0;
+    QBENCHMARK
+    {
+        // a view tracking a selection maps its source rows again after every change
+        const int changedRow = rowDistribution(generator);
+        sourceModel.insert(changedRow, valueDistribution(generator));
+        for (int row = 0; row < 1000; ++row)
+            proxyRowTotal += sorted.mapFromSource(sourceModel.index((changedRow + row * 97) % rowCount)).row();
+        sourceModel.removeRows(changedRow, 1);
+        ++operations;
+    }
+    counter.report(operations);
+
+    QVERIFY(proxyRowTotal > 0);
+    QCOMPARE(counter.inserts, operations);
+    QCOMPARE(counter.removals, operations);
+}
+
+void SortProxyModelBenchmark::readRows_data()
+{
+    addRowCounts();
+}
+
+void SortProxyModelBenchmark::readRows()
+{
+    QFETCH(int, rowCount);
+
+    VectorModel<int> sourceModel(randomValues(rowCount, rowCount / 4));
+    SortProxyModel sorted;
+    sortOnFirstColumn(sorted, sourceModel);
+    std::mt19937 generator(7);
+    std::uniform_int_distribution<int> rowDistribution(0, rowCount - 1000);
+    qint64 valueTotal = 0;
+    QBENCHMARK
+    {
+        // a view painting 1000 rows, each of which maps its index to the source
+        const int firstRow = rowDistribution(generator);
+        for (int row = firstRow; row < firstRow + 1000; ++row)
+        {
+            const QModelIndex index = sorted.index(row, 0);
+            valueTotal += sorted.data(index, Qt::DisplayRole).toInt() + sorted.mapToSource(index).row();
+        }
+    }
+
+    QVERIFY(valueTotal > 0);
+}
+
+void SortProxyModelBenchmark::parallelSort_data()
+{
+    QTest::addColumn<int>("rowCount");
+    QTest::addColumn<int>("threadCount");
+
+    const int idealThreadCount = QThread::idealThreadCount();
+    for (int rowCount : {100000, 1000000})
+    {
+        for (int threadCount = 1; threadCount < idealThreadCount; threadCount *= 2)
+            QTest::addRow("%d rows, %d threads", rowCount, threadCount) << rowCount << threadCount;
+        QTest::addRow("%d rows, %d threads", rowCount, idealThreadCount) << rowCount << idealThreadCount;
+    }
+}
+
+void SortProxyModelBenchmark::parallelSort()
+{
+    QFETCH(int, rowCount);
+    QFETCH(int, threadCount);
+
+    const int maxThreadCount = QThreadPool::globalInstance()->maxThreadCount();
+    QThreadPool::globalInstance()->setMaxThreadCount(threadCount);
+    const auto restoreThreadCount =
+        qScopeGuard([maxThreadCount]() { QThreadPool::globalInstance()->setMaxThreadCount(maxThreadCount); });
+
+    VectorModel<int> sourceModel(randomValues(rowCount, rowCount / 4));
+    SortProxyModel sorted;
+    sorted.setParallelSorting(threadCount > 1);
+    sortOnFirstColumn(sorted, sourceModel);
+    // measure the sort itself rather than the row moves of a reversal
+    sorted.setReorderSignalPolicy(SortProxyModel::AlwaysEmitLayoutChange);
+    SignalCounter counter(&sorted);
+    Qt::SortOrder order = Qt::AscendingOrder;
+    int operations = 0;
+    QBENCHMARK
+    {
+        order = order == Qt::AscendingOrder ? Qt::DescendingOrder : Qt::AscendingOrder;
+        sorted.sort(0, order);
+        ++operations;
+    }
+    counter.report(operations);
+
+    QCOMPARE(counter.layoutChanges, operations);
+    QCOMPARE(counter.moves, 0);
+}
+
+void SortProxyModelBenchmark::removeScatteredRows_data()
+{
+    // every removed row takes a step of its own, which costs O(log n) each
+    addRowCounts();
+}
+
+void SortProxyModelBenchmark::removeScatteredRows()
+{
+    QFETCH(int, rowCount);
+
+    // the first half of the source rows sorts to every other proxy row, so removing it takes one
+    //   removal step per row
+    std::vector<int> values(static_cast<std::size_t>(rowCount));
+    for (int row = 0; row < rowCount / 2; ++row)
+    {
+        values[row] = 2 * row;
+        values[row + rowCount / 2] = 2 * row + 1;
+    }
+
+    VectorModel<int> sourceModel(values);
+    SortProxyModel sorted;
+    sortOnFirstColumn(sorted, sourceModel);
+    SignalCounter counter(&sorted);
+
+    // a view repaints its visible rows after every step
+    int visibleRowsTotal = 0;
+    connect(&sorted, &SortProxyModel::rowsRemoved, this, [&sorted, &visibleRowsTotal]() {
+        for (int row = 0; row < 50; ++row)
+            visibleRowsTotal += sorted.index(row, 0).data().toInt();
+    });
+
+    QBENCHMARK_ONCE
+    {
+        sourceModel.removeRows(0, rowCount / 2);
+    }
+    counter.report(1);
+
+    QCOMPARE(sorted.rowCount(), rowCount / 2);
+    QCOMPARE(sorted.index(0, 0).data().toInt(), 1);
+    QCOMPARE(counter.removals, rowCount / 2);
+    QCOMPARE(counter.moves, 0);
+    QVERIFY(visibleRowsTotal > 0);
+}
+
+QTEST_MAIN(SortProxyModelBenchmark)
+
+#include "tst_sortproxymodelbenchmark.moc"
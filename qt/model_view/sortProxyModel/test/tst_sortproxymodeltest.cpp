@@ -10,11 +10,16 @@
 #include "../sortproxymodel.h"
 #include "vectormodel.h"
 #include <QCoreApplication>
+#include <QDateTime>
 #include <QSignalSpy>
 #include <QStandardItemModel>
 #include <QString>
 #include <QStringBuilder>
 #include <QTest>
+#include <QThreadPool>
+
+#include <numeric>
+#include <random>
 
 enum RowMovedArguments
 {
@@ -32,6 +37,13 @@ enum RowsInsertedArguments
     InsertToIndex = 2
 };
 
+enum RowsRemovedArguments
+{
+    RemovedParent = 0,
+    RemovedFromIndex = 1,
+    RemovedToIndex = 2
+};
+
 enum DataChangedArguments
 {
     TopLeftIndex = 0,
@@ -62,22 +74,35 @@ private Q_SLOTS:
     void insertMultipleContiniousValues();
     void insertMultipleDiscontiniousValues();
     void insertAtEndOfRange();
+    void persistentIndexAfterShift();
+    void mapFromSourceDuringUpdates();
+    void changeFewValuesOfMany();
     void removeSingleValue();
     void removeMultipleContiniousValues();
     void removeMultipleDiscontiniousValues();
+    void removeScatteredRows();
 
     void strings();
+    void localeAwareStrings();
     void doubles();
+    void dateTimes();
+    void mixedTypes();
     void sortOnRolesAndColumns();
+    void multipleSortCriteria();
+    void treeModel();
+    void layoutChangeAboveThreshold();
+    void asynchronousSorting();
+    void parallelSorting();
+    void rowLimit();
+    void filter();
 };
 
 bool SortProxyModelTest::verifyInternalMapping(SortProxyModel *model)
 {
-    for (unsigned long i = 0; i < model->m_proxyToSourceMap.size(); ++i)
+    for (int i = 0; i < model->rowCount(); ++i)
     {
-        unsigned long sourceRow = model->m_proxyToSourceMap[i];
-        unsigned long proxyRow = model->m_sourceToProxyMap[sourceRow];
-        if (proxyRow != i)
+        const QModelIndex sourceIndex = model->mapToSource(model->index(i, 0));
+        if (!sourceIndex.isValid() || model->mapFromSource(sourceIndex).row() != i)
         {
             return false;
         }
@@ -85,6 +110,15 @@ bool SortProxyModelTest::verifyInternalMapping(SortProxyModel *model)
     return true;
 }
 
+// the source rows of the top level proxy rows, in proxy order
+static std::vector<int> sourceRows(const SortProxyModel &model)
+{
+    std::vector<int> rows;
+    for (int row = 0; row < model.rowCount(); ++row)
+        rows.push_back(model.mapToSource(model.index(row, 0)).row());
+    return rows;
+}
+
 template<int line, typename value_type>
 void checkModelContents(const QAbstractItemModel &model, std::initializer_list<value_type> values)
 {
@@ -239,11 +273,11 @@ void SortProxyModelTest::changeSingleValueLeft()
 
     // check sorted model
     CHECKMODELCONTENTS(int)(sorted, {-2, 1, 2, 3, 5});
-    // signal emission
+    // signal emission: only the changed row moves
     QCOMPARE(spy.count(), 1);
-    QCOMPARE(spy.at(0)[SourceFromIndex], 0);
-    QCOMPARE(spy.at(0)[SourceToIndex], 2);
-    QCOMPARE(spy.at(0)[ToIndex], 4);
+    QCOMPARE(spy.at(0)[SourceFromIndex], 3);
+    QCOMPARE(spy.at(0)[SourceToIndex], 3);
+    QCOMPARE(spy.at(0)[ToIndex], 0);
     QCOMPARE(changedSpy.count(), 1);
     QCOMPARE(changedSpy.at(0)[TopLeftIndex].value<QModelIndex>().row(), 3);
     QVERIFY(verifyInternalMapping(&sorted));
@@ -437,6 +471,104 @@ void SortProxyModelTest::insertAtEndOfRange()
     QCOMPARE(insertedSpy.at(0)[InsertToIndex], 5);
 }
 
+void SortProxyModelTest::mapFromSourceDuringUpdates()
+{
+    VectorModel<int> sourceModel{3, 9, 1, 2, 4};
+    SortProxyModel sorted;
+    sorted.setSourceModel(&sourceModel);
+    sorted.sort(0);
+
+    // between the steps of an insert or a removal, every source row either maps to the proxy row
+    //   showing it, or is not (or no longer) part of the proxy
+    int steps = 0;
+    int unmappedRows = 0;
+    const auto checkMapping = [&]() {
+        ++steps;
+        for (int sourceRow = 0; sourceRow < sourceModel.rowCount(); ++sourceRow)
+        {
+            const QModelIndex sourceIndex = sourceModel.index(sourceRow);
+            const QModelIndex proxyIndex = sorted.mapFromSource(sourceIndex);
+            if (!proxyIndex.isValid())
+            {
+                ++unmappedRows;
+                continue;
+            }
+            QCOMPARE(sorted.mapToSource(proxyIndex), sourceIndex);
+            QCOMPARE(proxyIndex.data(), sourceIndex.data());
+        }
+    };
+    connect(&sorted, &SortProxyModel::rowsInserted, this, checkMapping);
+    connect(&sorted, &SortProxyModel::rowsRemoved, this, checkMapping);
+
+    sourceModel.append({8, 3, -2});
+    CHECKMODELCONTENTS(int)(sorted, {-2, 1, 2, 3, 3, 4, 8, 9});
+    QCOMPARE(steps, 3);
+    QCOMPARE(unmappedRows, 2 + 1); // rows not yet inserted after the first and second step
+
+    steps = 0;
+    unmappedRows = 0;
+    sourceModel.removeRows(0, 2); // 3 and 9
+    CHECKMODELCONTENTS(int)(sorted, {-2, 1, 2, 3, 4, 8});
+    QCOMPARE(steps, 2);
+    QCOMPARE(unmappedRows, 0);
+    QVERIFY(verifyInternalMapping(&sorted));
+}
+
+void SortProxyModelTest::changeFewValuesOfMany()
+{
+    std::vector<int> values(1000);
+    std::iota(values.begin(), values.end(), 0);
+    VectorModel<int> sourceModel(values);
+    SortProxyModel sorted;
+    sorted.setSourceModel(&sourceModel);
+    sorted.sort(0);
+    QSignalSpy spy(&sorted, &SortProxyModel::rowsMoved);
+
+    // changes that keep rows between their neighbours do not move anything
+    sourceModel.contents[10] = 11;
+    sourceModel.contents[11] = 12;
+    Q_EMIT sourceModel.dataChanged(sourceModel.index(10), sourceModel.index(11));
+    QCOMPARE(spy.count(), 0);
+
+    // a wide change range only moves the rows that need to go elsewhere, one move each
+    const QPersistentModelIndex persistentIndex = sorted.index(500);
+    sourceModel.contents[100] = 2000;
+    sourceModel.contents[900] = -1;
+    Q_EMIT sourceModel.dataChanged(sourceModel.index(0), sourceModel.index(999));
+    QCOMPARE(spy.count(), 2);
+    QCOMPARE(spy.at(0)[SourceFromIndex], 100);
+    QCOMPARE(spy.at(0)[ToIndex], 1000);
+    QCOMPARE(spy.at(1)[SourceFromIndex], 899);
+    QCOMPARE(spy.at(1)[ToIndex], 0);
+    QCOMPARE(sorted.index(0).data().toInt(), -1);
+    QCOMPARE(sorted.index(999).data().toInt(), 2000);
+    QCOMPARE(persistentIndex.row(), 500);
+    QVERIFY(verifyInternalMapping(&sorted));
+}
+
+void SortProxyModelTest::persistentIndexAfterShift()
+{
+    VectorModel<int> sourceModel{10, 30, 20};
+    SortProxyModel sorted;
+    sorted.setSourceModel(&sourceModel);
+    sorted.sort(0);
+    CHECKMODELCONTENTS(int)(sorted, {10, 20, 30});
+
+    // the source row of 20 shifts, but the persistent index has to keep pointing at it
+    const QPersistentModelIndex persistentIndex = sorted.index(1);
+    sourceModel.insert(0, {5, 40});
+    CHECKMODELCONTENTS(int)(sorted, {5, 10, 20, 30, 40});
+    QCOMPARE(persistentIndex.row(), 2);
+    QCOMPARE(persistentIndex.data().toInt(), 20);
+    QCOMPARE(sorted.mapToSource(persistentIndex).row(), 4);
+
+    sourceModel.removeRows(0, 3);
+    CHECKMODELCONTENTS(int)(sorted, {20, 30});
+    QCOMPARE(persistentIndex.row(), 0);
+    QCOMPARE(persistentIndex.data().toInt(), 20);
+    QVERIFY(verifyInternalMapping(&sorted));
+}
+
 void SortProxyModelTest::removeSingleValue()
 {
     VectorModel<int> sourceModel{3, 9, 1, 2, 4};
@@ -510,6 +642,42 @@ void SortProxyModelTest::removeMultipleDiscontiniousValues()
     QCOMPARE(removedSpy.count(), 2);
 }
 
+void SortProxyModelTest::removeScatteredRows()
+{
+    // the first half of the source rows sorts to every other proxy row
+    VectorModel<int> sourceModel{0, 2, 4, 6, 8, 1, 3, 5, 7, 9};
+    SortProxyModel sorted;
+    sorted.setSourceModel(&sourceModel);
+    sorted.sort(0);
+
+    QSignalSpy movedSpy(&sorted, &SortProxyModel::rowsMoved);
+    QSignalSpy removedSpy(&sorted, &SortProxyModel::rowsRemoved);
+
+    // between the steps, the rows that are still shown map to the source rows they were shifted to
+    connect(&sorted, &SortProxyModel::rowsRemoved, this, [&]() {
+        for (int sourceRow = 0; sourceRow < sourceModel.rowCount(); ++sourceRow)
+        {
+            const QModelIndex proxyIndex = sorted.mapFromSource(sourceModel.index(sourceRow, 0));
+            QVERIFY(proxyIndex.isValid());
+            QCOMPARE(sorted.mapToSource(proxyIndex).row(), sourceRow);
+            QCOMPARE(proxyIndex.data().toInt(), 2 * sourceRow + 1);
+        }
+    });
+
+    sourceModel.removeRows(0, 5);
+    CHECKMODELCONTENTS(int)(sorted, {1, 3, 5, 7, 9});
+    QCOMPARE(movedSpy.count(), 0);
+
+    // one step per row, starting at the back so the rows in front keep their place
+    QCOMPARE(removedSpy.count(), 5);
+    for (int step = 0; step < 5; ++step)
+    {
+        QCOMPARE(removedSpy.at(step)[RemovedFromIndex], 8 - 2 * step);
+        QCOMPARE(removedSpy.at(step)[RemovedToIndex], 8 - 2 * step);
+    }
+    QVERIFY(verifyInternalMapping(&sorted));
+}
+
 void SortProxyModelTest::strings()
 {
     VectorModel<QString> sourceModel{QLatin1String("cherry"), QLatin1String("dew"), QLatin1String("Bee"),
@@ -535,6 +703,43 @@ void SortProxyModelTest::strings()
               QLatin1String("Bee")});
 }
 
+void SortProxyModelTest::localeAwareStrings()
+{
+    VectorModel<QString> sourceModel{QLatin1String("file10"), QLatin1String("File2"), QLatin1String("apple"),
+                                     QLatin1String("file1"), QLatin1String("Bee")};
+
+    SortProxyModel sorted;
+    sorted.setSourceModel(&sourceModel);
+    sorted.setSortCollator(QCollator(QLocale(QStringLiteral("en_US"))));
+    sorted.sort(0);
+    CHECKMODELCONTENTS(QString)
+    (sorted, {QLatin1String("Bee"), QLatin1String("File2"), QLatin1String("apple"), QLatin1String("file1"),
+              QLatin1String("file10")});
+
+    QSignalSpy localeAwareSpy(&sorted, &SortProxyModel::sortLocaleAwareChanged);
+    sorted.setSortLocaleAware(true);
+    QCOMPARE(localeAwareSpy.count(), 1);
+    QVERIFY(sorted.sortCriteria().constFirst().localeAware);
+    CHECKMODELCONTENTS(QString)
+    (sorted, {QLatin1String("apple"), QLatin1String("Bee"), QLatin1String("file1"), QLatin1String("file10"),
+              QLatin1String("File2")});
+
+    // numeric mode compares sequences of digits by their value
+    QCollator collator = sorted.sortCollator();
+    collator.setNumericMode(true);
+    sorted.setSortCollator(collator);
+    CHECKMODELCONTENTS(QString)
+    (sorted, {QLatin1String("apple"), QLatin1String("Bee"), QLatin1String("file1"), QLatin1String("File2"),
+              QLatin1String("file10")});
+
+    sourceModel.setValue(2, QLatin1String("file3"));
+    sourceModel.insert(0, QLatin1String("bee"));
+    CHECKMODELCONTENTS(QString)
+    (sorted, {QLatin1String("bee"), QLatin1String("Bee"), QLatin1String("file1"), QLatin1String("File2"),
+              QLatin1String("file3"), QLatin1String("file10")});
+    QVERIFY(verifyInternalMapping(&sorted));
+}
+
 void SortProxyModelTest::doubles()
 {
     VectorModel<double> sourceModel{20.0, 1.1, 42.0, 3.33};
@@ -549,6 +754,47 @@ void SortProxyModelTest::doubles()
     CHECKMODELCONTENTS(double)(sorted, {42.0, 20.0, 3.33, 1.1});
 }
 
+void SortProxyModelTest::dateTimes()
+{
+    const auto dateTime = [](qint64 msecs) { return QDateTime::fromMSecsSinceEpoch(msecs); };
+    VectorModel<QDateTime> sourceModel{dateTime(3000), dateTime(1000), QDateTime(), dateTime(2000)};
+
+    SortProxyModel sorted;
+    sorted.setSourceModel(&sourceModel);
+    sorted.sort(0);
+
+    // invalid date/times sort first
+    CHECKMODELCONTENTS(QDateTime)(sorted, {QDateTime(), dateTime(1000), dateTime(2000), dateTime(3000)});
+
+    sourceModel.setValue(2, dateTime(4000));
+    CHECKMODELCONTENTS(QDateTime)(sorted, {dateTime(1000), dateTime(2000), dateTime(3000), dateTime(4000)});
+}
+
+void SortProxyModelTest::mixedTypes()
+{
+    VectorModel<QVariant> sourceModel{QVariant(3), QVariant(1), QVariant(2), QVariant(1)};
+
+    SortProxyModel sorted;
+    sorted.setSourceModel(&sourceModel);
+    sorted.sort(0);
+
+    CHECKMODELCONTENTS(QVariant)(sorted, {QVariant(1), QVariant(1), QVariant(2), QVariant(3)});
+    // equal values keep the order of the source model
+    QCOMPARE(sorted.mapToSource(sorted.index(0, 0)).row(), 1);
+    QCOMPARE(sorted.mapToSource(sorted.index(1, 0)).row(), 3);
+
+    // a value of a different type makes the proxy fall back to comparing QVariants
+    sourceModel.setValue(0, QVariant(qlonglong(0)));
+    CHECKMODELCONTENTS(QVariant)(sorted, {QVariant(qlonglong(0)), QVariant(1), QVariant(1), QVariant(2)});
+
+    // invalid values sort last
+    sourceModel.insert(0, QVariant());
+    sourceModel.append(QVariant(-1));
+    CHECKMODELCONTENTS(QVariant)
+    (sorted, {QVariant(-1), QVariant(qlonglong(0)), QVariant(1), QVariant(1), QVariant(2), QVariant()});
+    QVERIFY(verifyInternalMapping(&sorted));
+}
+
 void SortProxyModelTest::sortOnRolesAndColumns()
 {
     QStandardItemModel sourceModel;
@@ -599,6 +845,412 @@ void SortProxyModelTest::sortOnRolesAndColumns()
     CHECKMODELCONTENTS(int)(sorted, {1, 2, 3, 4, 5});
 }
 
+void SortProxyModelTest::multipleSortCriteria()
+{
+    QStandardItemModel sourceModel;
+    struct Entry
+    {
+        QString symbol;
+        int timestamp;
+    };
+
+    const std::vector<Entry> data = {{QStringLiteral("b"), 1},
+                                     {QStringLiteral("a"), 2},
+                                     {QStringLiteral("B"), 3},
+                                     {QStringLiteral("a"), 1},
+                                     {QStringLiteral("b"), 3}};
+
+    sourceModel.setColumnCount(2);
+    sourceModel.setRowCount(int(data.size()));
+    int row = 0;
+    for (const auto &entry : data)
+    {
+        auto symbolItem = new QStandardItem();
+        symbolItem->setData(entry.symbol, Qt::DisplayRole);
+        sourceModel.setItem(row, 0, symbolItem);
+        auto timestampItem = new QStandardItem();
+        timestampItem->setData(entry.timestamp, Qt::DisplayRole);
+        sourceModel.setItem(row, 1, timestampItem);
+        row++;
+    }
+
+    SortProxyModel sorted;
+    sorted.setSourceModel(&sourceModel);
+    QSignalSpy columnSpy(&sorted, &SortProxyModel::sortColumnChanged);
+    QSignalSpy caseSensitivitySpy(&sorted, &SortProxyModel::sortCaseSensitivityChanged);
+
+    // symbol ascending, then timestamp descending
+    const QVector<SortProxyModel::SortCriterion> criteria{
+        {0, Qt::DisplayRole, Qt::AscendingOrder, Qt::CaseInsensitive},
+        {1, Qt::DisplayRole, Qt::DescendingOrder, Qt::CaseSensitive}};
+    sorted.setSortCriteria(criteria);
+    QCOMPARE(sorted.sortCriteria(), criteria);
+    QCOMPARE(sorted.sortColumn(), 0);
+    QCOMPARE(sorted.sortCaseSensitivity(), Qt::CaseInsensitive);
+    QCOMPARE(columnSpy.count(), 1);
+    QCOMPARE(caseSensitivitySpy.count(), 1);
+    // "B" and "b" with equal timestamps keep their source order
+    QCOMPARE(sourceRows(sorted), (std::vector<int>{1, 3, 2, 4, 0}));
+    QVERIFY(verifyInternalMapping(&sorted));
+
+    // changing a secondary key moves the row within its group
+    QSignalSpy movedSpy(&sorted, &SortProxyModel::rowsMoved);
+    sourceModel.setData(sourceModel.index(3, 1), 5);
+    QCOMPARE(sourceRows(sorted), (std::vector<int>{3, 1, 2, 4, 0}));
+    QCOMPARE(movedSpy.count(), 1);
+    QVERIFY(verifyInternalMapping(&sorted));
+
+    // sorting on a single column replaces the criteria
+    sorted.sort(1);
+    QCOMPARE(sorted.sortCriteria().size(), 1);
+    QCOMPARE(sourceRows(sorted), (std::vector<int>{0, 1, 2, 4, 3}));
+    QVERIFY(verifyInternalMapping(&sorted));
+
+    sorted.setSortCriteria({});
+    QCOMPARE(sorted.sortColumn(), -1);
+    CHECKMODELCONTENTS(QString)
+    (sorted, {QLatin1String("b"), QLatin1String("a"), QLatin1String("B"), QLatin1String("a"), QLatin1String("b")});
+}
+
+void SortProxyModelTest::treeModel()
+{
+    const auto makeItem = [](int value) {
+        auto item = new QStandardItem();
+        item->setData(value, Qt::DisplayRole);
+        return item;
+    };
+    const auto childValues = [](const QAbstractItemModel &model, const QModelIndex &parent) {
+        QVector<int> values;
+        for (int row = 0; row < model.rowCount(parent); ++row)
+            values.append(model.index(row, 0, parent).data().toInt());
+        return values;
+    };
+
+    QStandardItemModel sourceModel;
+    for (int parentValue : {30, 10, 20})
+    {
+        auto parentItem = makeItem(parentValue);
+        for (int childValue : {5, 2, 8, 1})
+            parentItem->appendRow(makeItem(parentValue + childValue));
+        sourceModel.appendRow(parentItem);
+    }
+
+    SortProxyModel sorted;
+    sorted.setSourceModel(&sourceModel);
+    sorted.sort(0);
+    CHECKMODELCONTENTS(int)(sorted, {10, 20, 30});
+    // the rows below the parents are only mapped once they are queried
+    QVERIFY(sorted.m_rootMapping.children.empty());
+
+    const QPersistentModelIndex parent = sorted.index(0, 0);
+    QCOMPARE(childValues(sorted, parent), (QVector<int>{11, 12, 15, 18}));
+    QCOMPARE(sorted.m_rootMapping.children.size(), std::size_t(1));
+    const QModelIndex child = sorted.index(2, 0, parent);
+    QCOMPARE(child.parent(), QModelIndex(parent));
+    QCOMPARE(sorted.mapToSource(child), sourceModel.item(1)->child(0)->index());
+    QCOMPARE(sorted.mapFromSource(sourceModel.item(1)->child(0)->index()), child);
+
+    // changing a child moves it within its parent
+    QSignalSpy movedSpy(&sorted, &SortProxyModel::rowsMoved);
+    sourceModel.item(1)->child(2)->setData(9, Qt::DisplayRole);
+    QCOMPARE(childValues(sorted, parent), (QVector<int>{9, 11, 12, 15}));
+    QCOMPARE(movedSpy.count(), 1);
+    QCOMPARE(movedSpy.at(0).at(SourceParent).value<QModelIndex>(), QModelIndex(parent));
+    QCOMPARE(movedSpy.at(0).at(SourceFromIndex).toInt(), 3);
+    QCOMPARE(movedSpy.at(0).at(ToIndex).toInt(), 0);
+
+    // inserting into a parent that was queried is signalled, other parents stay unmapped
+    QSignalSpy insertedSpy(&sorted, &SortProxyModel::rowsInserted);
+    sourceModel.item(1)->appendRow(makeItem(13));
+    sourceModel.item(0)->appendRow(makeItem(33));
+    QCOMPARE(childValues(sorted, parent), (QVector<int>{9, 11, 12, 13, 15}));
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(insertedSpy.at(0).at(InsertParent).value<QModelIndex>(), QModelIndex(parent));
+    QCOMPARE(insertedSpy.at(0).at(InsertFromIndex).toInt(), 3);
+    QCOMPARE(sorted.m_rootMapping.children.size(), std::size_t(1));
+
+    // changing the sort order reorders all mapped levels, keeping persistent indexes intact
+    const QPersistentModelIndex persistentChild = sorted.index(4, 0, parent);
+    sorted.sort(0, Qt::DescendingOrder);
+    CHECKMODELCONTENTS(int)(sorted, {30, 20, 10});
+    QCOMPARE(parent.row(), 2);
+    QCOMPARE(childValues(sorted, parent), (QVector<int>{15, 13, 12, 11, 9}));
+    QCOMPARE(persistentChild.row(), 0);
+    QCOMPARE(persistentChild.data().toInt(), 15);
+    QCOMPARE(persistentChild.parent(), QModelIndex(parent));
+    QCOMPARE(childValues(sorted, sorted.index(0, 0)), (QVector<int>{38, 35, 33, 32, 31}));
+
+    // removing a parent removes the mapping of its children with it
+    sourceModel.removeRow(1);
+    CHECKMODELCONTENTS(int)(sorted, {30, 20});
+    QVERIFY(!parent.isValid());
+    QVERIFY(!persistentChild.isValid());
+    QCOMPARE(sorted.m_rootMapping.children.size(), std::size_t(1));
+    QCOMPARE(QModelIndex(sorted.m_rootMapping.children.begin()->second->sourceParent), sourceModel.index(0, 0));
+    QVERIFY(verifyInternalMapping(&sorted));
+
+    // removing parents in several steps keeps the rows that stay mapped in between, including the
+    //   children of the remaining parent
+    auto parentItem = makeItem(25);
+    for (int childValue : {3, 1, 2})
+        parentItem->appendRow(makeItem(25 + childValue));
+    sourceModel.appendRow(parentItem);
+    CHECKMODELCONTENTS(int)(sorted, {30, 25, 20});
+    QCOMPARE(childValues(sorted, sorted.index(1, 0)), (QVector<int>{28, 27, 26}));
+    QCOMPARE(childValues(sorted, sorted.index(2, 0)), (QVector<int>{28, 25, 22, 21}));
+    QCOMPARE(sorted.m_rootMapping.children.size(), std::size_t(3));
+    QSignalSpy removedSpy(&sorted, &SortProxyModel::rowsRemoved);
+    connect(&sorted, &SortProxyModel::rowsRemoved, this, [&]() {
+        const QModelIndex sourceParent = sourceModel.indexFromItem(parentItem);
+        const QModelIndex proxyParent = sorted.mapFromSource(sourceParent);
+        QCOMPARE(proxyParent.data().toInt(), 25);
+        for (int row = 0; row < sourceModel.rowCount(sourceParent); ++row)
+        {
+            const QModelIndex sourceChild = sourceModel.index(row, 0, sourceParent);
+            const QModelIndex proxyChild = sorted.mapFromSource(sourceChild);
+            QCOMPARE(proxyChild.parent(), proxyParent);
+            QCOMPARE(sorted.mapToSource(proxyChild), sourceChild);
+        }
+    });
+    sourceModel.removeRows(0, 2); // 30 and 20, with 25 in between
+    CHECKMODELCONTENTS(int)(sorted, {25});
+    QCOMPARE(removedSpy.count(), 2);
+    QCOMPARE(childValues(sorted, sorted.index(0, 0)), (QVector<int>{28, 27, 26}));
+    QVERIFY(verifyInternalMapping(&sorted));
+}
+
+void SortProxyModelTest::layoutChangeAboveThreshold()
+{
+    VectorModel<int> sourceModel{1, 2, 3, 4, 5, 6, 7, 8};
+    SortProxyModel sorted;
+    sorted.setSourceModel(&sourceModel);
+    sorted.setReorderSignalPolicy(SortProxyModel::EmitLayoutChangeAboveThreshold);
+    sorted.setLayoutChangeMoveThreshold(2);
+    sorted.sort(0);
+    CHECKMODELCONTENTS(int)(sorted, {1, 2, 3, 4, 5, 6, 7, 8});
+
+    QSignalSpy movedSpy(&sorted, &SortProxyModel::rowsMoved);
+    QSignalSpy layoutSpy(&sorted, &SortProxyModel::layoutChanged);
+
+    // reversing the order moves 7 rows, which is above the threshold
+    const QPersistentModelIndex persistentIndex = sorted.index(1, 0);
+    sorted.sort(0, Qt::DescendingOrder);
+    CHECKMODELCONTENTS(int)(sorted, {8, 7, 6, 5, 4, 3, 2, 1});
+    QCOMPARE(movedSpy.count(), 0);
+    QCOMPARE(layoutSpy.count(), 1);
+    QCOMPARE(persistentIndex.row(), 6);
+    QCOMPARE(persistentIndex.data().toInt(), 2);
+    QVERIFY(verifyInternalMapping(&sorted));
+
+    // moving a single row stays below the threshold
+    sourceModel.setValue(0, 10);
+    CHECKMODELCONTENTS(int)(sorted, {10, 8, 7, 6, 5, 4, 3, 2});
+    QCOMPARE(movedSpy.count(), 1);
+    QCOMPARE(layoutSpy.count(), 1);
+
+    // a fraction of the row count works as a threshold as well
+    sorted.setLayoutChangeRowFraction(0.1);
+    sourceModel.setValue(0, 1);
+    CHECKMODELCONTENTS(int)(sorted, {8, 7, 6, 5, 4, 3, 2, 1});
+    QCOMPARE(movedSpy.count(), 1);
+    QCOMPARE(layoutSpy.count(), 2);
+    QCOMPARE(persistentIndex.row(), 6);
+    QVERIFY(verifyInternalMapping(&sorted));
+}
+
+void SortProxyModelTest::asynchronousSorting()
+{
+    VectorModel<int> sourceModel{5, 3, 8, 1, 4};
+    SortProxyModel sorted;
+    sorted.setAsynchronousSorting(true);
+    sorted.setSourceModel(&sourceModel);
+    QVERIFY(!sorted.isSortPending());
+
+    QSignalSpy pendingSpy(&sorted, &SortProxyModel::sortPendingChanged);
+    sorted.sort(0);
+    QVERIFY(sorted.isSortPending());
+    CHECKMODELCONTENTS(int)(sorted, {5, 3, 8, 1, 4}); // unchanged until the result arrives
+    QTRY_VERIFY(!sorted.isSortPending());
+    QCOMPARE(pendingSpy.count(), 2);
+    CHECKMODELCONTENTS(int)(sorted, {1, 3, 4, 5, 8});
+    QVERIFY(verifyInternalMapping(&sorted));
+
+    // source changes while a sort is pending restart it
+    sorted.sort(0, Qt::DescendingOrder);
+    QVERIFY(sorted.isSortPending());
+    sourceModel.append(6);
+    sourceModel.setValue(0, 0);
+    QTRY_VERIFY(!sorted.isSortPending());
+    CHECKMODELCONTENTS(int)(sorted, {8, 6, 4, 3, 1, 0});
+    QVERIFY(verifyInternalMapping(&sorted));
+
+    // after a reset, the source order is shown until the sort has finished
+    sourceModel.removeRows(0, sourceModel.rowCount());
+    sorted.setSourceModel(nullptr);
+    VectorModel<int> otherModel{2, 9, 7};
+    sorted.setSourceModel(&otherModel);
+    CHECKMODELCONTENTS(int)(sorted, {2, 9, 7});
+    QTRY_VERIFY(!sorted.isSortPending());
+    CHECKMODELCONTENTS(int)(sorted, {9, 7, 2});
+
+    // turning asynchronous sorting off applies a pending sort right away
+    sorted.sort(0, Qt::AscendingOrder);
+    QVERIFY(sorted.isSortPending());
+    sorted.setAsynchronousSorting(false);
+    QVERIFY(!sorted.isSortPending());
+    CHECKMODELCONTENTS(int)(sorted, {2, 7, 9});
+    QVERIFY(verifyInternalMapping(&sorted));
+}
+
+static std::vector<int> randomValues(int count)
+{
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> distribution(0, count / 4);
+    std::vector<int> values(static_cast<std::size_t>(count));
+    for (auto &value : values)
+        value = distribution(generator);
+    return values;
+}
+
+void SortProxyModelTest::parallelSorting()
+{
+    // many duplicate keys, so the source row tiebreak has to survive the merges
+    VectorModel<int> sourceModel(randomValues(20000));
+    SortProxyModel sequential;
+    sequential.setSourceModel(&sourceModel);
+    sequential.sort(0);
+
+    // use several chunks, even on machines with few cores
+    const int maxThreadCount = QThreadPool::globalInstance()->maxThreadCount();
+    QThreadPool::globalInstance()->setMaxThreadCount(3);
+
+    SortProxyModel parallel;
+    parallel.setParallelSorting(true);
+    parallel.setParallelSortThreshold(1000);
+    parallel.setSourceModel(&sourceModel);
+    parallel.sort(0);
+    QVERIFY(verifyInternalMapping(&parallel));
+    QCOMPARE(sourceRows(parallel), sourceRows(sequential));
+
+    sequential.sort(0, Qt::DescendingOrder);
+    parallel.sort(0, Qt::DescendingOrder);
+    QCOMPARE(sourceRows(parallel), sourceRows(sequential));
+
+    QThreadPool::globalInstance()->setMaxThreadCount(maxThreadCount);
+}
+
+void SortProxyModelTest::rowLimit()
+{
+    VectorModel<int> sourceModel{50, 20, 80, 10, 40, 70, 30, 60};
+    SortProxyModel sorted;
+    sorted.setSourceModel(&sourceModel);
+    sorted.setRowLimit(3);
+    sorted.sort(0);
+    CHECKMODELCONTENTS(int)(sorted, {10, 20, 30});
+    QVERIFY(!sorted.mapFromSource(sourceModel.index(0, 0)).isValid());
+    QVERIFY(verifyInternalMapping(&sorted));
+
+    QSignalSpy insertedSpy(&sorted, &SortProxyModel::rowsInserted);
+    QSignalSpy removedSpy(&sorted, &SortProxyModel::rowsRemoved);
+
+    // a new row within the limit pushes out the last row
+    const QPersistentModelIndex persistentIndex = sorted.index(1, 0);
+    sourceModel.insert(0, 15);
+    CHECKMODELCONTENTS(int)(sorted, {10, 15, 20});
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(persistentIndex.row(), 2);
+    QVERIFY(verifyInternalMapping(&sorted));
+
+    // a new row beyond the limit does not show up at all
+    sourceModel.append(90);
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(removedSpy.count(), 1);
+
+    // removing a row within the limit brings in the next one
+    sourceModel.removeRows(0, 1);
+    CHECKMODELCONTENTS(int)(sorted, {10, 20, 30});
+
+    // changed rows move in and out of the limit
+    sourceModel.setValue(2, 5);
+    CHECKMODELCONTENTS(int)(sorted, {5, 10, 20});
+    sourceModel.setValue(3, 100);
+    CHECKMODELCONTENTS(int)(sorted, {5, 20, 30});
+    QVERIFY(verifyInternalMapping(&sorted));
+
+    sorted.setRowLimit(5);
+    CHECKMODELCONTENTS(int)(sorted, {5, 20, 30, 40, 50});
+    sorted.sort(0, Qt::DescendingOrder);
+    CHECKMODELCONTENTS(int)(sorted, {100, 90, 70, 60, 50});
+    sorted.setRowLimit(2);
+    CHECKMODELCONTENTS(int)(sorted, {100, 90});
+
+    // without a limit, all rows are shown again
+    sorted.setRowLimit(-1);
+    CHECKMODELCONTENTS(int)(sorted, {100, 90, 70, 60, 50, 40, 30, 20, 5});
+    QVERIFY(verifyInternalMapping(&sorted));
+}
+
+void SortProxyModelTest::filter()
+{
+    VectorModel<int> sourceModel{50, 21, 80, 10, 43, 70, 30, 65};
+    SortProxyModel sorted;
+    sorted.setSourceModel(&sourceModel);
+    sorted.sort(0);
+    int threshold = 0;
+    const auto evenAboveThreshold = [&threshold](const QAbstractItemModel *model, int row, const QModelIndex &parent) {
+        const int value = model->index(row, 0, parent).data().toInt();
+        return value % 2 == 0 && value > threshold;
+    };
+    sorted.setFilterAcceptsRowFunction(evenAboveThreshold);
+    CHECKMODELCONTENTS(int)(sorted, {10, 30, 50, 70, 80});
+    QVERIFY(!sorted.mapFromSource(sourceModel.index(1, 0)).isValid());
+    QVERIFY(verifyInternalMapping(&sorted));
+
+    QSignalSpy insertedSpy(&sorted, &SortProxyModel::rowsInserted);
+    QSignalSpy removedSpy(&sorted, &SortProxyModel::rowsRemoved);
+
+    // inserted rows are only shown if they pass the filter
+    sourceModel.insert(0, {15, 40});
+    CHECKMODELCONTENTS(int)(sorted, {10, 30, 40, 50, 70, 80});
+    QCOMPARE(insertedSpy.count(), 1);
+    sourceModel.append(33);
+    QCOMPARE(insertedSpy.count(), 1);
+    QVERIFY(verifyInternalMapping(&sorted));
+
+    // changed rows are filtered again
+    sourceModel.setValue(3, 20); // 21 -> 20
+    CHECKMODELCONTENTS(int)(sorted, {10, 20, 30, 40, 50, 70, 80});
+    QCOMPARE(insertedSpy.count(), 2);
+    sourceModel.setValue(4, 11); // 80 -> 11
+    CHECKMODELCONTENTS(int)(sorted, {10, 20, 30, 40, 50, 70});
+    QCOMPARE(removedSpy.count(), 1);
+
+    // removing rows that are filtered out does not touch the proxy
+    sourceModel.removeRows(0, 1);
+    QCOMPARE(removedSpy.count(), 1);
+    QVERIFY(verifyInternalMapping(&sorted));
+
+    // the filter itself changes
+    threshold = 25;
+    sorted.invalidateFilter();
+    CHECKMODELCONTENTS(int)(sorted, {30, 40, 50, 70});
+    QCOMPARE(insertedSpy.count(), 2);
+
+    // combined with a row limit, the limit applies to the rows that pass the filter
+    sorted.setRowLimit(2);
+    sorted.sort(0, Qt::DescendingOrder);
+    CHECKMODELCONTENTS(int)(sorted, {70, 50});
+    threshold = 60;
+    sorted.invalidateFilter();
+    CHECKMODELCONTENTS(int)(sorted, {70});
+    sorted.setRowLimit(-1);
+
+    sorted.clearFilterAcceptsRowFunction();
+    CHECKMODELCONTENTS(int)(sorted, {70, 65, 50, 43, 40, 33, 30, 20, 11, 10});
+    QVERIFY(verifyInternalMapping(&sorted));
+}
+
 QTEST_MAIN(SortProxyModelTest)
 
 #include "tst_sortproxymodeltest.moc"
@@ -33,6 +33,12 @@ public:
     {
     }
 
+    explicit VectorModel(std::vector<T> initialContents, QObject *parent = nullptr)
+        : QAbstractListModel(parent)
+        , contents(std::move(initialContents))
+    {
+    }
+
     void setValue(int row, const T &value)
     {
         auto &e = contents[row];
@@ -73,6 +79,13 @@ public:
         endInsertRows();
     }
 
+    void insert(int row, const std::vector<T> &values)
+    {
+        beginInsertRows({}, row, row + static_cast<int>(values.size()) - 1);
+        contents.insert(contents.begin() + row, values.cbegin(), values.cend());
+        endInsertRows();
+    }
+
     // QAbstractItemModel interface
 public:
     int rowCount(const QModelIndex &parent = QModelIndex()) const override
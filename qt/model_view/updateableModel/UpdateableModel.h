@@ -10,10 +10,27 @@
 #ifndef UPDATEABLEMODEL_H
 #define UPDATEABLEMODEL_H
 
+#include <QByteArray>
+#include <QDeadlineTimer>
+#include <QHash>
 #include <QModelIndex>
-#include <QSet>
+#include <QSemaphore>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
 #include <QVector>
+#include <QtAlgorithms>
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 // concepts
 #define ForwardIt typename
@@ -98,19 +115,6 @@ void updateCollection(const FwdIt srcBegin, const FwdIt srcEnd, TargetCollection
 // helper functions
 namespace
 {
-// helper function to create a QSet<T> out of any container<T>.
-template<typename T>
-auto setFromContainer(T container) -> QSet<typename T::value_type>
-{
-    QSet<typename T::value_type> set;
-    set.reserve(container.size());
-    for (const auto value : container)
-    {
-        set.insert(value);
-    }
-    return set;
-}
-
 // helper for manual overload ranking
 //   highest rank is selected first
 template<size_t Rank>
@@ -208,225 +212,1910 @@ bool dataLessThan(const T &lhs, const T &rhs)
 {
     return dataLessThan_imp(lhs, rhs, OverloadRanker<BestDataLessThanOverloadRank>{});
 }
+
+/**
+ *  Moves the items in the rows [firstRow, lastRow] of @arg container to before @arg destinationRow,
+ *  like QAbstractItemModel::beginMoveRows describes it
+ */
+template<Container C>
+void moveRange(C &container, int firstRow, int lastRow, int destinationRow)
+{
+    const auto begin = std::begin(container);
+    const auto first = std::next(begin, firstRow);
+    const auto end = std::next(begin, lastRow + 1);
+    const auto destination = std::next(begin, destinationRow);
+    if (destinationRow > lastRow)
+        std::rotate(first, end, destination);
+    else
+        std::rotate(destination, first, end);
 }
 
-// actual class to inherit from
-template<QAIM BaseModel, typename DataType>
-class UpdateableModel : public BaseModel
+/**
+ *  Lets updateCollection walk a container without modifying it, as long as the event handlers do not
+ */
+template<Container C>
+struct ReadOnlyCollection
 {
-    // can't use Q_OBJECT on templates
+    const C &container;
 
-public:
-    explicit UpdateableModel(QObject *parent = nullptr)
-        : BaseModel(parent)
+    auto begin() const { return std::cbegin(container); }
+    auto end() const { return std::cend(container); }
+    void reserve(std::size_t) const {}
+};
+}
+
+// helper functions that are not templates, so every translation unit shares the same definition
+namespace UpdateableModelDetail
+{
+// longestIncreasingSubsequence and runConcurrently are kept identical to the copies in sortproxymodel.cpp
+/**
+ * @brief Finds a longest strictly increasing subsequence in @p values
+ * @returns for every entry in @p values whether it is part of the subsequence
+ *
+ * Runs in O(n log n). If there are several subsequences of maximum length, the one that picks
+ * the earliest possible entries is returned.
+ */
+inline std::vector<bool> longestIncreasingSubsequence(const std::vector<int> &values)
+{
+    const int size = static_cast<int>(values.size());
+
+    // lengthFrom[i] is the length of the longest increasing subsequence starting at i. It is
+    // computed from the back, so heads[len - 1] holds the largest value any increasing
+    // subsequence of length len found so far starts with. heads is decreasing.
+    std::vector<int> lengthFrom(values.size());
+    std::vector<int> heads;
+    for (int i = size - 1; i >= 0; --i)
     {
+        const auto it = std::lower_bound(heads.begin(), heads.end(), values[i], std::greater<int>());
+        lengthFrom[i] = static_cast<int>(it - heads.begin()) + 1;
+        if (it == heads.end())
+            heads.push_back(values[i]);
+        else
+            *it = values[i];
     }
 
-protected: // types
-    struct Operations
+    std::vector<bool> inSubsequence(values.size(), false);
+    int remaining = static_cast<int>(heads.size());
+    int previous = std::numeric_limits<int>::min();
+    for (int i = 0; i < size && remaining > 0; ++i)
     {
-        uint inserts;
-        uint removals;
-        uint updates;
-    };
+        if (lengthFrom[i] == remaining && values[i] > previous)
+        {
+            inSubsequence[i] = true;
+            previous = values[i];
+            --remaining;
+        }
+    }
+    return inSubsequence;
+}
 
-    struct DataChanges
+/**
+ * Runs task(0) ... task(count - 1), using idle threads of the global thread pool where available
+ * and the calling thread otherwise. Returns once all tasks have finished.
+ */
+inline void runConcurrently(int count, const std::function<void(int)> &task)
+{
+    QSemaphore finished;
+    for (int i = 1; i < count; ++i)
     {
-        operator bool() const { return !changedColumns.isEmpty(); }
-        QVector<int> changedColumns; // important: keep ordered!
-        QVector<int> changedRoles;
-    };
+        const bool started = QThreadPool::globalInstance()->tryStart([&task, &finished, i]() {
+            task(i);
+            finished.release();
+        });
+        if (!started)
+        {
+            task(i);
+            finished.release();
+        }
+    }
+    task(0);
+    finished.release();
+    finished.acquire(count);
+}
 
-    enum ChangeMergePolicy
+/**
+ *  A Fenwick tree over slots that are either occupied or free. Counting the occupied slots before
+ *  a slot, and occupying or freeing one, takes O(log n) steps.
+ */
+class OccupiedSlots
+{
+public:
+    explicit OccupiedSlots(const std::vector<bool> &occupied)
+        : m_tree(occupied.size() + 1, 0)
     {
-        AlwaysMergeNeighbouringRows,
-        MergeWhenColumnsMatch,
-        MergeWhenRolesMatch,
-        MergeOnPerfectMatch
-    };
+        const std::size_t size = occupied.size();
+        for (std::size_t i = 1; i <= size; ++i)
+        {
+            m_tree[i] += occupied[i - 1] ? 1 : 0;
+            const std::size_t parent = i + (i & (~i + 1));
+            if (parent <= size)
+                m_tree[parent] += m_tree[i];
+        }
+    }
 
-    using HasChangesFunction = std::function<DataChanges(const DataType & /*lhs*/, const DataType & /*rhs*/)>;
+    void occupy(int slot) { add(slot, 1); }
+    void vacate(int slot) { add(slot, -1); }
 
-protected: // methods
-    void setChangeMergePolicy(ChangeMergePolicy policy) { m_changeMergePolicy = policy; }
+    int countBefore(int slot) const
+    {
+        int count = 0;
+        for (std::size_t i = static_cast<std::size_t>(slot); i > 0; i &= i - 1)
+            count += m_tree[i];
+        return count;
+    }
 
-    ChangeMergePolicy changeMergePolicy() const { return m_changeMergePolicy; }
+private:
+    void add(int slot, int delta)
+    {
+        for (std::size_t i = static_cast<std::size_t>(slot) + 1; i < m_tree.size(); i += i & (~i + 1))
+            m_tree[i] += delta;
+    }
 
-    virtual bool lessThan(const DataType &lhs, const DataType &rhs) const { return dataLessThan(lhs, rhs); }
+    std::vector<int> m_tree; // 1-based, m_tree[i] counts the slots in (i - (i & -i), i]
+};
+}
 
-    virtual DataChanges itemHasChanged(const DataType &lhs, const DataType &rhs) const
-    {
-        Q_UNUSED(lhs);
-        Q_UNUSED(rhs);
+// keyed algorithm
+
+// precondition: the keys are unique within src and within target. src and target can be in any order.
+//   target needs to be a random access container.
+// If more than maxMovedRows rows need to move, onReorder is called once with the current rows in
+//   their new order instead of calling onMove for every move, and needs to reorder target itself.
+template<ForwardIt FwdIt, Container TargetCollection, typename KeyFunction, BinaryPredicate HasChanged,
+         EventHandler OnChanged, EventHandler OnInsert, EventHandler OnRemove, EventHandler OnMove,
+         EventHandler OnEqual, EventHandler OnReorder>
+void updateCollectionByKey(const FwdIt srcBegin, const FwdIt srcEnd, TargetCollection &target, KeyFunction key,
+                           HasChanged itemHasChanged, OnChanged onChanged, OnInsert onInsert, OnRemove onRemove,
+                           OnMove onMove, OnEqual onEqual, OnReorder onReorder, int maxMovedRows)
+{
+    using Key = std::decay_t<decltype(key(*srcBegin))>;
 
-        return {};
+    // position of every item in src, by key
+    QHash<Key, int> srcPositions;
+    srcPositions.reserve(static_cast<int>(std::distance(srcBegin, srcEnd)));
+    int srcCount = 0;
+    for (auto srcIt = srcBegin; srcIt != srcEnd; ++srcIt)
+    {
+        Q_ASSERT_X(!srcPositions.contains(key(*srcIt)), "updateCollectionByKey", "keys must be unique");
+        srcPositions.insert(key(*srcIt), srcCount++);
     }
 
-    template<ForwardIt Iterator, Container DataContainer, BinaryPredicate LessThan>
-    Operations updateData(Iterator srcBegin, Iterator srcEnd, DataContainer &targetContainer, LessThan lessThan,
-                          HasChangesFunction itemHasChanged)
+    // removal: target has items that are not in src (any more), so remove them. Neighbouring items
+    //   are removed in one go.
+    std::vector<int> positions; // the position in src of every item left in target
+    positions.reserve(target.size());
+    auto targetIt = std::begin(target);
+    while (targetIt != std::end(target))
     {
-        Operations ops{0, 0, 0};
-
-        // events
-        auto onChanged = [this, &targetContainer, &ops](Iterator lhs, typename DataContainer::iterator rhs,
-                                                        const DataChanges &changes) {
-            *rhs = *lhs;
-
-            int row = std::distance(targetContainer.begin(), rhs);
-            addChange(row, changes.changedColumns, changes.changedRoles);
+        const auto srcPosition = srcPositions.constFind(key(*targetIt));
+        if (srcPosition != srcPositions.cend())
+        {
+            positions.push_back(srcPosition.value());
+            ++targetIt;
+            continue;
+        }
 
-            ops.updates++;
-        };
+        auto targetRemoveEnd = std::next(targetIt);
+        while (targetRemoveEnd != std::end(target) && !srcPositions.contains(key(*targetRemoveEnd)))
+        {
+            targetRemoveEnd++;
+        }
+        targetIt = onRemove(targetIt, targetRemoveEnd);
+    }
 
-        auto onInsert = [this, &targetContainer, &ops](Iterator lhsBegin, Iterator lhsEnd,
-                                                       typename DataContainer::iterator rhsInsertAt) {
-            flushCachedChanges();
-            int firstNewRow = std::distance(targetContainer.begin(), rhsInsertAt);
-            int lastNewRow = firstNewRow + std::distance(lhsBegin, lhsEnd) - 1;
-            beginInsertRows(firstNewRow, lastNewRow);
-            auto rangeEnd = insertRange(targetContainer, rhsInsertAt, lhsBegin, lhsEnd);
-            endInsertRows();
+    // move: put the items left in target in the order of src. The items on the longest increasing
+    //   subsequence of their src positions are already in the right order relative to each other,
+    //   so only the others are moved, each to just before the item that follows it in src. Adjacent
+    //   items that go to the same place are moved together.
+    const int count = static_cast<int>(positions.size());
+    std::vector<int> rowAtPosition(static_cast<std::size_t>(srcCount), -1);
+    for (int row = 0; row < count; ++row)
+        rowAtPosition[positions[row]] = row;
+    std::vector<int> newOrder; // the current rows in their new order
+    newOrder.reserve(positions.size());
+    for (int row : rowAtPosition)
+    {
+        if (row != -1)
+            newOrder.push_back(row);
+    }
+    const std::vector<bool> staysInPlace = UpdateableModelDetail::longestIncreasingSubsequence(newOrder);
 
-            ops.inserts += lhsEnd - lhsBegin;
+    if (std::count(staysInPlace.cbegin(), staysInPlace.cend(), false) > maxMovedRows)
+    {
+        onReorder(static_cast<const std::vector<int> &>(newOrder));
+    }
+    else
+    {
+        // The rows of the items are tracked with slots: every item starts in the slot of its row,
+        //   and a moved item goes to a slot just before the slot of the item that stays in place
+        //   after it, or the end. The items moved before the same item are in the order of src, so
+        //   all slots are known up front, and the row of an item is the number of occupied slots
+        //   before its own.
+        std::vector<int> movedBefore(static_cast<std::size_t>(count) + 1, 0); // moved items per row they precede
+        std::vector<int> nextItemInPlace(positions.size()); // the row of that item, count for the end
+        for (int newRow = count - 1, itemInPlace = count; newRow >= 0; --newRow)
+        {
+            if (staysInPlace[newRow])
+            {
+                itemInPlace = newOrder[newRow];
+                continue;
+            }
+            nextItemInPlace[newRow] = itemInPlace;
+            ++movedBefore[itemInPlace];
+        }
 
-            return rangeEnd;
-        };
+        // the first slot of the items moved before each row
+        std::vector<int> firstSlotBefore(static_cast<std::size_t>(count) + 1);
+        int slotCount = 0;
+        for (int row = 0; row <= count; ++row)
+        {
+            firstSlotBefore[row] = slotCount;
+            slotCount += movedBefore[row] + (row < count ? 1 : 0);
+        }
 
-        auto onRemove = [this, &targetContainer, &ops](typename DataContainer::iterator rhsBegin,
-                                                       typename DataContainer::iterator rhsEnd) {
-            flushCachedChanges();
-            const auto targetContainerBegin = std::begin(targetContainer);
-            int firstRemovedRow = std::distance(targetContainerBegin, rhsBegin);
-            int lastRemovedRow = std::distance(targetContainerBegin, rhsEnd) - 1;
-            beginRemoveRows(firstRemovedRow, lastRemovedRow);
-            auto newRhsEnd = targetContainer.erase(rhsBegin, rhsEnd);
-            endRemoveRows();
+        std::vector<int> slotOfItem(positions.size()); // indexed by the original row of the item
+        std::vector<bool> occupied(static_cast<std::size_t>(slotCount), false);
+        for (int row = 0; row < count; ++row)
+        {
+            slotOfItem[row] = firstSlotBefore[row] + movedBefore[row];
+            occupied[slotOfItem[row]] = true;
+        }
+        UpdateableModelDetail::OccupiedSlots slots(occupied);
+        auto rowOfItem = [&slots, &slotOfItem](int item) { return slots.countBefore(slotOfItem[item]); };
 
-            ops.removals += std::distance(rhsBegin, rhsEnd);
+        std::vector<int> slotsTaken(static_cast<std::size_t>(count) + 1, 0); // moved items placed before a row
+        for (int newRow = count - 1; newRow >= 0; --newRow)
+        {
+            if (staysInPlace[newRow])
+                continue;
 
-            return newRhsEnd;
-        };
+            const int lastNewRow = newRow;
+            const int lastRow = rowOfItem(newOrder[newRow]);
+            int firstRow = lastRow;
+            while (newRow > 0 && !staysInPlace[newRow - 1] && rowOfItem(newOrder[newRow - 1]) == firstRow - 1)
+            {
+                --newRow;
+                --firstRow;
+            }
 
-        auto onEqual = [this](Iterator /*lhs*/, typename DataContainer::iterator /*rhs*/) { flushCachedChanges(); };
+            const int destinationRow = lastNewRow + 1 < count ? rowOfItem(newOrder[lastNewRow + 1]) : count;
 
-        updateCollection(srcBegin, srcEnd, targetContainer, lessThan, itemHasChanged, onChanged, onInsert, onRemove,
-                         onEqual);
-        flushCachedChanges();
+            // the items are moved last to first, so they take the slots before the row from the back
+            for (int movedRow = lastNewRow; movedRow >= newRow; --movedRow)
+            {
+                const int item = newOrder[movedRow];
+                const int itemInPlace = nextItemInPlace[movedRow];
+                slots.vacate(slotOfItem[item]);
+                slotOfItem[item] = firstSlotBefore[itemInPlace] + movedBefore[itemInPlace] - ++slotsTaken[itemInPlace];
+                slots.occupy(slotOfItem[item]);
+            }
 
-        return ops;
+            if (destinationRow != lastRow + 1)
+                onMove(firstRow, lastRow, destinationRow);
+        }
     }
 
-    template<ForwardIt Iterator, Container Data>
-    Operations updateData(Iterator srcBegin, Iterator srcEnd, Data &targetContainer, HasChangesFunction hasChanged = {})
+    // target now holds the items of src that it already had, in the order of src. Insert the new
+    //   items in between, and check the others for changes.
+    std::vector<bool> isInTarget(static_cast<std::size_t>(srcCount), false);
+    for (int position : positions)
+        isInTarget[position] = true;
+    int srcPosition = 0;
+    targetIt = std::begin(target);
+    auto srcIt = srcBegin;
+    while (srcIt != srcEnd)
     {
-        auto lessThanFunction = [this](const DataType &lhs, const DataType &rhs) { return this->lessThan(lhs, rhs); };
-        if (!hasChanged)
+        if (!isInTarget[srcPosition])
         {
-            hasChanged = [this](const DataType &lhs, const DataType &rhs) -> DataChanges {
-                return this->itemHasChanged(lhs, rhs);
-            };
+            // insert: src has one or more items that need to be inserted into target
+            auto srcInsertEnd = std::next(srcIt);
+            ++srcPosition;
+            while (srcInsertEnd != srcEnd && !isInTarget[srcPosition])
+            {
+                srcInsertEnd++;
+                ++srcPosition;
+            }
+            targetIt = onInsert(srcIt, srcInsertEnd, targetIt);
+            srcIt = srcInsertEnd;
+            continue;
         }
 
-        return updateData(srcBegin, srcEnd, targetContainer, lessThanFunction, hasChanged);
+        // same item, check for changes
+        auto changes = itemHasChanged(*srcIt, *targetIt);
+        if (changes)
+        {
+            onChanged(srcIt, targetIt, changes);
+        }
+        else
+        {
+            onEqual(srcIt, targetIt);
+        }
+        srcIt++;
+        targetIt++;
+        ++srcPosition;
     }
+}
 
-protected:
-    // Shadowing the methods in the base model, because MSVC thinks the onRemove and onInsert
-    // lambdas in updateData are not allowed to access the protected member functions in BaseClass.
-    // GCC is ok with it...
-    void beginInsertRows(int firstRow, int lastRow) { BaseModel::beginInsertRows(QModelIndex(), firstRow, lastRow); }
+template<ForwardIt FwdIt, Container TargetCollection, typename KeyFunction, BinaryPredicate HasChanged,
+         EventHandler OnChanged, EventHandler OnInsert, EventHandler OnRemove, EventHandler OnMove,
+         EventHandler OnEqual>
+void updateCollectionByKey(const FwdIt srcBegin, const FwdIt srcEnd, TargetCollection &target, KeyFunction key,
+                           HasChanged itemHasChanged, OnChanged onChanged, OnInsert onInsert, OnRemove onRemove,
+                           OnMove onMove, OnEqual onEqual)
+{
+    updateCollectionByKey(
+        srcBegin, srcEnd, target, key, itemHasChanged, onChanged, onInsert, onRemove, onMove, onEqual,
+        [](const std::vector<int> & /*newOrder*/) {}, std::numeric_limits<int>::max());
+}
 
-    void endInsertRows() { BaseModel::endInsertRows(); }
+// fingerprints
+
+/**
+ *  Mixes @arg value into the 64-bit fingerprint @arg seed
+ */
+inline quint64 combineFingerprint(quint64 seed, quint64 value)
+{
+    // the splitmix64 finalizer spreads the bits of small values over the whole fingerprint
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 12) + (seed >> 4));
+}
 
-    void beginRemoveRows(int firstRow, int lastRow) { BaseModel::beginRemoveRows(QModelIndex(), firstRow, lastRow); }
+namespace UpdateableModelDetail
+{
+// 64-bit FNV-1a over the code units, so strings keep 64 bits even where qHash only has 32
+template<typename CodeUnit>
+quint64 codeUnitFingerprint(const CodeUnit *begin, const CodeUnit *end)
+{
+    quint64 result = 0xcbf29ce484222325ULL;
+    for (const CodeUnit *it = begin; it != end; ++it)
+        result = (result ^ static_cast<quint64>(*it)) * 0x100000001b3ULL;
+    return result;
+}
 
-    void endRemoveRows() { BaseModel::endRemoveRows(); }
+inline quint64 fieldFingerprint(const QString &value)
+{
+    return codeUnitFingerprint(value.utf16(), value.utf16() + value.size());
+}
 
-private:
-    void flushCachedChanges()
+inline quint64 fieldFingerprint(const QByteArray &value)
+{
+    const auto *data = reinterpret_cast<const uchar *>(value.constData());
+    return codeUnitFingerprint(data, data + value.size());
+}
+
+template<typename T, std::enable_if_t<std::is_integral<T>::value || std::is_enum<T>::value, int> = 0>
+quint64 fieldFingerprint(const T &value)
+{
+    return static_cast<quint64>(value);
+}
+
+template<typename T, std::enable_if_t<std::is_floating_point<T>::value, int> = 0>
+quint64 fieldFingerprint(const T &value)
+{
+    const double widened = value;
+    quint64 bits;
+    std::memcpy(&bits, &widened, sizeof(bits));
+    return bits;
+}
+
+template<typename T, std::enable_if_t<!std::is_arithmetic<T>::value && !std::is_enum<T>::value, int> = 0>
+quint64 fieldFingerprint(const T &value)
+{
+    return qHash(value);
+}
+}
+
+/**
+ *  Computes a 64-bit fingerprint of @arg fields
+ *
+ *  Integers, enums and floating point numbers contribute their value, QString and QByteArray a
+ *  64-bit hash of their contents. Other types contribute their qHash value, which only has 32 bits
+ *  on Qt 5, so collisions between them are more likely there.
+ */
+template<typename... Fields>
+quint64 fingerprintOf(const Fields &...fields)
+{
+    quint64 result = 0;
+    for (quint64 field : std::initializer_list<quint64>{UpdateableModelDetail::fieldFingerprint(fields)...})
+        result = combineFingerprint(result, field);
+    return result;
+}
+
+/**
+ *  The fingerprints of an item with ColumnCount columns, to compare items without comparing all
+ *  their fields. Compute them when the data is produced, e.g. on a worker thread, and store them in
+ *  the items, so UpdateableModel::fingerprintChanges can tell which columns changed.
+ *
+ *  Different data can have the same fingerprint, but with 64 bits that is very unlikely to happen.
+ */
+template<int ColumnCount>
+struct ItemFingerprint
+{
+    ItemFingerprint() = default;
+
+    // takes the fingerprints of the columns, as computed by fingerprintOf, and combines them into
+    //   the fingerprint of the whole item
+    explicit ItemFingerprint(const std::array<quint64, ColumnCount> &columnFingerprints)
+        : columns(columnFingerprints)
     {
-        if (m_firstChangedRow == -1)
-            return;
+        for (quint64 column : columns)
+            row = combineFingerprint(row, column);
+    }
 
-        // reconstruct vector of changed roles
-        QVector<int> roles;
-        roles.reserve(m_changedRoles.count());
-#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-        for (int role : std::as_const(m_changedRoles))
-#else
-        for (int role : qAsConst(m_changedRoles))
-#endif
+    quint64 row = 0;
+    std::array<quint64, ColumnCount> columns = {};
+};
+
+// actual class to inherit from
+template<QAIM BaseModel, typename DataType>
+class UpdateableModel : public BaseModel
+{
+    // can't use Q_OBJECT on templates
+
+public:
+    explicit UpdateableModel(QObject *parent = nullptr)
+        : BaseModel(parent)
+    {
+    }
+
+protected: // types
+    struct Operations
+    {
+        uint inserts;
+        uint removals;
+        uint updates;
+        uint moves;
+    };
+
+    /**
+     * A set of columns or roles. Columns and roles below 64, and roles in the 64 from Qt::UserRole
+     * on, are kept in bit masks, so that building, comparing and merging the changes of an item
+     * does not allocate. Other values are kept in a sorted vector.
+     *
+     * It can be filled like the QVector<int> it replaces, through append(), an initializer list
+     * or any container of ints, and read like it through contains(), size(), iteration in
+     * ascending order, or toVector().
+     */
+    class IndexSet
+    {
+    public:
+        class const_iterator
         {
-            roles.append(role);
-        }
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = int;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const int *;
+            using reference = int;
+
+            const_iterator() = default;
 
-        // convert the vector of ints indicating changed columns into a vector of pairs of ints indicating ranges.
-        // for example, the vector {1, 2, 3, 5, 6, 9} would be converted to {{1, 3}, {5, 6}, {9, 9}}
-        typedef QVector<QPair<int, int>> ColumnRanges;
-        auto accumulator = [](ColumnRanges ranges, int column) {
-            if (ranges.isEmpty() || (ranges.last().second < column - 1))
+            int operator*() const { return m_value; }
+
+            const_iterator &operator++()
             {
-                ranges.append(qMakePair(column, column));
+                m_atEnd = !m_set->firstAfter(m_value, m_value);
+                return *this;
             }
-            else
+
+            const_iterator operator++(int)
             {
-                ranges[ranges.count() - 1].second = column;
+                const_iterator previous = *this;
+                ++*this;
+                return previous;
             }
-            return ranges;
-        };
-        const auto ranges =
-            std::accumulate(m_changedColumns.cbegin(), m_changedColumns.cend(), ColumnRanges(), accumulator);
 
-        for (const auto &columnRange : ranges)
-        {
-            QModelIndex topLeft = BaseModel::index(m_firstChangedRow, columnRange.first);
-            QModelIndex bottomRight = BaseModel::index(m_lastChangedRow, columnRange.second);
-            Q_EMIT BaseModel::dataChanged(topLeft, bottomRight, roles);
-        }
+            friend bool operator==(const const_iterator &lhs, const const_iterator &rhs)
+            {
+                return lhs.m_atEnd == rhs.m_atEnd && (lhs.m_atEnd || lhs.m_value == rhs.m_value);
+            }
+            friend bool operator!=(const const_iterator &lhs, const const_iterator &rhs) { return !(lhs == rhs); }
 
-        m_firstChangedRow = -1;
-    }
+        private:
+            friend class IndexSet;
 
-    void addChange(int row, const QVector<int> &columns, const QVector<int> &roles)
-    {
-        auto mergeColumns = [this](const QVector<int> &columns) {
-            QVector<int> columnUnion;
-            // we have to cast this to QAbstractItemModel, to work around QAbstractListModel making columnCount private
-            columnUnion.reserve(static_cast<QAbstractItemModel *>(this)->columnCount());
-            auto inserter = std::back_inserter(columnUnion);
-            std::set_union(m_changedColumns.cbegin(), m_changedColumns.cend(), columns.cbegin(), columns.cend(),
-                           inserter);
-            m_changedColumns = std::move(columnUnion);
+            const IndexSet *m_set = nullptr;
+            int m_value = 0;
+            bool m_atEnd = true;
         };
+        using iterator = const_iterator;
 
-        if (m_firstChangedRow > -1)
+        IndexSet() = default;
+
+        IndexSet(std::initializer_list<int> values)
         {
-            // from here rows are guaranteed to be sequential, so no need to check for that
-            m_lastChangedRow = row; // optimistic, but lets see...
+            for (int value : values)
+                insert(value);
+        }
 
-            switch (m_changeMergePolicy)
+        template<Container C, typename = decltype(std::begin(std::declval<const C &>()))>
+        IndexSet(const C &values)
+        {
+            for (int value : values)
+                insert(value);
+        }
+
+        void insert(int value)
+        {
+            if (quint64 *mask = maskFor(value))
             {
-            case AlwaysMergeNeighbouringRows:
-                m_changedRoles = m_changedRoles.intersect(setFromContainer(roles));
-                mergeColumns(columns);
+                *mask |= bitFor(value);
                 return;
-            case MergeWhenColumnsMatch:
-                if (m_changedColumns == columns)
-                {
-                    m_changedRoles = m_changedRoles.intersect(setFromContainer(roles));
-                    return;
-                }
-                break;
-            case MergeWhenRolesMatch:
-                if (m_changedRoles == setFromContainer(roles))
-                {
-                    mergeColumns(columns);
-                    return;
-                }
-                break;
-            case MergeOnPerfectMatch:
-                if (m_changedColumns == columns && m_changedRoles == setFromContainer(roles))
+            }
+            const auto it = std::lower_bound(m_others.begin(), m_others.end(), value);
+            if (it == m_others.end() || *it != value)
+                m_others.insert(it, value);
+        }
+
+        void append(int value) { insert(value); }
+
+        bool contains(int value) const
+        {
+            if (const quint64 *mask = maskFor(value))
+                return *mask & bitFor(value);
+            return std::binary_search(m_others.cbegin(), m_others.cend(), value);
+        }
+
+        bool isEmpty() const { return !m_lowMask && !m_userMask && m_others.empty(); }
+
+        int count() const
+        {
+            return int(qPopulationCount(m_lowMask) + qPopulationCount(m_userMask)) + int(m_others.size());
+        }
+
+        int size() const { return count(); }
+
+        const_iterator begin() const
+        {
+            const_iterator it;
+            it.m_set = this;
+            it.m_atEnd = !firstAfter(std::numeric_limits<qint64>::min(), it.m_value);
+            return it;
+        }
+
+        const_iterator end() const { return {}; }
+
+        QVector<int> toVector() const
+        {
+            QVector<int> values;
+            values.reserve(count());
+            forEach([&values](int value) { values.append(value); });
+            return values;
+        }
+
+        // calls @p function with every value, in ascending order
+        template<typename Function>
+        void forEach(Function function) const
+        {
+            auto other = m_others.cbegin();
+            const auto othersBelow = [this, &other, &function](int limit) {
+                for (; other != m_others.cend() && *other < limit; ++other)
+                    function(*other);
+            };
+            othersBelow(0);
+            forEachBit(m_lowMask, 0, function);
+            othersBelow(Qt::UserRole);
+            forEachBit(m_userMask, Qt::UserRole, function);
+            othersBelow(std::numeric_limits<int>::max());
+            if (other != m_others.cend())
+                function(*other);
+        }
+
+        IndexSet &operator|=(const IndexSet &other)
+        {
+            m_lowMask |= other.m_lowMask;
+            m_userMask |= other.m_userMask;
+            if (!other.m_others.empty())
+            {
+                std::vector<int> others;
+                std::set_union(m_others.cbegin(), m_others.cend(), other.m_others.cbegin(), other.m_others.cend(),
+                               std::back_inserter(others));
+                m_others = std::move(others);
+            }
+            return *this;
+        }
+
+        IndexSet &operator&=(const IndexSet &other)
+        {
+            m_lowMask &= other.m_lowMask;
+            m_userMask &= other.m_userMask;
+            const auto notInOther = [&other](int value) {
+                return !std::binary_search(other.m_others.cbegin(), other.m_others.cend(), value);
+            };
+            m_others.erase(std::remove_if(m_others.begin(), m_others.end(), notInOther), m_others.end());
+            return *this;
+        }
+
+        friend bool operator==(const IndexSet &lhs, const IndexSet &rhs)
+        {
+            return lhs.m_lowMask == rhs.m_lowMask && lhs.m_userMask == rhs.m_userMask && lhs.m_others == rhs.m_others;
+        }
+        friend bool operator!=(const IndexSet &lhs, const IndexSet &rhs) { return !(lhs == rhs); }
+
+    private:
+        static constexpr int MaskSize = 64;
+
+        quint64 *maskFor(int value)
+        {
+            return const_cast<quint64 *>(static_cast<const IndexSet *>(this)->maskFor(value));
+        }
+
+        const quint64 *maskFor(int value) const
+        {
+            if (value >= 0 && value < MaskSize)
+                return &m_lowMask;
+            if (value >= Qt::UserRole && value < Qt::UserRole + MaskSize)
+                return &m_userMask;
+            return nullptr;
+        }
+
+        static quint64 bitFor(int value) { return quint64(1) << (value % MaskSize); }
+
+        // finds the smallest value above @p after, for iterating in ascending order
+        bool firstAfter(qint64 after, int &value) const
+        {
+            qint64 found = std::numeric_limits<qint64>::max();
+            const auto inMask = [after, &found](quint64 mask, int offset) {
+                if (after >= offset + MaskSize - 1)
+                    return;
+                if (after >= offset)
+                    mask &= ~quint64(0) << (after - offset + 1);
+                if (mask)
+                    found = std::min(found, qint64(offset) + qCountTrailingZeroBits(mask));
+            };
+            inMask(m_lowMask, 0);
+            inMask(m_userMask, Qt::UserRole);
+            const auto other = std::upper_bound(m_others.cbegin(), m_others.cend(), after,
+                                                [](qint64 limit, int value) { return limit < value; });
+            if (other != m_others.cend())
+                found = std::min(found, qint64(*other));
+
+            if (found == std::numeric_limits<qint64>::max())
+                return false;
+            value = int(found);
+            return true;
+        }
+
+        template<typename Function>
+        static void forEachBit(quint64 mask, int offset, Function &function)
+        {
+            while (mask)
+            {
+                function(offset + int(qCountTrailingZeroBits(mask)));
+                mask &= mask - 1;
+            }
+        }
+
+        quint64 m_lowMask = 0;
+        quint64 m_userMask = 0;
+        std::vector<int> m_others;
+    };
+
+    struct DataChanges
+    {
+        operator bool() const { return !changedColumns.isEmpty(); }
+        IndexSet changedColumns;
+        IndexSet changedRoles;
+    };
+
+    enum ChangeMergePolicy
+    {
+        AlwaysMergeNeighbouringRows,
+        MergeWhenColumnsMatch,
+        MergeWhenRolesMatch,
+        MergeOnPerfectMatch
+    };
+
+    enum ApplyPolicy
+    {
+        AlwaysEditInPlace, ///< insert into and remove from the container run by run, with row signals for each
+        RebuildAboveThreshold ///< rebuild the container in one pass if an update has more runs than the threshold
+    };
+
+    using HasChangesFunction = std::function<DataChanges(const DataType & /*lhs*/, const DataType & /*rhs*/)>;
+
+    /**
+     * A single step of an UpdateScript. Rows refer to the container as it is after the steps before.
+     */
+    struct Edit
+    {
+        enum Type
+        {
+            Insert, ///< insert count items, starting at item, before row
+            Remove, ///< remove count rows starting at row
+            Move, ///< move count rows starting at row to before destinationRow
+            Change ///< replace the item on row by item, with the given changes
+        };
+
+        Type type;
+        int row;
+        int count;
+        int destinationRow;
+        int item; // index into UpdateScript::items
+        DataChanges changes;
+    };
+
+    /**
+     * The steps that turn the data of a model into new data, as computed by computeUpdate or
+     * computeUpdateByKey. It holds copies of the new and changed items, so it does not refer to
+     * the new data after it has been computed.
+     */
+    struct UpdateScript
+    {
+        int rowCount = 0; // the number of rows the script starts from
+        std::vector<Edit> edits;
+        std::vector<DataType> items;
+    };
+
+protected: // methods
+    void setChangeMergePolicy(ChangeMergePolicy policy) { m_changeMergePolicy = policy; }
+
+    ChangeMergePolicy changeMergePolicy() const { return m_changeMergePolicy; }
+
+    /**
+     * Sets how updates are applied to the container. Inserting or removing a run of rows moves all
+     * the rows after it, so an update with many runs scattered over a large container is quadratic.
+     * With RebuildAboveThreshold, sorted updates with more runs of inserted or removed rows than
+     * rebuildThreshold() are instead applied by building a new container in a single pass, and
+     * swapping it in. Such an update is signalled as a layout change, with the persistent indexes of
+     * removed rows invalidated, followed by the data changes. The default is AlwaysEditInPlace.
+     *
+     * Views see a layout change across which the row count changes, which
+     * QAbstractItemModel does not foresee: views and proxy models that only re-read the order of the
+     * rows they know about on layoutChanged get out of sync. Rebuilding remaps the persistent
+     * indexes of the top level rows only, so it is for flat models, and asserts that there are no
+     * persistent indexes with a parent.
+     *
+     * Keyed updates that move more rows than rebuildThreshold() reorder the container in a single
+     * pass instead of moving the rows one run at a time, signalled as a layout change, and then
+     * insert and change rows in place, so the row count stays the same across that layout change.
+     * updateTree always edits the container in place, regardless of the apply policy.
+     */
+    void setApplyPolicy(ApplyPolicy policy) { m_applyPolicy = policy; }
+
+    ApplyPolicy applyPolicy() const { return m_applyPolicy; }
+
+    /**
+     * Sets the number of runs of inserted or removed rows above which an update rebuilds the
+     * container, and the number of moved rows above which a keyed update reorders it, if the apply
+     * policy is RebuildAboveThreshold. The default is 1000.
+     */
+    void setRebuildThreshold(int runs) { m_rebuildThreshold = runs; }
+
+    int rebuildThreshold() const { return m_rebuildThreshold; }
+
+    /**
+     * Sets whether to check the items for changes on multiple threads. If itemHasChanged is
+     * expensive, for example because it compares many fields, it dominates an update. With parallel
+     * change detection, updates that keep at least parallelChangeDetectionThreshold() items first
+     * pair up the old and new items, using lessThan or the key, then compare all pairs in chunks on
+     * the threads of the global thread pool, and only then apply the update. itemHasChanged, or the
+     * function passed instead, must be safe to call from multiple threads at once.
+     */
+    void setParallelChangeDetection(bool enabled) { m_parallelChangeDetection = enabled; }
+
+    bool parallelChangeDetection() const { return m_parallelChangeDetection; }
+
+    /**
+     * Sets the number of items an update must keep to check them for changes on multiple threads,
+     * if parallel change detection is enabled. The default is 10000.
+     */
+    void setParallelChangeDetectionThreshold(int items) { m_parallelChangeDetectionThreshold = items; }
+
+    int parallelChangeDetectionThreshold() const { return m_parallelChangeDetectionThreshold; }
+
+    virtual bool lessThan(const DataType &lhs, const DataType &rhs) const { return dataLessThan(lhs, rhs); }
+
+    virtual DataChanges itemHasChanged(const DataType &lhs, const DataType &rhs) const
+    {
+        Q_UNUSED(lhs);
+        Q_UNUSED(rhs);
+
+        return {};
+    }
+
+    /**
+     * Returns the changes between two items with the fingerprints @p lhs and @p rhs: none if the
+     * fingerprints of the items are equal, and otherwise the columns whose fingerprints differ, with
+     * @p roles as the changed roles. Empty roles stand for all roles, like in dataChanged.
+     *
+     * This is meant to be returned by itemHasChanged, so unchanged items cost a single comparison.
+     */
+    template<int ColumnCount>
+    static DataChanges fingerprintChanges(const ItemFingerprint<ColumnCount> &lhs,
+                                          const ItemFingerprint<ColumnCount> &rhs, const IndexSet &roles = {})
+    {
+        DataChanges changes;
+        if (lhs.row == rhs.row)
+            return changes;
+
+        for (int column = 0; column < ColumnCount; ++column)
+        {
+            if (lhs.columns[column] != rhs.columns[column])
+                changes.changedColumns.insert(column);
+        }
+        if (!changes.changedColumns.isEmpty())
+            changes.changedRoles = roles;
+        return changes;
+    }
+
+    /**
+     * Returns a function that can be passed to updateData and updateDataByKey to compare the items
+     * by their fingerprint member @p fingerprint, see fingerprintChanges.
+     */
+    template<int ColumnCount>
+    static auto changesByFingerprint(ItemFingerprint<ColumnCount> DataType::*fingerprint, const IndexSet &roles = {})
+    {
+        return [fingerprint, roles](const DataType &lhs, const DataType &rhs) {
+            return fingerprintChanges(lhs.*fingerprint, rhs.*fingerprint, roles);
+        };
+    }
+
+    // itemHasChanged may be any callable with the signature of HasChangesFunction. Passing a lambda
+    //   rather than a std::function allows it to be inlined into updateCollection.
+    template<ForwardIt Iterator, Container DataContainer, BinaryPredicate LessThan, BinaryPredicate HasChanged>
+    Operations updateData(Iterator srcBegin, Iterator srcEnd, DataContainer &targetContainer, LessThan lessThan,
+                          HasChanged itemHasChanged)
+    {
+        if (usesParallelChangeDetection(srcBegin, srcEnd, targetContainer))
+        {
+            const auto pairs = alignSorted(srcBegin, srcEnd, targetContainer, lessThan);
+            if (static_cast<int>(pairs.size()) >= m_parallelChangeDetectionThreshold)
+            {
+                std::vector<DataChanges> changes = detectChangesConcurrently(pairs, itemHasChanged);
+                std::size_t next = 0;
+                auto precomputedChanges = [&changes, &next](const DataType &, const DataType &) -> DataChanges {
+                    return std::move(changes[next++]);
+                };
+                return updateSorted(srcBegin, srcEnd, targetContainer, lessThan, precomputedChanges);
+            }
+        }
+
+        return updateSorted(srcBegin, srcEnd, targetContainer, lessThan, itemHasChanged);
+    }
+
+    template<ForwardIt Iterator, Container Data>
+    Operations updateData(Iterator srcBegin, Iterator srcEnd, Data &targetContainer, HasChangesFunction hasChanged = {})
+    {
+        auto lessThanFunction = [this](const DataType &lhs, const DataType &rhs) { return this->lessThan(lhs, rhs); };
+        if (!hasChanged)
+        {
+            hasChanged = [this](const DataType &lhs, const DataType &rhs) -> DataChanges {
+                return this->itemHasChanged(lhs, rhs);
+            };
+        }
+
+        return updateData(srcBegin, srcEnd, targetContainer, lessThanFunction, hasChanged);
+    }
+
+    /**
+     * Updates the model to contain the items in [srcBegin, srcEnd), in that order, identifying
+     * items by the key @p key returns for them rather than by their order.
+     *
+     * Unlike updateData, neither the new data nor the container need to be sorted. Items are looked
+     * up in a QHash, and which items move is decided in O(n log n) steps. Items that changed
+     * position are moved with row move signals instead of being removed and inserted again, so
+     * selections and persistent indexes follow them. Only the items that are not on the longest run
+     * of items that kept their relative order are moved, and finding the rows of every move takes
+     * O(log n) steps. Every move still shifts the rows between its source and its destination in
+     * the container, so data that reorders most items, like reversing them, takes quadratic time
+     * to apply in place. With RebuildAboveThreshold, an update that moves more rows than
+     * rebuildThreshold() instead puts all of them in their new order in a single pass, signalled
+     * as a layout change that keeps the row count, see setApplyPolicy.
+     *
+     * The keys need to be unique, and usable as a QHash key. The container needs to be a random
+     * access container.
+     */
+    template<ForwardIt Iterator, Container DataContainer, typename KeyFunction>
+    Operations updateDataByKey(Iterator srcBegin, Iterator srcEnd, DataContainer &targetContainer, KeyFunction key,
+                               HasChangesFunction itemHasChanged = {})
+    {
+        Operations ops{0, 0, 0, 0};
+        if (!itemHasChanged)
+        {
+            itemHasChanged = [this](const DataType &lhs, const DataType &rhs) -> DataChanges {
+                return this->itemHasChanged(lhs, rhs);
+            };
+        }
+
+        std::vector<DataChanges> changes;
+        std::size_t nextChanges = 0;
+        if (usesParallelChangeDetection(srcBegin, srcEnd, targetContainer))
+        {
+            const auto pairs = alignByKey(srcBegin, srcEnd, targetContainer, key);
+            if (static_cast<int>(pairs.size()) >= m_parallelChangeDetectionThreshold)
+            {
+                // updateCollectionByKey checks the items in the order of src, as alignByKey lists them
+                changes = detectChangesConcurrently(pairs, itemHasChanged);
+                itemHasChanged = [&changes, &nextChanges](const DataType &, const DataType &) -> DataChanges {
+                    return std::move(changes[nextChanges++]);
+                };
+            }
+        }
+
+        // events
+        auto onChanged = [this, &targetContainer, &ops](Iterator lhs, typename DataContainer::iterator rhs,
+                                                        const DataChanges &changes) {
+            changeItem(targetContainer, lhs, rhs, changes, ops);
+        };
+
+        auto onInsert = [this, &targetContainer, &ops](Iterator lhsBegin, Iterator lhsEnd,
+                                                       typename DataContainer::iterator rhsInsertAt) {
+            return insertItems(targetContainer, lhsBegin, lhsEnd, rhsInsertAt, ops);
+        };
+
+        auto onRemove = [this, &targetContainer, &ops](typename DataContainer::iterator rhsBegin,
+                                                       typename DataContainer::iterator rhsEnd) {
+            return removeItems(targetContainer, rhsBegin, rhsEnd, ops);
+        };
+
+        auto onMove = [this, &targetContainer, &ops](int firstRow, int lastRow, int destinationRow) {
+            moveItems(targetContainer, firstRow, lastRow, destinationRow, ops);
+        };
+
+        auto onEqual = [this](Iterator /*lhs*/, typename DataContainer::iterator /*rhs*/) { flushCachedChanges(); };
+
+        auto onReorder = [this, &targetContainer, &ops](const std::vector<int> &newOrder) {
+            reorderItems(targetContainer, newOrder, ops);
+        };
+
+        const int maxMovedRows =
+            rebuildsAboveThreshold() ? m_rebuildThreshold : std::numeric_limits<int>::max();
+        updateCollectionByKey(srcBegin, srcEnd, targetContainer, key, itemHasChanged, onChanged, onInsert, onRemove,
+                              onMove, onEqual, onReorder, maxMovedRows);
+        flushCachedChanges();
+
+        return ops;
+    }
+
+    using SubtreeFingerprintFunction = std::function<quint64(const DataType & /*item*/)>;
+    using AssignItemFunction = std::function<void(DataType & /*target*/, const DataType & /*source*/)>;
+
+    /**
+     * Updates a tree model, whose top level items are in @p targetContainer, to the items in
+     * [srcBegin, srcEnd) and their children, without resetting it. The items on every level are
+     * updated like updateData does, so they need to be sorted with respect to lessThan, and the rows
+     * are inserted, removed and changed below their own parent. The children of items that are in
+     * both are updated recursively; new items are inserted with all their children.
+     *
+     * @p children returns the container with the children of an item, for both const and non-const
+     * items, for example [](auto &item) -> auto & { return item.children; }.
+     *
+     * If @p subtreeFingerprint is set, items whose fingerprint did not change are assumed to be
+     * equal, including all their children, so neither are compared. Compute the fingerprint of an
+     * item when the data is produced, from its own fields and the fingerprints of its children.
+     *
+     * The children of a changed item are updated recursively, so only its own fields need to be
+     * copied. If @p assignItem is set, it is called with the item in the container and the new
+     * item to copy all fields except the children. Otherwise the whole new item is assigned,
+     * copying its children as well, and the updated children are put back afterwards.
+     *
+     * The model needs to be able to create indexes for the data in the containers at any time
+     * during the update, for example by storing a unique id of the item in the indexes. The rows are
+     * always edited in place, the apply policy does not apply to tree updates.
+     */
+    template<ForwardIt Iterator, Container DataContainer, typename ChildrenFunction>
+    Operations updateTree(Iterator srcBegin, Iterator srcEnd, DataContainer &targetContainer, ChildrenFunction children,
+                          SubtreeFingerprintFunction subtreeFingerprint = {}, AssignItemFunction assignItem = {},
+                          const QModelIndex &parent = QModelIndex())
+    {
+        Operations ops{0, 0, 0, 0};
+        const QModelIndex previousParent = m_updateParent;
+        m_updateParent = parent;
+        const bool wasUpdatingTree = m_updatingTree;
+        m_updatingTree = true;
+
+        auto isSameSubtree = [&subtreeFingerprint](const DataType &lhs, const DataType &rhs) {
+            return subtreeFingerprint && subtreeFingerprint(lhs) == subtreeFingerprint(rhs);
+        };
+
+        auto updateChildren = [&](Iterator lhs, typename DataContainer::iterator rhs) {
+            if (isSameSubtree(*lhs, *rhs))
+                return;
+
+            // the changes collected so far are below this parent, not below the item
+            flushCachedChanges();
+            const int row = static_cast<int>(std::distance(std::begin(targetContainer), rhs));
+            auto &srcChildren = children(*lhs);
+            const Operations childOps = updateTree(std::begin(srcChildren), std::end(srcChildren), children(*rhs),
+                                                   children, subtreeFingerprint, assignItem,
+                                                   this->index(row, 0, parent));
+            ops.inserts += childOps.inserts;
+            ops.removals += childOps.removals;
+            ops.updates += childOps.updates;
+            ops.moves += childOps.moves;
+        };
+
+        // events
+        auto hasChanged = [this, &isSameSubtree](const DataType &lhs, const DataType &rhs) -> DataChanges {
+            return isSameSubtree(lhs, rhs) ? DataChanges() : this->itemHasChanged(lhs, rhs);
+        };
+
+        auto lessThan = [this](const DataType &lhs, const DataType &rhs) { return this->lessThan(lhs, rhs); };
+
+        auto onChanged = [this, &targetContainer, &ops, &children, &updateChildren, &assignItem](
+                             Iterator lhs, typename DataContainer::iterator rhs, const DataChanges &changes) {
+            updateChildren(lhs, rhs);
+            if (assignItem)
+            {
+                assignItem(*rhs, *lhs);
+                markChanged(targetContainer, rhs, changes, ops);
+                return;
+            }
+            // the children are equal afterwards, keep them instead of replacing them by a copy
+            auto updatedChildren = std::move(children(*rhs));
+            changeItem(targetContainer, lhs, rhs, changes, ops);
+            using std::swap;
+            swap(children(*rhs), updatedChildren);
+        };
+
+        auto onInsert = [this, &targetContainer, &ops](Iterator lhsBegin, Iterator lhsEnd,
+                                                       typename DataContainer::iterator rhsInsertAt) {
+            return insertItems(targetContainer, lhsBegin, lhsEnd, rhsInsertAt, ops);
+        };
+
+        auto onRemove = [this, &targetContainer, &ops](typename DataContainer::iterator rhsBegin,
+                                                       typename DataContainer::iterator rhsEnd) {
+            return removeItems(targetContainer, rhsBegin, rhsEnd, ops);
+        };
+
+        auto onEqual = [this, &updateChildren](Iterator lhs, typename DataContainer::iterator rhs) {
+            flushCachedChanges();
+            updateChildren(lhs, rhs);
+        };
+
+        updateCollection(srcBegin, srcEnd, targetContainer, lessThan, hasChanged, onChanged, onInsert, onRemove,
+                         onEqual);
+        flushCachedChanges();
+
+        m_updateParent = previousParent;
+        m_updatingTree = wasUpdatingTree;
+        return ops;
+    }
+
+    /**
+     * Computes the steps updateData would take to turn the data in @p currentContainer into the data
+     * in [srcBegin, srcEnd), without modifying anything or emitting any signals. Apply them with
+     * applyUpdate.
+     *
+     * This does not touch the model, so it can run on a worker thread, as long as
+     * @p currentContainer is not modified at the same time and @p lessThan and @p itemHasChanged
+     * are safe to call from there. Only applyUpdate has to run on the thread of the model.
+     */
+    template<ForwardIt Iterator, Container DataContainer, BinaryPredicate LessThan, BinaryPredicate HasChanged>
+    static UpdateScript computeUpdate(Iterator srcBegin, Iterator srcEnd, const DataContainer &currentContainer,
+                                      LessThan lessThan, HasChanged itemHasChanged)
+    {
+        using TargetIterator = typename DataContainer::const_iterator;
+        UpdateScript script;
+        script.rowCount = static_cast<int>(currentContainer.size());
+        SortedScriptRecorder<Iterator, TargetIterator> recorder{script, std::cbegin(currentContainer)};
+
+        // events
+        auto onChanged = [&recorder](Iterator lhs, TargetIterator rhs, const DataChanges &changes) {
+            recorder.changed(lhs, rhs, changes);
+        };
+        auto onInsert = [&recorder](Iterator lhsBegin, Iterator lhsEnd, TargetIterator rhsInsertAt) {
+            return recorder.inserted(lhsBegin, lhsEnd, rhsInsertAt);
+        };
+        auto onRemove = [&recorder](TargetIterator rhsBegin, TargetIterator rhsEnd) {
+            return recorder.removed(rhsBegin, rhsEnd);
+        };
+        auto onEqual = [](Iterator /*lhs*/, TargetIterator /*rhs*/) {};
+
+        // the script is all that changes, so this takes a single pass over both
+        ReadOnlyCollection<DataContainer> current{currentContainer};
+        updateCollection(srcBegin, srcEnd, current, lessThan, itemHasChanged, onChanged, onInsert, onRemove, onEqual);
+        return script;
+    }
+
+    /**
+     * Like computeUpdate, using lessThan and itemHasChanged, so those must be safe to call from the
+     * thread this is called from.
+     */
+    template<ForwardIt Iterator, Container DataContainer>
+    UpdateScript computeUpdate(Iterator srcBegin, Iterator srcEnd, const DataContainer &currentContainer,
+                               HasChangesFunction hasChanged = {}) const
+    {
+        auto lessThanFunction = [this](const DataType &lhs, const DataType &rhs) { return this->lessThan(lhs, rhs); };
+        if (!hasChanged)
+        {
+            hasChanged = [this](const DataType &lhs, const DataType &rhs) -> DataChanges {
+                return this->itemHasChanged(lhs, rhs);
+            };
+        }
+
+        return computeUpdate(srcBegin, srcEnd, currentContainer, lessThanFunction, hasChanged);
+    }
+
+    /**
+     * Computes the steps updateDataByKey would take, like computeUpdate does for updateData.
+     */
+    template<ForwardIt Iterator, Container DataContainer, typename KeyFunction>
+    UpdateScript computeUpdateByKey(Iterator srcBegin, Iterator srcEnd, const DataContainer &currentContainer,
+                                    KeyFunction key, HasChangesFunction itemHasChanged = {}) const
+    {
+        if (!itemHasChanged)
+        {
+            itemHasChanged = [this](const DataType &lhs, const DataType &rhs) -> DataChanges {
+                return this->itemHasChanged(lhs, rhs);
+            };
+        }
+
+        using WorkingIterator = typename std::vector<DataType>::iterator;
+        UpdateScript script;
+        std::vector<DataType> working(std::begin(currentContainer), std::end(currentContainer));
+        script.rowCount = static_cast<int>(working.size());
+        ScriptRecorder<Iterator> recorder{script, working};
+
+        // events
+        auto onChanged = [&recorder](Iterator lhs, WorkingIterator rhs, const DataChanges &changes) {
+            recorder.changed(lhs, rhs, changes);
+        };
+        auto onInsert = [&recorder](Iterator lhsBegin, Iterator lhsEnd, WorkingIterator rhsInsertAt) {
+            return recorder.inserted(lhsBegin, lhsEnd, rhsInsertAt);
+        };
+        auto onRemove = [&recorder](WorkingIterator rhsBegin, WorkingIterator rhsEnd) {
+            return recorder.removed(rhsBegin, rhsEnd);
+        };
+        auto onMove = [&recorder](int firstRow, int lastRow, int destinationRow) {
+            recorder.moved(firstRow, lastRow, destinationRow);
+        };
+        auto onEqual = [](Iterator /*lhs*/, WorkingIterator /*rhs*/) {};
+
+        updateCollectionByKey(srcBegin, srcEnd, working, key, itemHasChanged, onChanged, onInsert, onRemove, onMove,
+                              onEqual);
+        return script;
+    }
+
+    /**
+     * Applies @p script, computed by computeUpdate or computeUpdateByKey, to @p targetContainer and
+     * emits the same signals updateData would. @p targetContainer must still hold the data the
+     * script was computed from.
+     *
+     * Depending on the apply policy, the container may be rebuilt instead, see setApplyPolicy.
+     */
+    template<Container DataContainer>
+    Operations applyUpdate(const UpdateScript &script, DataContainer &targetContainer)
+    {
+        Q_ASSERT_X(static_cast<int>(targetContainer.size()) == script.rowCount, "applyUpdate",
+                   "the data changed since the script was computed");
+        if (shouldRebuild(script))
+            return rebuildContainer(script, targetContainer);
+
+        Operations ops{0, 0, 0, 0};
+
+        for (const Edit &edit : script.edits)
+            applyEdit(script, edit, edit.count, targetContainer, ops);
+        flushCachedChanges();
+
+        return ops;
+    }
+
+    /**
+     * Updates the model to the data in [srcBegin, srcEnd) like updateData does, but spreads the
+     * inserts, removals and changes over as many event loop iterations as needed to spend at most
+     * about @p budget milliseconds in each, so views can still paint in between. Large inserts and
+     * removals are split up. The model and @p targetContainer are consistent between the slices,
+     * they just do not show all of the new data yet.
+     *
+     * The update starts in the next event loop iteration. If this is called again before the
+     * previous update has been applied, the rest of the previous update is dropped and the model
+     * is updated from its current state to the newest data instead, so a burst of snapshots does
+     * not have to be applied one after the other.
+     *
+     * The differences are computed on the GUI thread at the start of the first slice, which can
+     * exceed the budget for large data. To avoid that, compute the script on a worker thread with
+     * computeUpdate and pass it to applyUpdateInSlices instead.
+     *
+     * @p targetContainer must stay alive and must not be modified otherwise until hasPendingUpdate
+     * returns false.
+     */
+    template<ForwardIt Iterator, Container DataContainer>
+    void updateDataInSlices(Iterator srcBegin, Iterator srcEnd, DataContainer &targetContainer,
+                            int budget = DefaultSliceBudget)
+    {
+        m_slicedSnapshot.assign(srcBegin, srcEnd);
+        m_computeSlicedScript = [this, &targetContainer]() {
+            return computeUpdate(m_slicedSnapshot.cbegin(), m_slicedSnapshot.cend(), targetContainer);
+        };
+        scheduleSlice(targetContainer, budget);
+    }
+
+    /**
+     * Updates the model like updateDataByKey, in slices like updateDataInSlices does.
+     */
+    template<ForwardIt Iterator, Container DataContainer, typename KeyFunction>
+    void updateDataByKeyInSlices(Iterator srcBegin, Iterator srcEnd, DataContainer &targetContainer, KeyFunction key,
+                                 int budget = DefaultSliceBudget)
+    {
+        m_slicedSnapshot.assign(srcBegin, srcEnd);
+        m_computeSlicedScript = [this, &targetContainer, key]() {
+            return computeUpdateByKey(m_slicedSnapshot.cbegin(), m_slicedSnapshot.cend(), targetContainer, key);
+        };
+        scheduleSlice(targetContainer, budget);
+    }
+
+    /**
+     * Applies @p script, computed by computeUpdate or computeUpdateByKey, in slices like
+     * updateDataInSlices does, without computing anything on the thread of the model. Every slice
+     * only replays the steps of the script that fit in @p budget milliseconds, and the rest of any
+     * previous sliced update is dropped. @p targetContainer must hold the data the script was
+     * computed from when this is called.
+     */
+    template<Container DataContainer>
+    void applyUpdateInSlices(UpdateScript script, DataContainer &targetContainer, int budget = DefaultSliceBudget)
+    {
+        Q_ASSERT_X(static_cast<int>(targetContainer.size()) == script.rowCount, "applyUpdateInSlices",
+                   "the data changed since the script was computed");
+        m_computeSlicedScript = nullptr;
+        m_slicedSnapshot.clear();
+        m_slicedScript = std::move(script);
+        m_nextSlicedEdit = 0;
+        scheduleSlice(targetContainer, budget);
+    }
+
+    /**
+     * Returns whether updateDataInSlices, updateDataByKeyInSlices or applyUpdateInSlices has not
+     * finished updating the model yet.
+     */
+    bool hasPendingUpdate() const { return m_computeSlicedScript || m_nextSlicedEdit < m_slicedScript.edits.size(); }
+
+protected:
+    // Shadowing the methods in the base model, because MSVC thinks the onRemove and onInsert
+    // lambdas in updateData are not allowed to access the protected member functions in BaseClass.
+    // GCC is ok with it...
+    void beginInsertRows(int firstRow, int lastRow) { BaseModel::beginInsertRows(m_updateParent, firstRow, lastRow); }
+
+    void endInsertRows() { BaseModel::endInsertRows(); }
+
+    void beginRemoveRows(int firstRow, int lastRow) { BaseModel::beginRemoveRows(m_updateParent, firstRow, lastRow); }
+
+    void endRemoveRows() { BaseModel::endRemoveRows(); }
+
+    bool beginMoveRows(int firstRow, int lastRow, int destinationRow)
+    {
+        return BaseModel::beginMoveRows(m_updateParent, firstRow, lastRow, m_updateParent, destinationRow);
+    }
+
+    void endMoveRows() { BaseModel::endMoveRows(); }
+
+private:
+    // records the steps of a sorted update into an UpdateScript, keeping track of how the rows
+    //   shifted instead of modifying the container
+    template<ForwardIt Iterator, typename TargetIterator>
+    struct SortedScriptRecorder
+    {
+        UpdateScript &script;
+        TargetIterator targetBegin;
+        int rowOffset = 0; // the rows inserted minus the rows removed so far
+
+        int rowOf(TargetIterator it) const { return static_cast<int>(std::distance(targetBegin, it)) + rowOffset; }
+
+        int addItems(Iterator begin, Iterator end)
+        {
+            const int item = static_cast<int>(script.items.size());
+            script.items.insert(script.items.end(), begin, end);
+            return item;
+        }
+
+        void changed(Iterator src, TargetIterator target, const DataChanges &changes)
+        {
+            script.edits.push_back({Edit::Change, rowOf(target), 1, -1, addItems(src, std::next(src)), changes});
+        }
+
+        TargetIterator inserted(Iterator begin, Iterator end, TargetIterator insertAt)
+        {
+            const int count = static_cast<int>(std::distance(begin, end));
+            script.edits.push_back({Edit::Insert, rowOf(insertAt), count, -1, addItems(begin, end), {}});
+            rowOffset += count;
+            return insertAt;
+        }
+
+        TargetIterator removed(TargetIterator begin, TargetIterator end)
+        {
+            const int count = static_cast<int>(std::distance(begin, end));
+            script.edits.push_back({Edit::Remove, rowOf(begin), count, -1, -1, {}});
+            rowOffset -= count;
+            return end;
+        }
+    };
+
+    // records the steps of a keyed update into an UpdateScript, while applying the ones that change
+    //   the rows to the copy of the data the algorithms run on
+    template<ForwardIt Iterator>
+    struct ScriptRecorder
+    {
+        using WorkingIterator = typename std::vector<DataType>::iterator;
+
+        UpdateScript &script;
+        std::vector<DataType> &working;
+
+        int rowOf(WorkingIterator it) const { return static_cast<int>(std::distance(working.begin(), it)); }
+
+        int addItems(Iterator begin, Iterator end)
+        {
+            const int item = static_cast<int>(script.items.size());
+            script.items.insert(script.items.end(), begin, end);
+            return item;
+        }
+
+        void changed(Iterator src, WorkingIterator target, const DataChanges &changes)
+        {
+            // the working copy keeps the old item, the algorithms do not look at it again
+            script.edits.push_back({Edit::Change, rowOf(target), 1, -1, addItems(src, std::next(src)), changes});
+        }
+
+        WorkingIterator inserted(Iterator begin, Iterator end, WorkingIterator insertAt)
+        {
+            const int count = static_cast<int>(std::distance(begin, end));
+            script.edits.push_back({Edit::Insert, rowOf(insertAt), count, -1, addItems(begin, end), {}});
+            return insertRange(working, insertAt, begin, end);
+        }
+
+        WorkingIterator removed(WorkingIterator begin, WorkingIterator end)
+        {
+            const int count = static_cast<int>(std::distance(begin, end));
+            script.edits.push_back({Edit::Remove, rowOf(begin), count, -1, -1, {}});
+            return working.erase(begin, end);
+        }
+
+        void moved(int firstRow, int lastRow, int destinationRow)
+        {
+            script.edits.push_back({Edit::Move, firstRow, lastRow - firstRow + 1, destinationRow, -1, {}});
+            moveRange(working, firstRow, lastRow, destinationRow);
+        }
+    };
+
+    // applies @p edit, or only the first @p count rows of it if it is an insert or a removal
+    template<Container DataContainer>
+    void applyEdit(const UpdateScript &script, const Edit &edit, int count, DataContainer &targetContainer,
+                   Operations &ops)
+    {
+        const auto targetBegin = std::begin(targetContainer);
+        const auto items = std::next(script.items.cbegin(), edit.item);
+        switch (edit.type)
+        {
+        case Edit::Insert:
+            insertItems(targetContainer, items, std::next(items, count), std::next(targetBegin, edit.row), ops);
+            break;
+        case Edit::Remove:
+            removeItems(targetContainer, std::next(targetBegin, edit.row), std::next(targetBegin, edit.row + count),
+                        ops);
+            break;
+        case Edit::Move:
+            moveItems(targetContainer, edit.row, edit.row + edit.count - 1, edit.destinationRow, ops);
+            break;
+        case Edit::Change:
+            // the unchanged rows in between are not part of the script
+            if (m_firstChangedRow != -1 && edit.row != m_lastChangedRow + 1)
+                flushCachedChanges();
+            changeItem(targetContainer, items, std::next(targetBegin, edit.row), edit.changes, ops);
+            break;
+        }
+    }
+
+    // updateData, once the changes are detected or known how to detect
+    template<ForwardIt Iterator, Container DataContainer, BinaryPredicate LessThan, BinaryPredicate HasChanged>
+    Operations updateSorted(Iterator srcBegin, Iterator srcEnd, DataContainer &targetContainer, LessThan lessThan,
+                            HasChanged itemHasChanged)
+    {
+        if (rebuildsAboveThreshold() && hasManyRuns(srcBegin, srcEnd, targetContainer, lessThan))
+        {
+            // the edits of a sorted script go from the first row to the last, as rebuildContainer needs
+            return rebuildContainer(computeUpdate(srcBegin, srcEnd, targetContainer, lessThan, itemHasChanged),
+                                    targetContainer);
+        }
+
+        Operations ops{0, 0, 0, 0};
+
+        // events
+        auto onChanged = [this, &targetContainer, &ops](Iterator lhs, typename DataContainer::iterator rhs,
+                                                        const DataChanges &changes) {
+            changeItem(targetContainer, lhs, rhs, changes, ops);
+        };
+
+        auto onInsert = [this, &targetContainer, &ops](Iterator lhsBegin, Iterator lhsEnd,
+                                                       typename DataContainer::iterator rhsInsertAt) {
+            return insertItems(targetContainer, lhsBegin, lhsEnd, rhsInsertAt, ops);
+        };
+
+        auto onRemove = [this, &targetContainer, &ops](typename DataContainer::iterator rhsBegin,
+                                                       typename DataContainer::iterator rhsEnd) {
+            return removeItems(targetContainer, rhsBegin, rhsEnd, ops);
+        };
+
+        auto onEqual = [this](Iterator /*lhs*/, typename DataContainer::iterator /*rhs*/) { flushCachedChanges(); };
+
+        updateCollection(srcBegin, srcEnd, targetContainer, lessThan, itemHasChanged, onChanged, onInsert, onRemove,
+                         onEqual);
+        flushCachedChanges();
+
+        return ops;
+    }
+
+    // whether updateCollection would insert or remove more than m_rebuildThreshold runs of rows.
+    //   Only compares the items, and stops as soon as the threshold is crossed
+    template<ForwardIt Iterator, Container DataContainer, BinaryPredicate LessThan>
+    bool hasManyRuns(Iterator srcBegin, Iterator srcEnd, const DataContainer &targetContainer,
+                     LessThan lessThan) const
+    {
+        int runs = 0;
+        bool inInsertRun = false;
+        bool inRemoveRun = false;
+        auto srcIt = srcBegin;
+        auto targetIt = std::cbegin(targetContainer);
+        const auto targetEnd = std::cend(targetContainer);
+        while (srcIt != srcEnd && targetIt != targetEnd)
+        {
+            const bool inserted = lessThan(*srcIt, *targetIt);
+            const bool removed = !inserted && lessThan(*targetIt, *srcIt);
+            if ((inserted && !inInsertRun) || (removed && !inRemoveRun))
+            {
+                if (++runs > m_rebuildThreshold)
+                    return true;
+            }
+            inInsertRun = inserted;
+            inRemoveRun = removed;
+            if (!removed)
+                ++srcIt;
+            if (!inserted)
+                ++targetIt;
+        }
+        // the rest of src is inserted, or the rest of target removed, in one go
+        if ((srcIt != srcEnd && !inInsertRun) || (targetIt != targetEnd && !inRemoveRun))
+            ++runs;
+        return runs > m_rebuildThreshold;
+    }
+
+    using ItemPairs = std::vector<std::pair<const DataType *, const DataType *>>;
+
+    // the items in [srcBegin, srcEnd) that are in @p targetContainer as well, with their counterpart,
+    //   in the order updateCollection checks them for changes
+    template<ForwardIt Iterator, Container DataContainer, BinaryPredicate LessThan>
+    static ItemPairs alignSorted(Iterator srcBegin, Iterator srcEnd, const DataContainer &targetContainer,
+                                 LessThan lessThan)
+    {
+        ItemPairs pairs;
+        auto srcIt = srcBegin;
+        auto targetIt = std::cbegin(targetContainer);
+        const auto targetEnd = std::cend(targetContainer);
+        while (srcIt != srcEnd && targetIt != targetEnd)
+        {
+            if (lessThan(*srcIt, *targetIt))
+            {
+                ++srcIt;
+            }
+            else if (lessThan(*targetIt, *srcIt))
+            {
+                ++targetIt;
+            }
+            else
+            {
+                pairs.emplace_back(&*srcIt, &*targetIt);
+                ++srcIt;
+                ++targetIt;
+            }
+        }
+        return pairs;
+    }
+
+    // like alignSorted, for updateCollectionByKey
+    template<ForwardIt Iterator, Container DataContainer, typename KeyFunction>
+    static ItemPairs alignByKey(Iterator srcBegin, Iterator srcEnd, const DataContainer &targetContainer,
+                                KeyFunction key)
+    {
+        using Key = std::decay_t<decltype(key(*srcBegin))>;
+        QHash<Key, const DataType *> targetItems;
+        targetItems.reserve(static_cast<int>(targetContainer.size()));
+        for (const DataType &item : targetContainer)
+            targetItems.insert(key(item), &item);
+
+        ItemPairs pairs;
+        for (auto srcIt = srcBegin; srcIt != srcEnd; ++srcIt)
+        {
+            const auto targetItem = targetItems.constFind(key(*srcIt));
+            if (targetItem != targetItems.cend())
+                pairs.emplace_back(&*srcIt, targetItem.value());
+        }
+        return pairs;
+    }
+
+    // whether an update could keep enough items to check them for changes on multiple threads, so
+    //   pairing them up is not wasted on small updates
+    template<ForwardIt Iterator, Container DataContainer>
+    bool usesParallelChangeDetection(Iterator srcBegin, Iterator srcEnd, const DataContainer &targetContainer) const
+    {
+        return m_parallelChangeDetection
+            && static_cast<int>(targetContainer.size()) >= m_parallelChangeDetectionThreshold
+            && std::distance(srcBegin, srcEnd) >= m_parallelChangeDetectionThreshold;
+    }
+
+    // calls @p itemHasChanged for every pair, in chunks on the threads of the global thread pool
+    template<BinaryPredicate HasChanged>
+    static std::vector<DataChanges> detectChangesConcurrently(const ItemPairs &pairs, HasChanged &itemHasChanged)
+    {
+        constexpr int minimumChunkSize = 1024;
+        const int size = static_cast<int>(pairs.size());
+        const int chunkCount =
+            std::max(1, std::min(QThreadPool::globalInstance()->maxThreadCount(), size / minimumChunkSize));
+
+        std::vector<DataChanges> changes(pairs.size());
+        const auto detectChunk = [&pairs, &changes, &itemHasChanged, size, chunkCount](int chunk) {
+            const int end = static_cast<int>(static_cast<qint64>(size) * (chunk + 1) / chunkCount);
+            for (int i = static_cast<int>(static_cast<qint64>(size) * chunk / chunkCount); i < end; ++i)
+                changes[i] = itemHasChanged(*pairs[i].first, *pairs[i].second);
+        };
+        UpdateableModelDetail::runConcurrently(chunkCount, detectChunk);
+        return changes;
+    }
+
+    // whether the apply policy is RebuildAboveThreshold, outside of updateTree, as rebuildContainer
+    //   and reorderItems only remap the persistent indexes of the rows being updated
+    bool rebuildsAboveThreshold() const { return m_applyPolicy == RebuildAboveThreshold && !m_updatingTree; }
+
+    // whether to apply @p script using rebuildContainer, which needs the edits to go from the first
+    //   row to the last, as those of sorted updates do
+    bool shouldRebuild(const UpdateScript &script) const
+    {
+        if (!rebuildsAboveThreshold())
+            return false;
+
+        int runs = 0;
+        int nextRow = 0; // the first row the next edit may touch
+        for (const Edit &edit : script.edits)
+        {
+            if (edit.type == Edit::Move || edit.row < nextRow)
+                return false;
+            if (edit.type != Edit::Change)
+                ++runs;
+            nextRow = edit.row + (edit.type == Edit::Insert ? edit.count : edit.type == Edit::Change ? 1 : 0);
+        }
+        return runs > m_rebuildThreshold;
+    }
+
+    // applies @p script by moving the kept rows and copying the new and changed ones into a new
+    //   container in a single pass, signalled as a layout change
+    template<Container DataContainer>
+    Operations rebuildContainer(const UpdateScript &script, DataContainer &targetContainer)
+    {
+        Operations ops{0, 0, 0, 0};
+        int newRowCount = script.rowCount;
+        for (const Edit &edit : script.edits)
+        {
+            if (edit.type == Edit::Insert)
+                newRowCount += edit.count;
+            else if (edit.type == Edit::Remove)
+                newRowCount -= edit.count;
+        }
+
+        flushCachedChanges();
+        Q_EMIT this->layoutAboutToBeChanged();
+
+        DataContainer rebuilt;
+        rebuilt.reserve(newRowCount);
+        std::vector<int> newRows(script.rowCount, -1); // the row every old row ends up on
+        std::vector<const Edit *> changes;
+        auto oldIt = std::begin(targetContainer);
+        int oldRow = 0;
+        int rowOffset = 0; // the rows inserted minus the rows removed so far
+        auto keepRowsUntil = [&](int row) {
+            for (; oldRow < row; ++oldRow, ++oldIt)
+            {
+                newRows[oldRow] = static_cast<int>(rebuilt.size());
+                rebuilt.push_back(std::move(*oldIt));
+            }
+        };
+
+        for (const Edit &edit : script.edits)
+        {
+            keepRowsUntil(edit.row - rowOffset);
+            const auto items = std::next(script.items.cbegin(), edit.item);
+            switch (edit.type)
+            {
+            case Edit::Insert:
+                std::copy(items, std::next(items, edit.count), std::back_inserter(rebuilt));
+                rowOffset += edit.count;
+                ops.inserts += edit.count;
+                break;
+            case Edit::Remove:
+                std::advance(oldIt, edit.count);
+                oldRow += edit.count;
+                rowOffset -= edit.count;
+                ops.removals += edit.count;
+                break;
+            case Edit::Change:
+                newRows[oldRow] = static_cast<int>(rebuilt.size());
+                rebuilt.push_back(*items);
+                ++oldIt;
+                ++oldRow;
+                changes.push_back(&edit);
+                ops.updates++;
+                break;
+            case Edit::Move:
+                Q_UNREACHABLE();
+                break;
+            }
+        }
+        keepRowsUntil(script.rowCount);
+
+        using std::swap;
+        swap(targetContainer, rebuilt);
+
+        const QModelIndexList oldIndexes = this->persistentIndexList();
+        QModelIndexList newIndexes;
+        newIndexes.reserve(oldIndexes.size());
+        for (const QModelIndex &index : oldIndexes)
+        {
+            Q_ASSERT_X(!index.parent().isValid(), "rebuildContainer",
+                       "rebuilding the container is only supported for flat models");
+            const int newRow = newRows[index.row()];
+            newIndexes.append(newRow == -1 ? QModelIndex() : this->index(newRow, index.column(), QModelIndex()));
+        }
+        this->changePersistentIndexList(oldIndexes, newIndexes);
+        Q_EMIT this->layoutChanged();
+
+        // the changed rows are signalled for their new position, after the layout change
+        for (const Edit *edit : changes)
+        {
+            const int row = edit->row;
+            if (m_firstChangedRow != -1 && row != m_lastChangedRow + 1)
+                flushCachedChanges();
+            addChange(row, edit->changes.changedColumns, edit->changes.changedRoles);
+        }
+        flushCachedChanges();
+
+        return ops;
+    }
+
+    template<Container DataContainer>
+    void scheduleSlice(DataContainer &targetContainer, int budget)
+    {
+        m_applySlice = [this, &targetContainer, budget]() { applySlice(targetContainer, budget); };
+        if (m_sliceScheduled)
+            return;
+
+        m_sliceScheduled = true;
+        QTimer::singleShot(0, this, [this]() {
+            m_sliceScheduled = false;
+            // applying the slice schedules the next one, replacing m_applySlice
+            const auto applySlice = m_applySlice;
+            applySlice();
+        });
+    }
+
+    template<Container DataContainer>
+    void applySlice(DataContainer &targetContainer, int budget)
+    {
+        const QDeadlineTimer deadline(budget);
+        if (m_computeSlicedScript)
+        {
+            // a new snapshot arrived, continue from where the previous one got to
+            m_slicedScript = m_computeSlicedScript();
+            m_nextSlicedEdit = 0;
+            m_computeSlicedScript = nullptr;
+            m_slicedSnapshot.clear();
+        }
+
+        Operations ops{0, 0, 0, 0};
+        auto &edits = m_slicedScript.edits;
+        while (m_nextSlicedEdit < edits.size())
+        {
+            Edit &edit = edits[m_nextSlicedEdit];
+            const bool splittable = edit.type == Edit::Insert || edit.type == Edit::Remove;
+            const int count = splittable ? std::min(edit.count, MaxRowsPerSliceStep) : edit.count;
+            applyEdit(m_slicedScript, edit, count, targetContainer, ops);
+
+            // leave the rest of a split up edit for the next step
+            edit.count -= count;
+            if (edit.type == Edit::Insert)
+            {
+                edit.row += count;
+                edit.item += count;
+            }
+            if (edit.count == 0 || !splittable)
+                ++m_nextSlicedEdit;
+
+            if (deadline.hasExpired())
+                break;
+        }
+        flushCachedChanges();
+
+        if (m_nextSlicedEdit < edits.size())
+        {
+            scheduleSlice(targetContainer, budget);
+        }
+        else
+        {
+            m_slicedScript = UpdateScript();
+            m_nextSlicedEdit = 0;
+        }
+    }
+
+    template<ForwardIt Iterator, Container DataContainer>
+    void changeItem(DataContainer &targetContainer, Iterator lhs, typename DataContainer::iterator rhs,
+                    const DataChanges &changes, Operations &ops)
+    {
+        *rhs = *lhs;
+        markChanged(targetContainer, rhs, changes, ops);
+    }
+
+    template<Container DataContainer>
+    void markChanged(DataContainer &targetContainer, typename DataContainer::iterator rhs, const DataChanges &changes,
+                     Operations &ops)
+    {
+        int row = std::distance(targetContainer.begin(), rhs);
+        addChange(row, changes.changedColumns, changes.changedRoles);
+
+        ops.updates++;
+    }
+
+    template<ForwardIt Iterator, Container DataContainer>
+    typename DataContainer::iterator insertItems(DataContainer &targetContainer, Iterator lhsBegin, Iterator lhsEnd,
+                                                 typename DataContainer::iterator rhsInsertAt, Operations &ops)
+    {
+        flushCachedChanges();
+        int firstNewRow = std::distance(targetContainer.begin(), rhsInsertAt);
+        int lastNewRow = firstNewRow + std::distance(lhsBegin, lhsEnd) - 1;
+        beginInsertRows(firstNewRow, lastNewRow);
+        auto rangeEnd = insertRange(targetContainer, rhsInsertAt, lhsBegin, lhsEnd);
+        endInsertRows();
+
+        ops.inserts += std::distance(lhsBegin, lhsEnd);
+
+        return rangeEnd;
+    }
+
+    template<Container DataContainer>
+    void moveItems(DataContainer &targetContainer, int firstRow, int lastRow, int destinationRow, Operations &ops)
+    {
+        flushCachedChanges();
+        if (!beginMoveRows(firstRow, lastRow, destinationRow))
+        {
+            // the base model refused the move, for example because it would not change anything, so
+            //   take the rows out and insert them again instead
+            const int count = lastRow - firstRow + 1;
+            const int insertRow =
+                destinationRow > lastRow ? destinationRow - count : std::min(destinationRow, firstRow);
+            const auto first = std::next(std::begin(targetContainer), firstRow);
+            const auto last = std::next(first, count);
+            std::vector<DataType> items(std::make_move_iterator(first), std::make_move_iterator(last));
+            removeItems(targetContainer, first, last, ops);
+            insertItems(targetContainer, std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()),
+                        std::next(std::begin(targetContainer), insertRow), ops);
+            return;
+        }
+        moveRange(targetContainer, firstRow, lastRow, destinationRow);
+        endMoveRows();
+
+        ops.moves += lastRow - firstRow + 1;
+    }
+
+    // puts the rows in @p newOrder, which lists the current rows in their new order, in a single
+    //   pass, signalled as a layout change
+    template<Container DataContainer>
+    void reorderItems(DataContainer &targetContainer, const std::vector<int> &newOrder, Operations &ops)
+    {
+        flushCachedChanges();
+        Q_EMIT this->layoutAboutToBeChanged();
+
+        DataContainer reordered;
+        reordered.reserve(newOrder.size());
+        std::vector<int> newRows(newOrder.size()); // the row every old row ends up on
+        const auto oldBegin = std::begin(targetContainer);
+        for (int newRow = 0; newRow < static_cast<int>(newOrder.size()); ++newRow)
+        {
+            reordered.push_back(std::move(*std::next(oldBegin, newOrder[newRow])));
+            newRows[newOrder[newRow]] = newRow;
+            if (newOrder[newRow] != newRow)
+                ops.moves++;
+        }
+
+        using std::swap;
+        swap(targetContainer, reordered);
+
+        const QModelIndexList oldIndexes = this->persistentIndexList();
+        QModelIndexList newIndexes;
+        newIndexes.reserve(oldIndexes.size());
+        for (const QModelIndex &index : oldIndexes)
+        {
+            newIndexes.append(index.parent() == m_updateParent
+                                  ? this->index(newRows[index.row()], index.column(), m_updateParent)
+                                  : index);
+        }
+        this->changePersistentIndexList(oldIndexes, newIndexes);
+        Q_EMIT this->layoutChanged();
+    }
+
+    template<Container DataContainer>
+    typename DataContainer::iterator removeItems(DataContainer &targetContainer,
+                                                 typename DataContainer::iterator rhsBegin,
+                                                 typename DataContainer::iterator rhsEnd, Operations &ops)
+    {
+        flushCachedChanges();
+        const auto targetContainerBegin = std::begin(targetContainer);
+        int firstRemovedRow = std::distance(targetContainerBegin, rhsBegin);
+        int lastRemovedRow = std::distance(targetContainerBegin, rhsEnd) - 1;
+        beginRemoveRows(firstRemovedRow, lastRemovedRow);
+        auto newRhsEnd = targetContainer.erase(rhsBegin, rhsEnd);
+        endRemoveRows();
+
+        ops.removals += lastRemovedRow - firstRemovedRow + 1;
+
+        return newRhsEnd;
+    }
+
+    void flushCachedChanges()
+    {
+        if (m_firstChangedRow == -1)
+            return;
+
+        // the vector of changed roles is kept for as long as the roles stay the same, so the changes of
+        //   many single rows do not build the same vector over and over again
+        if (m_changedRoles != m_emittedRoles)
+        {
+            m_emittedRoles = m_changedRoles;
+            m_emittedRoleVector.clear();
+            m_changedRoles.forEach([this](int role) { m_emittedRoleVector.append(role); });
+        }
+
+        // emit a signal per range of neighbouring columns. For example, the columns {1, 2, 3, 5, 6, 9}
+        //   are emitted as the ranges {1, 3}, {5, 6} and {9, 9}
+        int firstColumn = -1;
+        int lastColumn = -1;
+        const auto emitRange = [this, &firstColumn, &lastColumn]() {
+            QModelIndex topLeft = this->index(m_firstChangedRow, firstColumn, m_updateParent);
+            QModelIndex bottomRight = this->index(m_lastChangedRow, lastColumn, m_updateParent);
+            Q_EMIT BaseModel::dataChanged(topLeft, bottomRight, m_emittedRoleVector);
+        };
+        m_changedColumns.forEach([&](int column) {
+            if (firstColumn != -1 && column != lastColumn + 1)
+            {
+                emitRange();
+                firstColumn = -1;
+            }
+            if (firstColumn == -1)
+                firstColumn = column;
+            lastColumn = column;
+        });
+        if (firstColumn != -1)
+            emitRange();
+
+        m_firstChangedRow = -1;
+    }
+
+    void addChange(int row, const IndexSet &columns, const IndexSet &roles)
+    {
+        if (m_firstChangedRow > -1)
+        {
+            // from here rows are guaranteed to be sequential, so no need to check for that
+            m_lastChangedRow = row; // optimistic, but lets see...
+
+            switch (m_changeMergePolicy)
+            {
+            case AlwaysMergeNeighbouringRows:
+                m_changedRoles &= roles;
+                m_changedColumns |= columns;
+                return;
+            case MergeWhenColumnsMatch:
+                if (m_changedColumns == columns)
+                {
+                    m_changedRoles &= roles;
+                    return;
+                }
+                break;
+            case MergeWhenRolesMatch:
+                if (m_changedRoles == roles)
+                {
+                    m_changedColumns |= columns;
+                    return;
+                }
+                break;
+            case MergeOnPerfectMatch:
+                if (m_changedColumns == columns && m_changedRoles == roles)
                 {
                     return;
                 }
@@ -441,14 +2130,75 @@ private:
         m_firstChangedRow = row;
         m_lastChangedRow = row;
         m_changedColumns = columns;
-        m_changedRoles = setFromContainer(roles);
+        m_changedRoles = roles;
     }
 
     ChangeMergePolicy m_changeMergePolicy = MergeOnPerfectMatch;
+    ApplyPolicy m_applyPolicy = AlwaysEditInPlace;
+    int m_rebuildThreshold = 1000;
+    bool m_parallelChangeDetection = false;
+    int m_parallelChangeDetectionThreshold = 10000;
     int m_firstChangedRow = -1;
     int m_lastChangedRow = -1;
-    QVector<int> m_changedColumns;
-    QSet<int> m_changedRoles;
+    IndexSet m_changedColumns;
+    IndexSet m_changedRoles;
+    IndexSet m_emittedRoles;
+    QVector<int> m_emittedRoleVector; // m_emittedRoles, as passed to dataChanged
+    QModelIndex m_updateParent; // the parent of the rows being updated, see updateTree
+    bool m_updatingTree = false;
+
+    // state of updateDataInSlices
+    static constexpr int DefaultSliceBudget = 4; // ms, to leave time to paint at 60 fps
+    static constexpr int MaxRowsPerSliceStep = 1000;
+    std::vector<DataType> m_slicedSnapshot; // the newest data, until its script is computed
+    std::function<UpdateScript()> m_computeSlicedScript;
+    std::function<void()> m_applySlice;
+    UpdateScript m_slicedScript;
+    std::size_t m_nextSlicedEdit = 0;
+    bool m_sliceScheduled = false;
+};
+
+/**
+ * UpdateableModel for models that provide their comparison and change detection at compile time.
+ *
+ * Derived implements lessThan and itemHasChanged with the same signatures as the virtual functions of
+ * UpdateableModel, and makes them accessible to this class (by making them public or by declaring
+ * StaticUpdateableModel a friend). updateData calls them directly instead of through the virtual
+ * functions and a std::function, so they can be inlined into the loop in updateCollection, which makes
+ * a difference for models with many items.
+ */
+template<QAIM BaseModel, typename DataType, typename Derived>
+class StaticUpdateableModel : public UpdateableModel<BaseModel, DataType>
+{
+    using Base = UpdateableModel<BaseModel, DataType>;
+
+public:
+    using Base::Base;
+
+protected:
+    // the overload taking a comparison and a change detection stays available
+    using Base::updateData;
+
+    // hides the overload of the base class with the same parameters. A @p hasChanged passed in is
+    //   used instead of Derived::itemHasChanged, as the base class would
+    template<ForwardIt Iterator, Container DataContainer>
+    typename Base::Operations updateData(Iterator srcBegin, Iterator srcEnd, DataContainer &targetContainer,
+                                         typename Base::HasChangesFunction hasChanged = {})
+    {
+        const auto *derived = static_cast<const Derived *>(this);
+        // qualified calls, so overrides of the virtual functions are not dispatched dynamically either
+        auto lessThan = [derived](const DataType &lhs, const DataType &rhs) {
+            return derived->Derived::lessThan(lhs, rhs);
+        };
+        if (hasChanged)
+            return Base::updateData(srcBegin, srcEnd, targetContainer, lessThan, hasChanged);
+
+        auto itemHasChanged = [derived](const DataType &lhs, const DataType &rhs) {
+            return derived->Derived::itemHasChanged(lhs, rhs);
+        };
+
+        return Base::updateData(srcBegin, srcEnd, targetContainer, lessThan, itemHasChanged);
+    }
 };
 
 #undef ForwardIt
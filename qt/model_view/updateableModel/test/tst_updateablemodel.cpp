@@ -0,0 +1,940 @@
+/*
+  This file is part of KDToolBox.
+
+  SPDX-FileCopyrightText: 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+
+  SPDX-License-Identifier: MIT
+*/
+
+#include "../UpdateableModel.h"
+
+#include <QAbstractListModel>
+#include <QSignalSpy>
+#include <QTest>
+#include <QTimer>
+
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+
+struct Item
+{
+    int id;
+    QString text;
+};
+
+template<typename Model>
+class ItemListModel : public Model
+{
+public:
+    using typename Model::DataChanges;
+    using typename Model::Edit;
+    using typename Model::IndexSet;
+    using typename Model::Operations;
+    using typename Model::UpdateScript;
+    using Model::fingerprintChanges;
+    using Model::Model;
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override
+    {
+        return parent.isValid() ? 0 : static_cast<int>(m_items.size());
+    }
+
+    QVariant data(const QModelIndex &index, int role) const override
+    {
+        const Item &item = m_items[index.row()];
+        if (role == Qt::DisplayRole)
+            return item.text;
+        if (role == Qt::UserRole)
+            return item.id;
+        return {};
+    }
+
+    static DataChanges changesBetween(const Item &lhs, const Item &rhs)
+    {
+        DataChanges changes;
+        if (lhs.text != rhs.text)
+        {
+            changes.changedColumns = {0};
+            changes.changedRoles = {Qt::DisplayRole};
+        }
+        return changes;
+    }
+
+    std::vector<Item> m_items;
+};
+
+class ItemModel : public ItemListModel<UpdateableModel<QAbstractListModel, Item>>
+{
+public:
+    Operations update(const std::vector<Item> &items) { return updateData(items.cbegin(), items.cend(), m_items); }
+
+    Operations updateByKey(const std::vector<Item> &items)
+    {
+        return updateDataByKey(items.cbegin(), items.cend(), m_items, [](const Item &item) { return item.id; });
+    }
+
+    UpdateScript scriptFor(const std::vector<Item> &items, bool byKey) const
+    {
+        if (byKey)
+            return computeUpdateByKey(items.cbegin(), items.cend(), m_items, [](const Item &item) { return item.id; });
+        return computeUpdate(items.cbegin(), items.cend(), m_items);
+    }
+
+    Operations apply(const UpdateScript &script) { return applyUpdate(script, m_items); }
+
+    void updateInSlices(const std::vector<Item> &items, bool byKey, int budget)
+    {
+        if (byKey)
+            updateDataByKeyInSlices(items.cbegin(), items.cend(), m_items, [](const Item &item) { return item.id; },
+                                    budget);
+        else
+            updateDataInSlices(items.cbegin(), items.cend(), m_items, budget);
+    }
+
+    void applyInSlices(const UpdateScript &script, int budget) { applyUpdateInSlices(script, m_items, budget); }
+
+    using UpdateableModel::hasPendingUpdate;
+
+    void detectChangesInParallel()
+    {
+        setParallelChangeDetection(true);
+        setParallelChangeDetectionThreshold(1);
+    }
+
+    void rebuildAbove(int runs)
+    {
+        setApplyPolicy(RebuildAboveThreshold);
+        setRebuildThreshold(runs);
+    }
+
+protected:
+    bool lessThan(const Item &lhs, const Item &rhs) const override { return lhs.id < rhs.id; }
+
+    DataChanges itemHasChanged(const Item &lhs, const Item &rhs) const override { return changesBetween(lhs, rhs); }
+};
+
+class StaticItemModel : public ItemListModel<StaticUpdateableModel<QAbstractListModel, Item, StaticItemModel>>
+{
+public:
+    Operations update(const std::vector<Item> &items) { return updateData(items.cbegin(), items.cend(), m_items); }
+
+    // uses the overload of UpdateableModel that takes the comparison and the change detection
+    Operations updateIgnoringChanges(const std::vector<Item> &items)
+    {
+        return updateData(
+            items.cbegin(), items.cend(), m_items, [](const Item &lhs, const Item &rhs) { return lhs.id < rhs.id; },
+            [](const Item &, const Item &) { return DataChanges(); });
+    }
+
+    bool lessThan(const Item &lhs, const Item &rhs) const override { return lhs.id < rhs.id; }
+
+    DataChanges itemHasChanged(const Item &lhs, const Item &rhs) const override { return changesBetween(lhs, rhs); }
+};
+
+struct Node
+{
+    int id;
+    QString text;
+    std::vector<Node> children;
+    quint64 subtreeFingerprint = 0;
+};
+
+/**
+ * Tree model with the id of the item in its indexes. Looking items up by walking the tree is slow,
+ * but keeps the indexes valid while the tree changes.
+ */
+class TreeModel : public UpdateableModel<QAbstractItemModel, Node>
+{
+public:
+    Operations update(const std::vector<Node> &nodes)
+    {
+        return updateTree(nodes.cbegin(), nodes.cend(), m_nodes, [](auto &node) -> auto & { return node.children; },
+                          [](const Node &node) { return node.subtreeFingerprint; });
+    }
+
+    // copies only the fields of the changed nodes themselves
+    Operations updateOwnFields(const std::vector<Node> &nodes)
+    {
+        return updateTree(
+            nodes.cbegin(), nodes.cend(), m_nodes, [](auto &node) -> auto & { return node.children; },
+            [](const Node &node) { return node.subtreeFingerprint; },
+            [this](Node &target, const Node &source) {
+                ++m_assignments;
+                target.id = source.id;
+                target.text = source.text;
+                target.subtreeFingerprint = source.subtreeFingerprint;
+            });
+    }
+
+    void rebuildAbove(int runs)
+    {
+        setApplyPolicy(RebuildAboveThreshold);
+        setRebuildThreshold(runs);
+    }
+
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override
+    {
+        const std::vector<Node> &siblings = parent.isValid() ? find(m_nodes, parent.internalId())->children : m_nodes;
+        if (row < 0 || row >= static_cast<int>(siblings.size()) || column != 0)
+            return {};
+        return createIndex(row, column, static_cast<quintptr>(siblings[row].id));
+    }
+
+    QModelIndex parent(const QModelIndex &child) const override
+    {
+        const Node *parentNode = findParent(m_nodes, nullptr, child.internalId());
+        if (!parentNode)
+            return {};
+        const Node *grandParentNode = findParent(m_nodes, nullptr, parentNode->id);
+        const std::vector<Node> &siblings = grandParentNode ? grandParentNode->children : m_nodes;
+        const auto row = std::find_if(siblings.cbegin(), siblings.cend(),
+                                      [parentNode](const Node &node) { return node.id == parentNode->id; });
+        return createIndex(static_cast<int>(std::distance(siblings.cbegin(), row)), 0,
+                           static_cast<quintptr>(parentNode->id));
+    }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override
+    {
+        if (!parent.isValid())
+            return static_cast<int>(m_nodes.size());
+        return static_cast<int>(find(m_nodes, parent.internalId())->children.size());
+    }
+
+    int columnCount(const QModelIndex & = QModelIndex()) const override { return 1; }
+
+    QVariant data(const QModelIndex &index, int role) const override
+    {
+        const Node *node = find(m_nodes, index.internalId());
+        if (role == Qt::DisplayRole)
+            return node->text;
+        if (role == Qt::UserRole)
+            return node->id;
+        return {};
+    }
+
+    std::vector<Node> m_nodes;
+    mutable int m_comparisons = 0;
+    int m_assignments = 0;
+
+protected:
+    bool lessThan(const Node &lhs, const Node &rhs) const override { return lhs.id < rhs.id; }
+
+    DataChanges itemHasChanged(const Node &lhs, const Node &rhs) const override
+    {
+        ++m_comparisons;
+        DataChanges changes;
+        if (lhs.text != rhs.text)
+        {
+            changes.changedColumns = {0};
+            changes.changedRoles = {Qt::DisplayRole};
+        }
+        return changes;
+    }
+
+private:
+    static const Node *find(const std::vector<Node> &nodes, quintptr id)
+    {
+        for (const Node &node : nodes)
+        {
+            if (static_cast<quintptr>(node.id) == id)
+                return &node;
+            if (const Node *child = find(node.children, id))
+                return child;
+        }
+        return nullptr;
+    }
+
+    static const Node *findParent(const std::vector<Node> &nodes, const Node *parent, quintptr id)
+    {
+        for (const Node &node : nodes)
+        {
+            if (static_cast<quintptr>(node.id) == id)
+                return parent;
+            if (const Node *found = findParent(node.children, &node, id))
+                return found;
+        }
+        return nullptr;
+    }
+};
+
+class tst_UpdateableModel : public QObject
+{
+    Q_OBJECT
+public:
+    using QObject::QObject;
+
+private Q_SLOTS:
+    void updateSorted();
+    void updateByKeyMovesItems();
+    void updateByKeyInsertsRemovesAndChanges();
+    void updateByKeyRandom();
+    void updateByKeyReorder();
+    void refusedMove();
+    void staticUpdate();
+    void computeAndApplyUpdate_data();
+    void computeAndApplyUpdate();
+    void updateInSlices_data();
+    void updateInSlices();
+    void applyUpdateInSlices_data();
+    void applyUpdateInSlices();
+    void rebuildContainer();
+    void parallelChangeDetection_data();
+    void parallelChangeDetection();
+    void indexSet();
+    void fingerprints();
+    void updateTree();
+
+private:
+    static void checkContents(const ItemModel &model, const std::vector<Item> &items);
+};
+
+static Node node(int id, std::vector<Node> children = {}, const QString &text = QString())
+{
+    Node result{id, text.isEmpty() ? QString::number(id) : text, std::move(children)};
+    result.subtreeFingerprint = fingerprintOf(result.id, result.text);
+    for (const Node &child : result.children)
+        result.subtreeFingerprint = combineFingerprint(result.subtreeFingerprint, child.subtreeFingerprint);
+    return result;
+}
+
+static std::vector<Item> items(std::initializer_list<int> ids)
+{
+    std::vector<Item> result;
+    for (int id : ids)
+        result.push_back({id, QString::number(id)});
+    return result;
+}
+
+void tst_UpdateableModel::checkContents(const ItemModel &model, const std::vector<Item> &items)
+{
+    QCOMPARE(model.rowCount(), static_cast<int>(items.size()));
+    for (int row = 0; row < model.rowCount(); ++row)
+    {
+        QCOMPARE(model.index(row).data(Qt::UserRole).toInt(), items[row].id);
+        QCOMPARE(model.index(row).data().toString(), items[row].text);
+    }
+}
+
+void tst_UpdateableModel::updateSorted()
+{
+    ItemModel model;
+    model.update(items({1, 2, 4, 5}));
+    checkContents(model, items({1, 2, 4, 5}));
+
+    QSignalSpy insertedSpy(&model, &QAbstractItemModel::rowsInserted);
+    QSignalSpy removedSpy(&model, &QAbstractItemModel::rowsRemoved);
+    QSignalSpy changedSpy(&model, &QAbstractItemModel::dataChanged);
+    auto newItems = items({2, 3, 4, 5});
+    newItems[2].text = QStringLiteral("four");
+    const auto ops = model.update(newItems);
+    checkContents(model, newItems);
+    QCOMPARE(ops.inserts, 1u);
+    QCOMPARE(ops.removals, 1u);
+    QCOMPARE(ops.updates, 1u);
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(changedSpy.count(), 1);
+}
+
+void tst_UpdateableModel::updateByKeyMovesItems()
+{
+    ItemModel model;
+    model.updateByKey(items({3, 1, 4, 5, 2}));
+    checkContents(model, items({3, 1, 4, 5, 2}));
+
+    const QPersistentModelIndex persistentIndex = model.index(2); // 4
+    QSignalSpy movedSpy(&model, &QAbstractItemModel::rowsMoved);
+    QSignalSpy insertedSpy(&model, &QAbstractItemModel::rowsInserted);
+    QSignalSpy removedSpy(&model, &QAbstractItemModel::rowsRemoved);
+
+    // a single item moving to the front is a single move
+    auto ops = model.updateByKey(items({2, 3, 1, 4, 5}));
+    checkContents(model, items({2, 3, 1, 4, 5}));
+    QCOMPARE(ops.moves, 1u);
+    QCOMPARE(movedSpy.count(), 1);
+    QCOMPARE(persistentIndex.row(), 3);
+
+    // neighbouring items moving to the same place move together
+    ops = model.updateByKey(items({4, 5, 2, 3, 1}));
+    checkContents(model, items({4, 5, 2, 3, 1}));
+    QCOMPARE(ops.moves, 2u);
+    QCOMPARE(movedSpy.count(), 2);
+    QCOMPARE(persistentIndex.row(), 0);
+    QCOMPARE(insertedSpy.count(), 0);
+    QCOMPARE(removedSpy.count(), 0);
+}
+
+void tst_UpdateableModel::updateByKeyInsertsRemovesAndChanges()
+{
+    ItemModel model;
+    model.updateByKey(items({10, 20, 30, 40, 50}));
+
+    QSignalSpy movedSpy(&model, &QAbstractItemModel::rowsMoved);
+    QSignalSpy insertedSpy(&model, &QAbstractItemModel::rowsInserted);
+    QSignalSpy removedSpy(&model, &QAbstractItemModel::rowsRemoved);
+    QSignalSpy changedSpy(&model, &QAbstractItemModel::dataChanged);
+    auto newItems = items({60, 50, 61, 10, 30});
+    newItems[3].text = QStringLiteral("ten");
+    newItems[4].text = QStringLiteral("thirty");
+    const auto ops = model.updateByKey(newItems);
+    checkContents(model, newItems);
+    QCOMPARE(ops.inserts, 2u);
+    QCOMPARE(ops.removals, 2u);
+    QCOMPARE(ops.moves, 1u);
+    QCOMPARE(ops.updates, 2u);
+    QCOMPARE(insertedSpy.count(), 2);
+    QCOMPARE(removedSpy.count(), 2);
+    QCOMPARE(movedSpy.count(), 1);
+    // the neighbouring changes are merged into a single dataChanged
+    QCOMPARE(changedSpy.count(), 1);
+    QCOMPARE(changedSpy.at(0).at(0).value<QModelIndex>().row(), 3);
+    QCOMPARE(changedSpy.at(0).at(1).value<QModelIndex>().row(), 4);
+}
+
+void tst_UpdateableModel::updateByKeyRandom()
+{
+    std::mt19937 generator(42);
+    ItemModel model;
+    int nextId = 0;
+    for (int round = 0; round < 200; ++round)
+    {
+        // keep some of the current items, add new ones and shuffle them
+        std::vector<Item> newItems;
+        for (const Item &item : model.m_items)
+        {
+            if (generator() % 4 != 0)
+                newItems.push_back({item.id, generator() % 8 == 0 ? QStringLiteral("changed") : item.text});
+        }
+        for (int i = static_cast<int>(generator() % 10); i > 0; --i)
+        {
+            newItems.push_back({nextId, QString::number(nextId)});
+            ++nextId;
+        }
+        if (generator() % 2 == 0)
+            std::shuffle(newItems.begin(), newItems.end(), generator);
+        else if (newItems.size() > 1)
+            std::swap(newItems.front(), newItems[generator() % newItems.size()]);
+
+        std::vector<QPersistentModelIndex> persistentIndexes;
+        std::vector<int> ids;
+        for (int row = 0; row < model.rowCount(); ++row)
+        {
+            persistentIndexes.emplace_back(model.index(row));
+            ids.push_back(model.m_items[row].id);
+        }
+
+        model.updateByKey(newItems);
+        checkContents(model, newItems);
+        for (std::size_t i = 0; i < persistentIndexes.size(); ++i)
+        {
+            const bool kept = std::any_of(newItems.cbegin(), newItems.cend(),
+                                          [&ids, i](const Item &item) { return item.id == ids[i]; });
+            QCOMPARE(persistentIndexes[i].isValid(), kept);
+            if (kept)
+                QCOMPARE(persistentIndexes[i].data(Qt::UserRole).toInt(), ids[i]);
+        }
+    }
+}
+
+void tst_UpdateableModel::updateByKeyReorder()
+{
+    ItemModel model;
+    model.rebuildAbove(2);
+    model.updateByKey(items({1, 2, 3, 4, 5, 6}));
+
+    const QPersistentModelIndex persistentIndex = model.index(1); // 2
+    QSignalSpy movedSpy(&model, &QAbstractItemModel::rowsMoved);
+    QSignalSpy layoutSpy(&model, &QAbstractItemModel::layoutChanged);
+    QSignalSpy insertedSpy(&model, &QAbstractItemModel::rowsInserted);
+    QSignalSpy removedSpy(&model, &QAbstractItemModel::rowsRemoved);
+    QSignalSpy changedSpy(&model, &QAbstractItemModel::dataChanged);
+
+    // moving fewer rows than the threshold moves them
+    auto ops = model.updateByKey(items({3, 1, 2, 4, 5, 6}));
+    checkContents(model, items({3, 1, 2, 4, 5, 6}));
+    QCOMPARE(ops.moves, 1u);
+    QCOMPARE(movedSpy.count(), 1);
+    QCOMPARE(layoutSpy.count(), 0);
+    QCOMPARE(persistentIndex.row(), 2);
+
+    // reversing moves more, so the rows are reordered in a single layout change, with the removed
+    //   and inserted rows signalled on their own
+    auto newItems = items({7, 5, 4, 2, 1, 3});
+    newItems[2].text = QStringLiteral("four");
+    ops = model.updateByKey(newItems);
+    checkContents(model, newItems);
+    QCOMPARE(ops.moves, 4u);
+    QCOMPARE(ops.inserts, 1u);
+    QCOMPARE(ops.removals, 1u);
+    QCOMPARE(ops.updates, 1u);
+    QCOMPARE(movedSpy.count(), 1);
+    QCOMPARE(layoutSpy.count(), 1);
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(changedSpy.count(), 1);
+    QCOMPARE(changedSpy.at(0).at(0).value<QModelIndex>().row(), 2);
+    QCOMPARE(persistentIndex.row(), 3);
+}
+
+void tst_UpdateableModel::refusedMove()
+{
+    ItemModel model;
+    model.update(items({1, 2, 3, 4, 5}));
+
+    QSignalSpy movedSpy(&model, &QAbstractItemModel::rowsMoved);
+    QSignalSpy insertedSpy(&model, &QAbstractItemModel::rowsInserted);
+    QSignalSpy removedSpy(&model, &QAbstractItemModel::rowsRemoved);
+
+    // QAbstractItemModel refuses to move rows to where they already are, so they are removed and
+    //   inserted again instead
+    ItemModel::UpdateScript script;
+    script.rowCount = 5;
+    script.edits.push_back({ItemModel::Edit::Move, 1, 2, 3, 0, {}});
+    const auto ops = model.apply(script);
+    checkContents(model, items({1, 2, 3, 4, 5}));
+    QCOMPARE(ops.moves, 0u);
+    QCOMPARE(ops.removals, 2u);
+    QCOMPARE(ops.inserts, 2u);
+    QCOMPARE(movedSpy.count(), 0);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(insertedSpy.at(0).at(1).toInt(), 1);
+}
+
+void tst_UpdateableModel::staticUpdate()
+{
+    StaticItemModel model;
+    model.update(items({1, 2, 4, 5}));
+
+    QSignalSpy insertedSpy(&model, &QAbstractItemModel::rowsInserted);
+    QSignalSpy removedSpy(&model, &QAbstractItemModel::rowsRemoved);
+    QSignalSpy changedSpy(&model, &QAbstractItemModel::dataChanged);
+    auto newItems = items({2, 3, 4, 5});
+    newItems[2].text = QStringLiteral("four");
+    const auto ops = model.update(newItems);
+    QCOMPARE(model.rowCount(), 4);
+    QCOMPARE(model.index(2).data().toString(), QStringLiteral("four"));
+    QCOMPARE(ops.inserts, 1u);
+    QCOMPARE(ops.removals, 1u);
+    QCOMPARE(ops.updates, 1u);
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(changedSpy.count(), 1);
+
+    newItems[2].text = QStringLiteral("vier");
+    QCOMPARE(model.updateIgnoringChanges(newItems).updates, 0u);
+    QCOMPARE(model.index(2).data().toString(), QStringLiteral("four"));
+    QCOMPARE(changedSpy.count(), 1);
+}
+
+/**
+ * Records the row signals of a model as strings, so the signals of two models can be compared.
+ */
+class SignalLog : public QObject
+{
+public:
+    explicit SignalLog(QAbstractItemModel *model)
+    {
+        connect(model, &QAbstractItemModel::rowsInserted, this,
+                [this](const QModelIndex &, int first, int last) { add("inserted", first, last); });
+        connect(model, &QAbstractItemModel::rowsRemoved, this,
+                [this](const QModelIndex &, int first, int last) { add("removed", first, last); });
+        connect(model, &QAbstractItemModel::rowsMoved, this,
+                [this](const QModelIndex &, int first, int last, const QModelIndex &, int destination) {
+                    add("moved", first, last, destination);
+                });
+        connect(model, &QAbstractItemModel::dataChanged, this,
+                [this](const QModelIndex &topLeft, const QModelIndex &bottomRight) {
+                    add("changed", topLeft.row(), bottomRight.row());
+                });
+    }
+
+    QStringList entries;
+
+private:
+    void add(const char *signal, int first, int last, int destination = -1)
+    {
+        entries.append(QStringLiteral("%1 %2 %3 %4").arg(QLatin1String(signal)).arg(first).arg(last).arg(destination));
+    }
+};
+
+void tst_UpdateableModel::computeAndApplyUpdate_data()
+{
+    QTest::addColumn<bool>("byKey");
+
+    QTest::newRow("sorted") << false;
+    QTest::newRow("by key") << true;
+}
+
+void tst_UpdateableModel::computeAndApplyUpdate()
+{
+    QFETCH(bool, byKey);
+
+    std::mt19937 generator(42);
+    ItemModel direct;
+    ItemModel scripted;
+    SignalLog directLog(&direct);
+    SignalLog scriptedLog(&scripted);
+    for (int round = 0; round < 100; ++round)
+    {
+        std::vector<Item> newItems;
+        for (int id = 0; id < 50; ++id)
+        {
+            if (generator() % 3 != 0)
+                newItems.push_back({id, generator() % 8 == 0 ? QStringLiteral("changed") : QString::number(id)});
+        }
+        if (byKey)
+            std::shuffle(newItems.begin(), newItems.end(), generator);
+
+        const auto directOps = byKey ? direct.updateByKey(newItems) : direct.update(newItems);
+
+        // compute the script on another thread, and apply it on this one
+        ItemModel::UpdateScript script;
+        std::thread worker([&]() { script = scripted.scriptFor(newItems, byKey); });
+        worker.join();
+        const auto scriptedOps = scripted.apply(script);
+
+        checkContents(scripted, newItems);
+        QCOMPARE(scriptedLog.entries, directLog.entries);
+        QCOMPARE(scriptedOps.inserts, directOps.inserts);
+        QCOMPARE(scriptedOps.removals, directOps.removals);
+        QCOMPARE(scriptedOps.updates, directOps.updates);
+        QCOMPARE(scriptedOps.moves, directOps.moves);
+    }
+}
+
+void tst_UpdateableModel::updateInSlices_data()
+{
+    computeAndApplyUpdate_data();
+}
+
+void tst_UpdateableModel::updateInSlices()
+{
+    QFETCH(bool, byKey);
+
+    std::vector<Item> original;
+    for (int id = 0; id < 5000; id += 2)
+        original.push_back({id, QString::number(id)});
+    ItemModel model;
+    model.update(original);
+
+    QSignalSpy insertedSpy(&model, &QAbstractItemModel::rowsInserted);
+    QSignalSpy removedSpy(&model, &QAbstractItemModel::rowsRemoved);
+    QSignalSpy changedSpy(&model, &QAbstractItemModel::dataChanged);
+    // the model must be consistent after every step
+    connect(&model, &QAbstractItemModel::rowsInserted, this,
+            [&model]() { QCOMPARE(model.rowCount(), static_cast<int>(model.m_items.size())); });
+
+    // the first snapshot is replaced before it got applied
+    std::vector<Item> first = original;
+    first.erase(first.begin(), first.begin() + 100);
+    model.updateInSlices(first, byKey, 0);
+    QVERIFY(model.hasPendingUpdate());
+    QCOMPARE(model.rowCount(), static_cast<int>(original.size()));
+
+    // 2500 new rows at the end, split up, and a changed item
+    std::vector<Item> second = original;
+    second[10].text = QStringLiteral("ten");
+    for (int id = 5001; id < 10000; id += 2)
+        second.push_back({id, QString::number(id)});
+    model.updateInSlices(second, byKey, 0);
+
+    QTRY_VERIFY(!model.hasPendingUpdate());
+    checkContents(model, second);
+    QCOMPARE(removedSpy.count(), 0);
+    QCOMPARE(insertedSpy.count(), 3);
+    QCOMPARE(changedSpy.count(), 1);
+}
+
+void tst_UpdateableModel::applyUpdateInSlices_data()
+{
+    computeAndApplyUpdate_data();
+}
+
+void tst_UpdateableModel::applyUpdateInSlices()
+{
+    QFETCH(bool, byKey);
+
+    std::vector<Item> original;
+    for (int id = 0; id < 5000; id += 2)
+        original.push_back({id, QString::number(id)});
+    ItemModel model;
+    model.update(original);
+
+    // scattered removals and changes, and 2500 new rows at the end
+    std::vector<Item> newItems;
+    for (const Item &item : original)
+    {
+        if (item.id % 10 == 4)
+            continue;
+        newItems.push_back(item);
+        if (item.id % 14 == 0)
+            newItems.back().text = QStringLiteral("changed");
+    }
+    for (int id = 5001; id < 10000; id += 2)
+        newItems.push_back({id, QString::number(id)});
+    if (byKey)
+        std::swap(newItems[3], newItems[300]);
+    const auto script = model.scriptFor(newItems, byKey);
+
+    // count the signals of every slice: the ticker runs between the slices, as each of them
+    //   schedules the next one
+    int signalsInSlice = 0;
+    int maxSignalsInSlice = 0;
+    int maxRowsInSignal = 0;
+    const auto countSignal = [&](const QModelIndex &, int first, int last) {
+        ++signalsInSlice;
+        maxRowsInSignal = std::max(maxRowsInSignal, last - first + 1);
+    };
+    connect(&model, &QAbstractItemModel::rowsInserted, this, countSignal);
+    connect(&model, &QAbstractItemModel::rowsRemoved, this, countSignal);
+    connect(&model, &QAbstractItemModel::rowsMoved, this, [&]() { ++signalsInSlice; });
+    connect(&model, &QAbstractItemModel::dataChanged, this, [&]() { ++signalsInSlice; });
+    std::function<void()> tick = [&]() {
+        maxSignalsInSlice = std::max(maxSignalsInSlice, signalsInSlice);
+        signalsInSlice = 0;
+        if (model.hasPendingUpdate())
+            QTimer::singleShot(0, this, tick);
+    };
+
+    model.applyInSlices(script, 0);
+    QVERIFY(model.hasPendingUpdate());
+    QTimer::singleShot(0, this, tick);
+    QTRY_VERIFY(!model.hasPendingUpdate());
+    tick();
+
+    checkContents(model, newItems);
+    // with no budget, every slice replays a single step, of at most 1000 rows
+    QCOMPARE(maxSignalsInSlice, 1);
+    QCOMPARE(maxRowsInSignal, 1000);
+}
+
+void tst_UpdateableModel::rebuildContainer()
+{
+    ItemModel model;
+    model.rebuildAbove(2);
+    model.update(items({1, 2, 3, 4, 5, 6, 7, 8}));
+
+    const QPersistentModelIndex kept = model.index(4); // 5
+    const QPersistentModelIndex removed = model.index(5); // 6
+    QSignalSpy layoutSpy(&model, &QAbstractItemModel::layoutChanged);
+    QSignalSpy insertedSpy(&model, &QAbstractItemModel::rowsInserted);
+    QSignalSpy removedSpy(&model, &QAbstractItemModel::rowsRemoved);
+    QSignalSpy changedSpy(&model, &QAbstractItemModel::dataChanged);
+
+    // two runs of rows stay below the threshold, and are signalled row by row
+    auto ops = model.update(items({0, 1, 2, 3, 4, 5, 6, 7}));
+    checkContents(model, items({0, 1, 2, 3, 4, 5, 6, 7}));
+    QCOMPARE(layoutSpy.count(), 0);
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(removedSpy.count(), 1);
+    QCOMPARE(kept.row(), 5);
+
+    // more runs rebuild the container
+    auto newItems = items({1, 3, 5, 7, 9, 11});
+    newItems[2].text = QStringLiteral("five");
+    newItems[3].text = QStringLiteral("seven");
+    ops = model.update(newItems);
+    checkContents(model, newItems);
+    QCOMPARE(ops.inserts, 2u);
+    QCOMPARE(ops.removals, 4u);
+    QCOMPARE(ops.updates, 2u);
+    QCOMPARE(layoutSpy.count(), 1);
+    QCOMPARE(insertedSpy.count(), 1);
+    QCOMPARE(removedSpy.count(), 1);
+    QVERIFY(!removed.isValid());
+    QCOMPARE(kept.row(), 2);
+    QCOMPARE(changedSpy.count(), 1);
+    QCOMPARE(changedSpy.at(0).at(0).value<QModelIndex>().row(), 2);
+    QCOMPARE(changedSpy.at(0).at(1).value<QModelIndex>().row(), 3);
+
+    // random updates end up with the same data as editing in place, and only rebuild the container
+    //   if they have more runs than the threshold
+    model.rebuildAbove(67);
+    std::mt19937 generator(42);
+    for (int round = 0; round < 50; ++round)
+    {
+        std::vector<Item> randomItems;
+        for (int id = 0; id < 200; ++id)
+        {
+            if (generator() % 3 != 0)
+                randomItems.push_back({id, generator() % 8 == 0 ? QStringLiteral("changed") : QString::number(id)});
+        }
+        const auto script = model.scriptFor(randomItems, false);
+        const auto runs = std::count_if(script.edits.cbegin(), script.edits.cend(), [](const auto &edit) {
+            return edit.type == ItemModel::Edit::Insert || edit.type == ItemModel::Edit::Remove;
+        });
+        const int layoutChanges = layoutSpy.count();
+        model.update(randomItems);
+        checkContents(model, randomItems);
+        QCOMPARE(layoutSpy.count() - layoutChanges, runs > 67 ? 1 : 0);
+    }
+}
+
+void tst_UpdateableModel::parallelChangeDetection_data()
+{
+    computeAndApplyUpdate_data();
+}
+
+void tst_UpdateableModel::parallelChangeDetection()
+{
+    QFETCH(bool, byKey);
+
+    std::mt19937 generator(42);
+    ItemModel serial;
+    ItemModel parallel;
+    parallel.detectChangesInParallel();
+    SignalLog serialLog(&serial);
+    SignalLog parallelLog(&parallel);
+    for (int round = 0; round < 20; ++round)
+    {
+        // enough items to be split into chunks
+        std::vector<Item> newItems;
+        for (int id = 0; id < 5000; ++id)
+        {
+            if (generator() % 8 != 0)
+                newItems.push_back({id, generator() % 8 == 0 ? QStringLiteral("changed") : QString::number(id)});
+        }
+        if (byKey)
+            std::shuffle(newItems.begin(), newItems.end(), generator);
+
+        const auto serialOps = byKey ? serial.updateByKey(newItems) : serial.update(newItems);
+        const auto parallelOps = byKey ? parallel.updateByKey(newItems) : parallel.update(newItems);
+        checkContents(parallel, newItems);
+        QCOMPARE(parallelLog.entries, serialLog.entries);
+        QCOMPARE(parallelOps.updates, serialOps.updates);
+    }
+}
+
+void tst_UpdateableModel::indexSet()
+{
+    using IndexSet = ItemModel::IndexSet;
+    IndexSet set{3, 1, Qt::UserRole + 2, 100, -1, 1000, 3};
+    QCOMPARE(set.count(), 6);
+    std::vector<int> values;
+    set.forEach([&values](int value) { values.push_back(value); });
+    QCOMPARE(values, (std::vector<int>{-1, 1, 3, 100, Qt::UserRole + 2, 1000}));
+    QVERIFY(set == IndexSet(QVector<int>{1000, -1, 100, Qt::UserRole + 2, 1, 3}));
+
+    IndexSet other{1, 2, 100, Qt::UserRole + 2};
+    IndexSet intersection = set;
+    intersection &= other;
+    QVERIFY(intersection == (IndexSet{1, 100, Qt::UserRole + 2}));
+    set |= other;
+    QCOMPARE(set.count(), 7);
+    QVERIFY(IndexSet().isEmpty());
+
+    // it reads like the QVector<int> it replaces
+    QCOMPARE(set.size(), 7);
+    QVERIFY(set.contains(2));
+    QVERIFY(set.contains(1000));
+    QVERIFY(!set.contains(4));
+    QVERIFY(!set.contains(Qt::UserRole));
+    const QVector<int> expected{-1, 1, 2, 3, 100, Qt::UserRole + 2, 1000};
+    QCOMPARE(set.toVector(), expected);
+    QVector<int> iterated;
+    for (int value : set)
+        iterated.append(value);
+    QCOMPARE(iterated, expected);
+    QVERIFY(std::find(set.begin(), set.end(), 100) != set.end());
+    QVERIFY(IndexSet().begin() == IndexSet().end());
+    QCOMPARE((IndexSet{63, 64, Qt::UserRole + 63}.toVector()), (QVector<int>{63, 64, Qt::UserRole + 63}));
+}
+
+void tst_UpdateableModel::fingerprints()
+{
+    using Fingerprint = ItemFingerprint<3>;
+    const auto fingerprint = [](int id, const QString &text, double value) {
+        return Fingerprint({fingerprintOf(id), fingerprintOf(text), fingerprintOf(value, id)});
+    };
+    QVERIFY(fingerprintOf(1, 2) != fingerprintOf(2, 1));
+    QVERIFY(fingerprintOf(QStringLiteral("one")) != fingerprintOf(QStringLiteral("two")));
+    QVERIFY(fingerprintOf(QByteArray("one")) != fingerprintOf(QByteArray("two")));
+    QVERIFY(fingerprintOf(1.5) != fingerprintOf(2.5));
+    QCOMPARE(fingerprintOf(1.5f), fingerprintOf(1.5));
+    // the upper half of 64-bit values is not lost
+    QVERIFY(fingerprintOf(Q_UINT64_C(1) << 32) != fingerprintOf(Q_UINT64_C(1) << 33));
+
+    const Fingerprint original = fingerprint(1, QStringLiteral("one"), 1.5);
+    QVERIFY(!ItemModel::fingerprintChanges(original, fingerprint(1, QStringLiteral("one"), 1.5)));
+
+    auto changes = ItemModel::fingerprintChanges(original, fingerprint(1, QStringLiteral("uno"), 1.5),
+                                                 {Qt::DisplayRole});
+    QVERIFY(changes.changedColumns == (ItemModel::IndexSet{1}));
+    QVERIFY(changes.changedRoles == (ItemModel::IndexSet{Qt::DisplayRole}));
+
+    changes = ItemModel::fingerprintChanges(original, fingerprint(2, QStringLiteral("one"), 2.5));
+    QVERIFY(changes.changedColumns == (ItemModel::IndexSet{0, 2}));
+    QVERIFY(changes.changedRoles.isEmpty());
+}
+
+void tst_UpdateableModel::updateTree()
+{
+    TreeModel model;
+    model.update({node(1, {node(11), node(12, {node(121), node(122)})}), node(2, {node(21)}), node(3)});
+    QCOMPARE(model.rowCount(), 3);
+    const QModelIndex twelve = model.index(1, 0, model.index(0, 0));
+    QCOMPARE(model.rowCount(twelve), 2);
+
+    const QPersistentModelIndex kept = model.index(0, 0, twelve); // 121
+    const QPersistentModelIndex removed = model.index(1, 0, twelve); // 122
+    QSignalSpy insertedSpy(&model, &QAbstractItemModel::rowsInserted);
+    QSignalSpy removedSpy(&model, &QAbstractItemModel::rowsRemoved);
+    QSignalSpy changedSpy(&model, &QAbstractItemModel::dataChanged);
+    QSignalSpy resetSpy(&model, &QAbstractItemModel::modelReset);
+    model.m_comparisons = 0;
+
+    model.update({node(1, {node(11, {}, QStringLiteral("eleven")), node(12, {node(121), node(123)})}),
+                  node(2, {node(21)}), node(4)});
+
+    QCOMPARE(resetSpy.count(), 0);
+    QCOMPARE(model.rowCount(), 3);
+    QCOMPARE(model.index(2, 0).data(Qt::UserRole).toInt(), 4);
+    QCOMPARE(model.index(0, 0, model.index(0, 0)).data().toString(), QStringLiteral("eleven"));
+    QCOMPARE(model.index(1, 0, twelve).data(Qt::UserRole).toInt(), 123);
+    QVERIFY(kept.isValid());
+    QCOMPARE(kept.data(Qt::UserRole).toInt(), 121);
+    QVERIFY(!removed.isValid());
+
+    // 122 below 12 and 3 at the top level were removed, 123 and 4 inserted in their place
+    QCOMPARE(removedSpy.count(), 2);
+    QCOMPARE(removedSpy.at(0).at(0).value<QModelIndex>().data(Qt::UserRole).toInt(), 12);
+    QVERIFY(!removedSpy.at(1).at(0).value<QModelIndex>().isValid());
+    QCOMPARE(insertedSpy.count(), 2);
+    QCOMPARE(insertedSpy.at(0).at(0).value<QModelIndex>().data(Qt::UserRole).toInt(), 12);
+    QVERIFY(!insertedSpy.at(1).at(0).value<QModelIndex>().isValid());
+    QCOMPARE(changedSpy.count(), 1);
+    QCOMPARE(changedSpy.at(0).at(0).value<QModelIndex>().data(Qt::UserRole).toInt(), 11);
+
+    // the subtrees of 2 and 121 did not change, so only 1, 11 and 12 were compared
+    QCOMPARE(model.m_comparisons, 3);
+
+    // the apply policy does not apply to tree updates, which keep the persistent indexes below
+    //   the top level up to date
+    model.rebuildAbove(0);
+    QSignalSpy layoutSpy(&model, &QAbstractItemModel::layoutChanged);
+    model.update({node(0), node(1, {node(11, {}, QStringLiteral("eleven")), node(12, {node(121), node(123)})}),
+                  node(4), node(5, {node(51)})});
+    QCOMPARE(layoutSpy.count(), 0);
+    QCOMPARE(model.rowCount(), 4);
+    QVERIFY(kept.isValid());
+    QCOMPARE(kept.data(Qt::UserRole).toInt(), 121);
+    QCOMPARE(kept.parent().parent().row(), 1);
+
+    // with an assignment of the own fields, changed items do not copy their children
+    const auto ops = model.updateOwnFields(
+        {node(0), node(1, {node(11), node(12, {node(121, {}, QStringLiteral("one two one")), node(123)})}), node(4),
+         node(5, {node(51)})});
+    // 11 and 121 changed; 1 and 12 were only compared, as their children changed
+    QCOMPARE(ops.updates, 2u);
+    QCOMPARE(model.m_assignments, 2);
+    QCOMPARE(model.index(0, 0, model.index(1, 0)).data().toString(), QStringLiteral("11"));
+    QCOMPARE(kept.data().toString(), QStringLiteral("one two one"));
+    QCOMPARE(model.rowCount(kept.parent()), 2);
+}
+
+QTEST_MAIN(tst_UpdateableModel)
+
+#include "tst_updateablemodel.moc"
@@ -0,0 +1,411 @@
+/*
+  This file is part of KDToolBox.
+
+  SPDX-FileCopyrightText: 2026 Klarälvdalens Datakonsult AB, a KDAB Group company <info@kdab.com>
+
+  SPDX-License-Identifier: MIT
+*/
+
+#include "../UpdateableModel.h"
+
+#include <QAbstractTableModel>
+#include <QTest>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+
+// Counts every allocation through operator new, which includes the standard containers used by
+//   the model and by the update algorithms. Qt's own containers allocate through malloc, and are not
+//   counted. The operators are not inlined, so the compiler does not see malloc and free paired with
+//   new and delete.
+static std::atomic<qint64> allocationCount{0};
+
+Q_NEVER_INLINE void *operator new(std::size_t size)
+{
+    ++allocationCount;
+    if (void *memory = std::malloc(size == 0 ? 1 : size))
+        return memory;
+    throw std::bad_alloc();
+}
+
+Q_NEVER_INLINE void operator delete(void *memory) noexcept
+{
+    std::free(memory);
+}
+
+Q_NEVER_INLINE void operator delete(void *memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+struct Row
+{
+    int id;
+    int name;
+    double value;
+};
+
+/**
+ * Table model with the name in the first column, and the value in the second. Changing the name
+ * changes the display role only, changing the value changes the user role as well, so the change
+ * merge policies merge different ranges.
+ */
+template<typename Model>
+class RowTableModel : public Model
+{
+public:
+    using typename Model::DataChanges;
+    using typename Model::Operations;
+
+    explicit RowTableModel(int policy = Model::MergeOnPerfectMatch, bool rebuild = false)
+    {
+        this->setChangeMergePolicy(static_cast<typename Model::ChangeMergePolicy>(policy));
+        this->setApplyPolicy(rebuild ? Model::RebuildAboveThreshold : Model::AlwaysEditInPlace);
+    }
+
+    Operations update(const std::vector<Row> &rows) { return this->updateData(rows.cbegin(), rows.cend(), m_rows); }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override
+    {
+        return parent.isValid() ? 0 : static_cast<int>(m_rows.size());
+    }
+
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override { return parent.isValid() ? 0 : 2; }
+
+    QVariant data(const QModelIndex &index, int role) const override
+    {
+        const Row &row = m_rows[index.row()];
+        if (role == Qt::DisplayRole)
+            return index.column() == 0 ? QVariant(row.name) : QVariant(row.value);
+        if (role == Qt::UserRole && index.column() == 1)
+            return row.value;
+        return {};
+    }
+
+    bool lessThan(const Row &lhs, const Row &rhs) const override { return lhs.id < rhs.id; }
+
+    DataChanges itemHasChanged(const Row &lhs, const Row &rhs) const override
+    {
+        DataChanges changes;
+        if (lhs.name != rhs.name)
+        {
+            changes.changedColumns.insert(0);
+            changes.changedRoles.insert(Qt::DisplayRole);
+        }
+        if (lhs.value != rhs.value)
+        {
+            changes.changedColumns.insert(1);
+            changes.changedRoles.insert(Qt::DisplayRole);
+            changes.changedRoles.insert(Qt::UserRole);
+        }
+        return changes;
+    }
+
+    std::vector<Row> m_rows;
+};
+
+class RowModel : public RowTableModel<UpdateableModel<QAbstractTableModel, Row>>
+{
+public:
+    using RowTableModel::RowTableModel;
+
+    Operations updateByKey(const std::vector<Row> &rows)
+    {
+        return updateDataByKey(rows.cbegin(), rows.cend(), m_rows, [](const Row &row) { return row.id; });
+    }
+};
+
+// the same model, with lessThan and itemHasChanged dispatched at compile time
+class StaticRowModel : public RowTableModel<StaticUpdateableModel<QAbstractTableModel, Row, StaticRowModel>>
+{
+public:
+    using RowTableModel::RowTableModel;
+};
+
+/**
+ * Counts the signals emitted by a model and the allocations made while it is updated, so the
+ * benchmarks can report them next to the wall time. The number of dataChanged signals is what the
+ * change merge policies trade against the number of cells views update needlessly.
+ */
+class SignalCounter : public QObject
+{
+public:
+    explicit SignalCounter(QAbstractItemModel *model)
+    {
+        connect(model, &QAbstractItemModel::dataChanged, this, [this]() { ++dataChanges; });
+        connect(model, &QAbstractItemModel::rowsInserted, this, [this]() { ++inserts; });
+        connect(model, &QAbstractItemModel::rowsRemoved, this, [this]() { ++removals; });
+        connect(model, &QAbstractItemModel::rowsMoved, this, [this]() { ++moves; });
+        connect(model, &QAbstractItemModel::layoutChanged, this, [this]() { ++layoutChanges; });
+    }
+
+    void start() { m_allocationsAtStart = allocationCount; }
+
+    void report(int updates) const
+    {
+        const double count = std::max(updates, 1);
+        qInfo("%s: per update %.1f data changes, %.1f inserts, %.1f removals, %.1f moves, %.1f layout changes, "
+              "%.1f allocations",
+              QTest::currentDataTag(), dataChanges / count, inserts / count, removals / count, moves / count,
+              layoutChanges / count, (allocationCount - m_allocationsAtStart) / count);
+    }
+
+    int dataChanges = 0;
+    int inserts = 0;
+    int removals = 0;
+    int moves = 0;
+    int layoutChanges = 0;
+
+private:
+    qint64 m_allocationsAtStart = 0;
+};
+
+class UpdateableModelBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    using QObject::QObject;
+
+private Q_SLOTS:
+    void mostlyUnchanged_data();
+    void mostlyUnchanged();
+    void heavyChurn_data();
+    void heavyChurn();
+    void appendOnly_data();
+    void appendOnly();
+    void reversedOrder_data();
+    void reversedOrder();
+    void staticDispatch_data();
+    void staticDispatch();
+};
+
+// the number of snapshots replayed after the initial one
+constexpr int updateCount = 4;
+
+// @p maxRowsInPlace leaves out editing larger models in place, for sequences where that is quadratic
+static void addRowCountsAndPolicies(bool withRebuild = false, int maxRowsInPlace = 1000000)
+{
+    QTest::addColumn<int>("rowCount");
+    QTest::addColumn<int>("policy");
+    QTest::addColumn<bool>("rebuild");
+
+    const char *const policyNames[] = {"AlwaysMergeNeighbouringRows", "MergeWhenColumnsMatch", "MergeWhenRolesMatch",
+                                       "MergeOnPerfectMatch"};
+    for (int rowCount : {10000, 100000, 1000000})
+    {
+        for (int policy = 0; policy < 4; ++policy)
+        {
+            if (rowCount <= maxRowsInPlace)
+                QTest::addRow("%d rows, %s", rowCount, policyNames[policy]) << rowCount << policy << false;
+            if (withRebuild)
+                QTest::addRow("%d rows, %s, rebuilt", rowCount, policyNames[policy]) << rowCount << policy << true;
+        }
+    }
+}
+
+// rows with even ids, so new rows can be inserted in between
+static std::vector<Row> initialRows(int rowCount)
+{
+    std::vector<Row> rows;
+    rows.reserve(rowCount);
+    for (int i = 0; i < rowCount; ++i)
+        rows.push_back({2 * i, i, 0.0});
+    return rows;
+}
+
+// changes the name or the value of every row with a probability of @p fraction
+static void changeRows(std::vector<Row> &rows, double fraction, std::mt19937 &generator)
+{
+    std::bernoulli_distribution changed(fraction);
+    for (Row &row : rows)
+    {
+        if (!changed(generator))
+            continue;
+        if (generator() % 2 == 0)
+            ++row.name;
+        else
+            row.value += 1.0;
+    }
+}
+
+/**
+ * Replays @p snapshots on a model that starts with the first one, and reports the signals and
+ * allocations. Replaying changes the model, so the sequence is measured once.
+ */
+static void replay(const std::vector<std::vector<Row>> &snapshots, bool byKey = false)
+{
+    QFETCH(int, policy);
+    QFETCH(bool, rebuild);
+
+    RowModel model(policy, rebuild);
+    model.update(snapshots.front());
+    SignalCounter counter(&model);
+    counter.start();
+    QBENCHMARK_ONCE
+    {
+        for (std::size_t i = 1; i < snapshots.size(); ++i)
+        {
+            if (byKey)
+                model.updateByKey(snapshots[i]);
+            else
+                model.update(snapshots[i]);
+        }
+    }
+    counter.report(static_cast<int>(snapshots.size()) - 1);
+
+    QCOMPARE(model.rowCount(), static_cast<int>(snapshots.back().size()));
+}
+
+void UpdateableModelBenchmark::mostlyUnchanged_data()
+{
+    addRowCountsAndPolicies();
+}
+
+void UpdateableModelBenchmark::mostlyUnchanged()
+{
+    QFETCH(int, rowCount);
+
+    // one percent of the rows change in every snapshot
+    std::mt19937 generator(42);
+    std::vector<std::vector<Row>> snapshots{initialRows(rowCount)};
+    for (int i = 0; i < updateCount; ++i)
+    {
+        snapshots.push_back(snapshots.back());
+        changeRows(snapshots.back(), 0.01, generator);
+    }
+
+    replay(snapshots);
+}
+
+void UpdateableModelBenchmark::heavyChurn_data()
+{
+    addRowCountsAndPolicies(true);
+}
+
+void UpdateableModelBenchmark::heavyChurn()
+{
+    QFETCH(int, rowCount);
+    QFETCH(bool, rebuild);
+
+    // every run of removed or inserted rows shifts all rows after it, and this has runs all over
+    //   the model; beyond 100000 rows only rebuilding the model finishes in reasonable time
+    if (rowCount > 100000 && !rebuild)
+        QSKIP("editing this many rows in place takes too long");
+
+    // in every snapshot, a tenth of the rows is removed, as many new ones are inserted in between,
+    //   and a tenth of the rest changes
+    std::mt19937 generator(42);
+    std::bernoulli_distribution picked(0.1);
+    std::vector<std::vector<Row>> snapshots{initialRows(rowCount)};
+    for (int i = 0; i < updateCount; ++i)
+    {
+        const std::vector<Row> &previous = snapshots.back();
+        std::vector<Row> next;
+        next.reserve(previous.size());
+        for (const Row &row : previous)
+        {
+            if (picked(generator))
+                continue;
+            if (picked(generator) && row.id % 2 == 0)
+                next.push_back({row.id - 1, row.name, row.value});
+            next.push_back(row);
+        }
+        // a row inserted in an earlier snapshot may have been inserted again
+        const auto sameId = [](const Row &lhs, const Row &rhs) { return lhs.id == rhs.id; };
+        next.erase(std::unique(next.begin(), next.end(), sameId), next.end());
+        changeRows(next, 0.1, generator);
+        snapshots.push_back(std::move(next));
+    }
+
+    replay(snapshots);
+}
+
+void UpdateableModelBenchmark::appendOnly_data()
+{
+    addRowCountsAndPolicies();
+}
+
+void UpdateableModelBenchmark::appendOnly()
+{
+    QFETCH(int, rowCount);
+
+    // every snapshot adds one percent of new rows at the end
+    std::vector<std::vector<Row>> snapshots{initialRows(rowCount)};
+    for (int i = 0; i < updateCount; ++i)
+    {
+        std::vector<Row> next = snapshots.back();
+        const int firstId = next.back().id + 2;
+        for (int j = 0; j < rowCount / 100; ++j)
+            next.push_back({firstId + 2 * j, j, 0.0});
+        snapshots.push_back(std::move(next));
+    }
+
+    replay(snapshots);
+}
+
+void UpdateableModelBenchmark::reversedOrder_data()
+{
+    // reversing moves every row on its own, and every move shifts the rows in between, so editing
+    //   in place is quadratic; rebuilding reorders the rows in a single pass
+    addRowCountsAndPolicies(true, 10000);
+}
+
+void UpdateableModelBenchmark::reversedOrder()
+{
+    QFETCH(int, rowCount);
+
+    std::vector<std::vector<Row>> snapshots{initialRows(rowCount)};
+    for (int i = 0; i < updateCount; ++i)
+    {
+        snapshots.push_back(snapshots.back());
+        std::reverse(snapshots.back().begin(), snapshots.back().end());
+    }
+
+    replay(snapshots, true);
+}
+
+void UpdateableModelBenchmark::staticDispatch_data()
+{
+    QTest::addColumn<bool>("staticDispatch");
+
+    QTest::newRow("virtual") << false;
+    QTest::newRow("static") << true;
+}
+
+template<typename Model>
+static void benchmarkUpdates(const std::vector<Row> &original, const std::vector<Row> &changed)
+{
+    Model model;
+    model.update(original);
+    bool toChanged = true;
+    QBENCHMARK
+    {
+        model.update(toChanged ? changed : original);
+        toChanged = !toChanged;
+    }
+}
+
+void UpdateableModelBenchmark::staticDispatch()
+{
+    QFETCH(bool, staticDispatch);
+
+    // a million rows, of which every 20th changes, so the time goes into comparing the rows
+    constexpr int rowCount = 1000000;
+    const std::vector<Row> original = initialRows(rowCount);
+    std::vector<Row> changed = original;
+    for (int i = 0; i < rowCount; i += 20)
+        ++changed[i].name;
+
+    if (staticDispatch)
+        benchmarkUpdates<StaticRowModel>(original, changed);
+    else
+        benchmarkUpdates<RowModel>(original, changed);
+}
+
+QTEST_MAIN(UpdateableModelBenchmark)
+
+#include "tst_updateablemodelbenchmark.moc"